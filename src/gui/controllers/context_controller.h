@@ -68,91 +68,3 @@ struct SearchContext {
     std::unordered_set<uint32_t> includedPlatformTags;
     std::unordered_set<uint32_t> excludedPlatformTags;
 };
-
-inline bool isMatchFilter(const PicInfo& pic, const FilterContext& filterCtx) {
-    if (!filterCtx.showUnknowPlatform && pic.sourceIdentifiers.empty()) return false;
-    for (const auto& source : pic.sourceIdentifiers) {
-        if (source.platform == PlatformType::Pixiv && !filterCtx.showPixiv) return false;
-        if (source.platform == PlatformType::Twitter && !filterCtx.showTwitter) return false;
-    }
-    if (!filterCtx.showPNG && pic.fileType == ImageFormat::PNG) return false;
-    if (!filterCtx.showJPG && pic.fileType == ImageFormat::JPG) return false;
-    if (!filterCtx.showGIF && pic.fileType == ImageFormat::GIF) return false;
-    if (!filterCtx.showWEBP && pic.fileType == ImageFormat::WebP) return false;
-
-    if (!filterCtx.showUnknowRestrict && pic.restrictType == RestrictType::Unknown) return false;
-    if (!filterCtx.showAllAge && pic.restrictType == RestrictType::AllAges) return false;
-    if (!filterCtx.showSensitive && pic.restrictType == RestrictType::Sensitive) return false;
-    if (!filterCtx.showQuestionable && pic.restrictType == RestrictType::Questionable) return false;
-    if (!filterCtx.showR18 && pic.restrictType == RestrictType::R18) return false;
-    if (!filterCtx.showR18G && pic.restrictType == RestrictType::R18G) return false;
-
-    if (!filterCtx.showUnknowAI && pic.aiType == AIType::Unknown) return false;
-    if (!filterCtx.showAI && pic.aiType == AIType::AI) return false;
-    if (!filterCtx.showNonAI && pic.aiType == AIType::NotAI) return false;
-
-    if (pic.width > filterCtx.maxWidth) return false;
-    if (pic.width < filterCtx.minWidth) return false;
-    if (pic.height > filterCtx.maxHeight) return false;
-    if (pic.height < filterCtx.minHeight) return false;
-
-    return true;
-};
-inline bool isMatchFilter(const Metadata& metadata, const FilterContext& filterCtx) {
-    if (!filterCtx.showUnknowPlatform && metadata.platformType == PlatformType::Unknown) return false;
-    if (metadata.platformType == PlatformType::Pixiv && !filterCtx.showPixiv) return false;
-    if (metadata.platformType == PlatformType::Twitter && !filterCtx.showTwitter) return false;
-
-    if (!filterCtx.showUnknowRestrict && metadata.restrictType == RestrictType::Unknown) return false;
-    if (!filterCtx.showAllAge && metadata.restrictType == RestrictType::AllAges) return false;
-    if (!filterCtx.showSensitive && metadata.restrictType == RestrictType::Sensitive) return false;
-    if (!filterCtx.showQuestionable && metadata.restrictType == RestrictType::Questionable) return false;
-    if (!filterCtx.showR18 && metadata.restrictType == RestrictType::R18) return false;
-    if (!filterCtx.showR18G && metadata.restrictType == RestrictType::R18G) return false;
-
-    if (!filterCtx.showUnknowAI && metadata.aiType == AIType::Unknown) return false;
-    if (!filterCtx.showAI && metadata.aiType == AIType::AI) return false;
-    if (!filterCtx.showNonAI && metadata.aiType == AIType::NotAI) return false;
-
-    return true;
-};
-inline bool comparePicInfo(const PicInfo& a, const PicInfo& b, const SortContext& sortContext) {
-    switch (sortContext.sortBy) {
-    case SortBy::ID:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.id < b.id : a.id > b.id;
-    case SortBy::DownloadDate:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.downloadTime < b.downloadTime : a.downloadTime > b.downloadTime;
-    case SortBy::EditDate:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.editTime < b.editTime : a.editTime > b.editTime;
-    case SortBy::Size:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.size < b.size : a.size > b.size;
-    case SortBy::Filename:
-        return sortContext.sortOrder == SortOrder::Ascending
-                   ? a.filePaths[0].filename().string() < b.filePaths[0].filename().string()
-                   : a.filePaths[0].filename().string() > b.filePaths[0].filename().string();
-    case SortBy::Width:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.width < b.width : a.width > b.width;
-    case SortBy::Height:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.height < b.height : a.height > b.height;
-    case SortBy::Ratio:
-        return std::abs(sortContext.ratio - a.getRatio()) < std::abs(sortContext.ratio - b.getRatio());
-    default:
-        return false;
-    }
-};
-inline bool comparePicItems(const PicItem& a, const PicItem& b, const SortContext& sortContext) {
-    return comparePicInfo(a.info, b.info, sortContext);
-};
-inline bool compareMetadata(const Metadata& a, const Metadata& b, const SortContext& sortContext) {
-    switch (sortContext.sortBy) {
-    case SortBy::ID:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.id < b.id : a.id > b.id;
-    case SortBy::DownloadDate:
-        return sortContext.sortOrder == SortOrder::Ascending ? a.date < b.date : a.date > b.date;
-    default:
-        return false;
-    }
-};
-inline bool compareMetadataItems(const MetadataItem& a, const MetadataItem& b, const SortContext& sortContext) {
-    return compareMetadata(a.metadata, b.metadata, sortContext);
-};
\ No newline at end of file
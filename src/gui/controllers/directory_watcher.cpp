@@ -0,0 +1,195 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "directory_watcher.h"
+#include "utils/logger.h"
+#include <QMetaObject>
+#include <QStringList>
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+
+DirectoryWatcher::DirectoryWatcher(QObject* parent) : QObject(parent) {
+    batchTimer.setSingleShot(true);
+    connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &DirectoryWatcher::handleDirectoryChanged);
+    connect(&batchTimer, &QTimer::timeout, this, &DirectoryWatcher::changesReady);
+}
+DirectoryWatcher::~DirectoryWatcher() {
+    stopScan();
+}
+void DirectoryWatcher::setRoots(const std::vector<std::pair<std::filesystem::path, ParserType>>& roots) {
+    stopScan(); // roots it did not finish are scanned again below
+    this->roots.clear();
+    for (const auto& [root, parserType] : roots) {
+        this->roots.emplace(root.string(), parserType);
+    }
+    for (auto it = scannedRoots.begin(); it != scannedRoots.end();) {
+        auto root = this->roots.find(it->first);
+        if (root != this->roots.end() && root->second == it->second) {
+            ++it;
+            continue;
+        }
+        std::string removedRoot = it->first;
+        it = scannedRoots.erase(it);
+        unwatchRoot(removedRoot);
+    }
+    if (changedDirs.empty()) batchTimer.stop();
+
+    std::vector<std::pair<std::string, ParserType>> newRoots;
+    for (const auto& root : this->roots) {
+        if (scannedRoots.find(root.first) == scannedRoots.end()) newRoots.push_back(root);
+    }
+    if (newRoots.empty()) return;
+
+    size_t generation = ++scanGeneration;
+    scanThread = std::thread([this, newRoots, generation]() {
+        for (const auto& [root, parserType] : newRoots) {
+            std::vector<std::string> directories = collectDirectories(root, &scanStop);
+            if (scanStop.load()) return; // the list is incomplete
+            QMetaObject::invokeMethod(
+                this,
+                [this, directories = std::move(directories), root = root, parserType = parserType, generation]() {
+                    if (generation != scanGeneration) return; // setRoots was called again, it scans this root itself
+                    scannedRoots.emplace(root, parserType);
+                    watchDirectories(directories, parserType, false);
+                },
+                Qt::QueuedConnection);
+        }
+    });
+}
+void DirectoryWatcher::stopScan() {
+    if (!scanThread.joinable()) return;
+    scanStop.store(true);
+    scanThread.join();
+    scanStop.store(false);
+    ++scanGeneration;
+}
+void DirectoryWatcher::unwatchRoot(const std::string& root) {
+    auto isUnder = [](const std::string& directory, const std::string& root) {
+        std::filesystem::path relative = std::filesystem::path(directory).lexically_relative(root);
+        return !relative.empty() && *relative.begin() != "..";
+    };
+    QStringList paths;
+    for (auto it = watchedDirs.begin(); it != watchedDirs.end();) {
+        bool keep = !isUnder(it->first, root);
+        for (auto scanned = scannedRoots.begin(); !keep && scanned != scannedRoots.end(); ++scanned) {
+            keep = isUnder(it->first, scanned->first);
+        }
+        if (keep) {
+            ++it;
+            continue;
+        }
+        paths.append(QString::fromStdString(it->first));
+        changedDirs.erase(it->first);
+        it = watchedDirs.erase(it);
+    }
+    if (!paths.isEmpty()) watcher.removePaths(paths);
+    Info() << "Watching directories:" << watchedDirs.size();
+}
+WatchedChanges DirectoryWatcher::takeChanges() {
+    WatchedChanges changes;
+    if (changedDirs.empty()) return changes;
+    changes.parserType = changedDirs.begin()->second;
+
+    // notifications do not say what changed, new subdirectories are looked for here once per batch
+    std::vector<std::string> newDirectories;
+    std::unordered_set<std::string> unsettledDirs; // imported now and checked again in the next batch
+    const auto now = std::filesystem::file_time_type::clock::now();
+    for (const auto& [directory, parserType] : changedDirs) {
+        if (parserType != changes.parserType) continue;
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec); !ec && it != std::filesystem::directory_iterator();
+             it.increment(ec)) {
+            std::error_code entryEc;
+            if (it->is_regular_file(entryEc)) { // may still be written, a later size or mtime change is imported again
+                auto age = now - it->last_write_time(entryEc);
+                if (!entryEc && age >= decltype(age)::zero() && age < std::chrono::milliseconds(WATCH_BATCH_DELAY)) {
+                    unsettledDirs.insert(directory);
+                }
+                continue;
+            }
+            if (!it->is_directory(entryEc) || it->is_symlink(entryEc)) continue;
+            if (watchedDirs.find(it->path().string()) != watchedDirs.end()) continue;
+            for (auto& subdirectory : collectDirectories(it->path())) { // files may have arrived before the watch
+                newDirectories.push_back(std::move(subdirectory));
+            }
+        }
+    }
+    watchDirectories(newDirectories, changes.parserType, true);
+
+    for (auto it = changedDirs.begin(); it != changedDirs.end();) {
+        if (it->second == changes.parserType) {
+            changes.directories.emplace_back(it->first);
+            it = unsettledDirs.count(it->first) ? std::next(it) : changedDirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    return changes;
+}
+void DirectoryWatcher::postpone() {
+    batchStart = std::chrono::steady_clock::now();
+    batchTimer.start(WATCH_BATCH_DELAY);
+}
+void DirectoryWatcher::handleDirectoryChanged(const QString& path) {
+    std::string directory = path.toStdString();
+    auto it = watchedDirs.find(directory);
+    if (it == watchedDirs.end()) return;
+    std::error_code ec;
+    if (!std::filesystem::is_directory(directory, ec)) { // removed, the watch went with it
+        watchedDirs.erase(it);
+        changedDirs.erase(directory);
+        return;
+    }
+    changedDirs.emplace(directory, it->second);
+    startBatchTimer();
+}
+void DirectoryWatcher::startBatchTimer() {
+    auto now = std::chrono::steady_clock::now();
+    if (!batchTimer.isActive()) batchStart = now;
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - batchStart).count();
+    batchTimer.start(static_cast<int>(std::clamp<long long>(WATCH_BATCH_MAX_DELAY - waited, 0, WATCH_BATCH_DELAY)));
+}
+void DirectoryWatcher::watchDirectories(const std::vector<std::string>& directories, ParserType parserType, bool changed) {
+    QStringList paths;
+    for (const auto& directory : directories) {
+        if (!watchedDirs.emplace(directory, parserType).second) continue;
+        paths.append(QString::fromStdString(directory));
+        if (changed) changedDirs.emplace(directory, parserType);
+    }
+    if (paths.isEmpty()) return;
+    QStringList failed = watcher.addPaths(paths);
+    if (!failed.isEmpty()) { // usually the inotify watch limit, fs.inotify.max_user_watches
+        Warn() << "Failed to watch directories:" << failed.size() << "of" << paths.size();
+    }
+    Info() << "Watching directories:" << watchedDirs.size();
+}
+std::vector<std::string> DirectoryWatcher::collectDirectories(const std::filesystem::path& root,
+                                                             const std::atomic<bool>* stop) {
+    std::vector<std::string> directories{root.string()};
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, ec);
+    std::filesystem::recursive_directory_iterator end;
+    for (; !ec && it != end; it.increment(ec)) {
+        if (stop && stop->load()) return directories;
+        std::error_code entryEc;
+        if (it->is_directory(entryEc) && !it->is_symlink(entryEc)) directories.push_back(it->path().string());
+    }
+    if (ec) Warn() << "Failed to list directory:" << root << "Error:" << ec.message();
+    return directories;
+}
@@ -0,0 +1,80 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "service/parser.h"
+#include <QFileSystemWatcher>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+constexpr int WATCH_BATCH_DELAY = 1000;      // ms without changes before the import, every change restarts the wait
+constexpr int WATCH_BATCH_MAX_DELAY = 10000; // ms from the first change, a long copy still gets imported as it goes
+
+struct WatchedChanges { // changed directories of one parser type, imported together
+    ParserType parserType = ParserType::None;
+    std::vector<std::filesystem::path> directories;
+};
+
+// watches picture directories and all their subdirectories with QFileSystemWatcher, which is backed by inotify on linux
+// and ReadDirectoryChangesW on windows, notifications only name the changed directory so changes are batched per directory
+class DirectoryWatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit DirectoryWatcher(QObject* parent = nullptr);
+    ~DirectoryWatcher();
+
+    // only added roots are scanned and only removed roots lose their watches, empty stops watching
+    void setRoots(const std::vector<std::pair<std::filesystem::path, ParserType>>& roots);
+    bool hasChanges() const { return !changedDirs.empty(); }
+    WatchedChanges takeChanges(); // every changed directory of the parser type that comes first
+    void postpone(); // another task is running, try again later
+
+signals:
+    void changesReady(); // sent once per batch, call takeChanges
+
+private:
+    QFileSystemWatcher watcher;
+    QTimer batchTimer;
+    std::chrono::steady_clock::time_point batchStart; // first change of the waiting batch
+    std::unordered_map<std::string, ParserType> watchedDirs;
+    std::map<std::string, ParserType> changedDirs; // waiting for the next batch
+
+    std::map<std::string, ParserType> roots;        // set by setRoots
+    std::map<std::string, ParserType> scannedRoots; // roots whose subdirectories are watched
+
+    std::thread scanThread; // lists the subdirectories of new roots, a large tree takes a while
+    std::atomic<bool> scanStop = false;
+    size_t scanGeneration = 0;
+
+    void handleDirectoryChanged(const QString& path);
+    void startBatchTimer();
+    void stopScan(); // the scan thread stops at its next directory, its queued results are dropped
+    void watchDirectories(const std::vector<std::string>& directories, ParserType parserType, bool changed);
+    void unwatchRoot(const std::string& root); // keeps directories that are also under another root
+    static std::vector<std::string> collectDirectories(const std::filesystem::path& root, // root and its subdirectories
+                                                       const std::atomic<bool>* stop = nullptr);
+};
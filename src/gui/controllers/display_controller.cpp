@@ -18,57 +18,114 @@
 
 #include "display_controller.h"
 #include "ui_main_window.h"
+#include <QCursor>
 #include <QScrollBar>
+#include <QVBoxLayout>
 
 // initialization
 
 DisplayController::DisplayController(Ui::MainWindow* ui, ImageLoader* imageLoader) : ui(ui), imageLoader(imageLoader) {}
 DisplayController::~DisplayController() {
+    imageLoader->setThumbnailPriority(nullptr);
+    if (picGrid) QObject::disconnect(picGrid, nullptr, nullptr, nullptr);
     if (displayItems) {
         delete displayItems;
         displayItems = nullptr;
     }
 }
-void DisplayController::setup() {
-    picFramePool = std::make_unique<PicFramePool>(ui->picBrowseWidget, imageLoader);
+void DisplayController::setup(std::function<void(uint64_t)> findSimilarHandler) {
+    picGrid = new PicGridWidget(ui->picBrowseWidget); // created before any frame so hover frames stack above it
+    auto* layout = new QVBoxLayout(ui->picBrowseWidget);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(picGrid);
+    QObject::connect(picGrid, &PicGridWidget::cellHovered, picGrid, [this](int index) { handleCellHovered(index); });
+    picFramePool = std::make_unique<PicFramePool>(ui->picBrowseWidget, imageLoader, std::move(findSimilarHandler));
+    imageLoader->setThumbnailPriority([this](uint64_t picId) { return thumbnailPriority(picId); });
 }
 void DisplayController::setDisplayItems(DisplayItems* displayItems, SearchField searchField) {
     clearDisplay();
     if (this->displayItems) delete this->displayItems; // delete previous displayItems
     this->displayItems = displayItems;
     this->displayMode = this->displayItems->type;
-    this->sortedItemIndices.resize(this->displayItems->type == DisplayItemType::Metadata
-                                       ? this->displayItems->metadataItems.size()
-                                       : this->displayItems->picItems.size());
+    this->sortedItemIndices.resize(itemCount());
     std::iota(this->sortedItemIndices.begin(), this->sortedItemIndices.end(), 0);
-    this->picFrames.resize(this->sortedItemIndices.size(), nullptr);
     this->searchField = searchField;
+    filterColumns.build(*this->displayItems);
+    matchCount = filterColumns.evaluate(filterCtx, filterSelection);
 
     resizing = true; // ignore scroll events during resizing
-    totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (sortedItemIndices.size() / picsPerRow + 1);
+    totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (matchCount / picsPerRow + 1);
     ui->picBrowseWidget->setMinimumHeight(totalHeight);
     resizing = false;
 }
+void DisplayController::appendDisplayItems(DisplayItems* displayItems) {
+    if (!this->displayItems || displayItems->type != displayMode) {
+        delete displayItems;
+        return;
+    }
+    releaseHoverFrame(); // the hover frame points into the item vectors, appending may reallocate them
+
+    // the chunk's cross references are relative to itself
+    size_t picOffset = this->displayItems->picItems.size();
+    size_t metadataOffset = this->displayItems->metadataItems.size();
+    for (auto& picItem : displayItems->picItems) {
+        picItem.metadataStartIndex += metadataOffset;
+    }
+    for (auto& metadataItem : displayItems->metadataItems) {
+        metadataItem.picStartIndex += picOffset;
+    }
+    auto& picItems = this->displayItems->picItems;
+    auto& metadataItems = this->displayItems->metadataItems;
+    picItems.insert(picItems.end(),
+                    std::make_move_iterator(displayItems->picItems.begin()),
+                    std::make_move_iterator(displayItems->picItems.end()));
+    metadataItems.insert(metadataItems.end(),
+                         std::make_move_iterator(displayItems->metadataItems.begin()),
+                         std::make_move_iterator(displayItems->metadataItems.end()));
+    delete displayItems;
+
+    filterColumns.build(*this->displayItems);
+    matchCount = filterColumns.evaluate(filterCtx, filterSelection);
+    // sorted items may go anywhere, so they are held out of sortedItemIndices until finishDisplayItems sorts them in once
+    if (sortCtx.sortBy == SortBy::None) { // new items go after the shown ones, nothing already displayed moves
+        size_t oldItemCount = sortedItemIndices.size();
+        sortedItemIndices.resize(itemCount());
+        std::iota(sortedItemIndices.begin() + oldItemCount, sortedItemIndices.end(), static_cast<int>(oldItemCount));
+        resizing = true; // ignore scroll events during resizing
+        totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (matchCount / picsPerRow + 1);
+        ui->picBrowseWidget->setMinimumHeight(totalHeight);
+        resizing = false;
+        displayPicFrames(); // fills the viewport if the previous chunks did not
+    }
+    updateHoverFromCursor();
+}
+void DisplayController::finishDisplayItems() {
+    if (!displayItems || sortedItemIndices.size() == itemCount()) return; // nothing held back
+    sortDisplayItems(sortCtx);
+}
 
 // helper functions
 
 void DisplayController::clearDisplay() {
-    displayingItemIndices.clear();
-    scrollBarValue = 0;
-    picIdToFrameIdxMap.clear();
-    nextMatchSortedIndex = 0;
     if (displaying) {
+        releaseHoverFrame();
         for (int i = startDisplayIndex; i < endDisplayIndex; i++) {
-            picFramePool->release(picFrames[i]);
+            if (const PicInfo* info = getThumbnailPicInfo(i)) imageLoader->cancel(info->id, LoadType::Thumbnail);
         }
     }
-    std::fill(picFrames.begin(), picFrames.end(), nullptr);
+    picGrid->clearCells();
+    cancelPrefetch();
+    prefetchPlanner.reset();
+    displayingItemIndices.clear();
+    scrollBarValue = 0;
+    picIdToFrameIdxMap.clear();
+    nextMatchSortedIndex = 0;
     startDisplayIndex = 0;
     endDisplayIndex = 0;
     resizing = true; // ignore scroll events during resizing
     ui->picBrowseScrollArea->verticalScrollBar()->setValue(0);
     // update totalHeight to max possible height, will be updated when displaying items
-    totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (sortedItemIndices.size() / picsPerRow + 1);
+    totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (matchCount / picsPerRow + 1);
     ui->picBrowseWidget->setMinimumHeight(totalHeight);
     resizing = false;
 
@@ -80,10 +137,10 @@ void DisplayController::displayImage(uint64_t picId, LoadType loadType) {
     if (it != picIdToFrameIdxMap.end()) {
         int idx = it->second;
         if (idx < startDisplayIndex || idx >= endDisplayIndex) return; // not currently displayed
-        PictureFrame* picFrame = picFrames[idx];
-        if (picFrame) {
-            picFrame->displayImage(picId, loadType);
-        }
+        if (hoverFrame && idx == hoverIndex) hoverFrame->displayImage(picId, loadType);
+        if (loadType != LoadType::Thumbnail) return; // previews are only shown by the hover frame
+        const PicInfo* info = getThumbnailPicInfo(idx);
+        if (info && info->id == picId) picGrid->setThumbnail(idx, imageLoader->getImage(picId, loadType));
     }
 }
 Vec2 DisplayController::getPicFramePosition(int displayIndex) const {
@@ -94,6 +151,31 @@ Vec2 DisplayController::getPicFramePosition(int displayIndex) const {
     int y = MARGIN + row * (PIC_FRAME_HEIGHT + SPACING);
     return Vec2{x, y};
 }
+int DisplayController::thumbnailPriority(uint64_t picId) const {
+    auto it = picIdToFrameIdxMap.find(picId);
+    if (it != picIdToFrameIdxMap.end() && it->second >= frameStartIndex && it->second < frameEndIndex) {
+        int idx = it->second;
+        int distance = std::min(std::abs(idx - lookingAt), VISIBLE_THUMBNAIL_PRIORITY - 1);
+        if (idx >= visibleStartIndex && idx < visibleEndIndex) return VISIBLE_THUMBNAIL_PRIORITY + distance;
+        return PRELOAD_THUMBNAIL_PRIORITY + distance;
+    }
+    auto prefetchIt = prefetchIdxMap.find(picId);
+    if (prefetchIt != prefetchIdxMap.end()) {
+        int distance = std::min(std::abs(prefetchIt->second - lookingAt), PREFETCH_THUMBNAIL_PRIORITY - 1);
+        return PREFETCH_THUMBNAIL_PRIORITY + distance;
+    }
+    return LOWEST_LOAD_PRIORITY;
+}
+size_t DisplayController::itemCount() const {
+    return displayMode == DisplayItemType::Metadata ? displayItems->metadataItems.size() : displayItems->picItems.size();
+}
+const PicInfo* DisplayController::getThumbnailPicInfo(int displayIndex) const { // the picture shown by a frame
+    int displayItemIdx = displayingItemIndices[displayIndex];
+    if (displayMode == DisplayItemType::Pic) return &displayItems->picItems[displayItemIdx].info;
+    const MetadataItem& metadataItem = displayItems->metadataItems[displayItemIdx];
+    if (metadataItem.picCount == 0) return nullptr;
+    return &displayItems->picItems[metadataItem.picStartIndex].info;
+}
 
 // display functions
 
@@ -103,9 +185,13 @@ void DisplayController::displayPicFrames() {
     int viewportTopRow = std::max(0, (scrollBarValue - MARGIN)) / (PIC_FRAME_HEIGHT + SPACING);
     int viewportBottomRow = (std::max(0, (scrollBarValue + viewportHeight - MARGIN)) / (PIC_FRAME_HEIGHT + SPACING)) + 1;
     int viewportRowDiff = viewportBottomRow - viewportTopRow;
+    visibleStartIndex = viewportTopRow * picsPerRow;
+    visibleEndIndex = viewportBottomRow * picsPerRow;
 
     int newStartDisplayIndex = std::max(0, viewportTopRow - PRE_LOAD_ROWS) * picsPerRow;
     int newEndDisplayIndex = (viewportBottomRow + PRE_LOAD_ROWS) * picsPerRow;
+    frameStartIndex = newStartDisplayIndex; // set before acquiring, new frames request thumbnails right away
+    frameEndIndex = newEndDisplayIndex;
 
     if (displaying && newStartDisplayIndex == startDisplayIndex && newEndDisplayIndex == endDisplayIndex) return; // no change
 
@@ -128,40 +214,11 @@ void DisplayController::displayPicFrames() {
                 if (i >= newEndDisplayIndex) break; // no more items to display
             }
 
-            int displayItemIdx = displayingItemIndices[i];
-            PicItem* picItem = nullptr;
-            MetadataItem* metadataItem = nullptr;
-            switch (displayMode) {
-            case DisplayItemType::Pic:
-                picItem = &displayItems->picItems[displayItemIdx];
-                if (picItem->metadataCount > 0) {
-                    metadataItem = &displayItems->metadataItems[picItem->metadataStartIndex];
-                }
-                picIdToFrameIdxMap[picItem->info.id] = i;
-                break;
-            case DisplayItemType::Metadata:
-                metadataItem = &displayItems->metadataItems[displayItemIdx];
-                if (metadataItem->picCount > 0) {
-                    picItem = &displayItems->picItems[metadataItem->picStartIndex];
-                    for (int j = metadataItem->picStartIndex; j < metadataItem->picStartIndex + metadataItem->picCount; j++) {
-                        picIdToFrameIdxMap[displayItems->picItems[j].info.id] = i;
-                    }
-                }
-                break;
-            }
-            PictureFrame* picFrame = picFramePool->acquire(picItem, metadataItem, searchField);
-            while (picFrames.size() <= i)
-                picFrames.push_back(nullptr);
-
-            picFrames[i] = picFrame;
-
-            Vec2 pos = getPicFramePosition(i);
-            picFrame->move(pos.x, pos.y);
+            showCell(i);
         }
     } else if (newEndDisplayIndex < endDisplayIndex) { // release frames at the bottom
         for (int i = endDisplayIndex - 1; i >= std::max(newEndDisplayIndex, startDisplayIndex); i--) {
-            picFramePool->release(picFrames[i]);
-            picFrames[i] = nullptr;
+            hideCell(i);
         }
     }
     endDisplayIndex = newEndDisplayIndex;
@@ -169,60 +226,157 @@ void DisplayController::displayPicFrames() {
     // top changes
     if (newStartDisplayIndex < startDisplayIndex) { // load new frames at the top
         for (int i = std::min(startDisplayIndex - 1, newEndDisplayIndex - 1); i >= newStartDisplayIndex; i--) {
-            int displayItemIdx = displayingItemIndices[i];
-            PicItem* picItem = nullptr;
-            MetadataItem* metadataItem = nullptr;
-            switch (displayMode) {
-            case DisplayItemType::Pic:
-                picItem = &displayItems->picItems[displayItemIdx];
-                if (picItem->metadataCount > 0) {
-                    metadataItem = &displayItems->metadataItems[picItem->metadataStartIndex];
-                }
-                break;
-            case DisplayItemType::Metadata:
-                metadataItem = &displayItems->metadataItems[displayItemIdx];
-                picItem = &displayItems->picItems[metadataItem->picStartIndex];
-                break;
-            }
-            PictureFrame* picFrame = picFramePool->acquire(picItem, metadataItem, searchField);
-            picFrames[i] = picFrame;
-            Vec2 pos = getPicFramePosition(i);
-            picFrame->move(pos.x, pos.y);
+            showCell(i);
         }
     } else if (newStartDisplayIndex > startDisplayIndex) { // release frames at the top
         for (int i = startDisplayIndex; i < std::min(newStartDisplayIndex, endDisplayIndex); i++) {
-            picFramePool->release(picFrames[i]);
-            picFrames[i] = nullptr;
+            hideCell(i);
         }
     }
     startDisplayIndex = newStartDisplayIndex;
+    frameStartIndex = startDisplayIndex; // may have moved up when the filtered items ran out
+    frameEndIndex = endDisplayIndex;
 
     displaying = true;
 }
+void DisplayController::showCell(int displayIndex) {
+    int displayItemIdx = displayingItemIndices[displayIndex];
+    PicItem* picItem = nullptr;
+    MetadataItem* metadataItem = nullptr;
+    switch (displayMode) {
+    case DisplayItemType::Pic:
+        picItem = &displayItems->picItems[displayItemIdx];
+        if (picItem->metadataCount > 0) {
+            metadataItem = &displayItems->metadataItems[picItem->metadataStartIndex];
+        }
+        picIdToFrameIdxMap[picItem->info.id] = displayIndex;
+        break;
+    case DisplayItemType::Metadata:
+        metadataItem = &displayItems->metadataItems[displayItemIdx];
+        if (metadataItem->picCount > 0) {
+            picItem = &displayItems->picItems[metadataItem->picStartIndex];
+            for (int j = metadataItem->picStartIndex; j < metadataItem->picStartIndex + metadataItem->picCount; j++) {
+                picIdToFrameIdxMap[displayItems->picItems[j].info.id] = displayIndex;
+            }
+        }
+        break;
+    }
+    Vec2 pos = getPicFramePosition(displayIndex);
+    QRect rect(pos.x, pos.y, PIC_FRAME_WIDTH, PIC_FRAME_HEIGHT);
+    picGrid->setCell(displayIndex, rect, getFrameTexts(picItem, metadataItem, searchField));
+    if (picItem) picGrid->setThumbnail(displayIndex, imageLoader->getImage(picItem->info, LoadType::Thumbnail));
+}
+void DisplayController::hideCell(int displayIndex) {
+    if (displayIndex == hoverIndex) releaseHoverFrame();
+    // scrolled out of the preload rows, its thumbnail is no longer needed
+    if (const PicInfo* info = getThumbnailPicInfo(displayIndex)) imageLoader->cancel(info->id, LoadType::Thumbnail);
+    picGrid->removeCell(displayIndex);
+}
 bool DisplayController::fillFilteredItemUntil(int displayIndex) {
     while (displayIndex >= displayingItemIndices.size()) { // need to find next item that matches filter
-        while (nextMatchSortedIndex < sortedItemIndices.size()) {
-            if (displayMode == DisplayItemType::Pic &&
-                isMatchFilter(displayItems->picItems[sortedItemIndices[nextMatchSortedIndex]].info, filterCtx)) {
-                nextMatchSortedIndex += 1;
-                break;
-            }
-            if (displayMode == DisplayItemType::Metadata &&
-                isMatchFilter(displayItems->metadataItems[sortedItemIndices[nextMatchSortedIndex]].metadata, filterCtx)) {
-                nextMatchSortedIndex += 1;
-                break;
-            }
+        while (nextMatchSortedIndex < sortedItemIndices.size() &&
+               !FilterColumns::isSelected(filterSelection, sortedItemIndices[nextMatchSortedIndex])) {
             nextMatchSortedIndex += 1;
         }
-
         if (nextMatchSortedIndex >= sortedItemIndices.size()) return false; // no more items to display
 
-        // nextMatchSortedIndex has been incremented, so we need to use nextMatchSortedIndex - 1
-        displayingItemIndices.push_back(sortedItemIndices[nextMatchSortedIndex - 1]);
+        displayingItemIndices.push_back(sortedItemIndices[nextMatchSortedIndex]);
+        nextMatchSortedIndex += 1;
     }
     return true;
 }
 
+// prefetch
+
+void DisplayController::prefetchThumbnails() {
+    if (!displaying) return;
+    int direction = prefetchPlanner.getDirection();
+    int prefetchCount = prefetchPlanner.lookaheadRows(PIC_FRAME_HEIGHT + SPACING) * picsPerRow;
+    int first = 0; // [first, last) of the display indices to prefetch, none behind the direction of travel
+    int last = 0;
+    if (direction > 0) {
+        first = endDisplayIndex;
+        last = endDisplayIndex + prefetchCount;
+    } else if (direction < 0) {
+        first = std::max(0, startDisplayIndex - prefetchCount);
+        last = startDisplayIndex;
+    }
+
+    std::unordered_map<uint64_t, int> plan;
+    for (int i = first; i < last; i++) {
+        if (i >= displayingItemIndices.size() && !fillFilteredItemUntil(i)) break; // no more items
+        if (const PicInfo* info = getThumbnailPicInfo(i)) plan[info->id] = i;
+    }
+    for (const auto& [picId, idx] : prefetchIdxMap) { // planned before, now behind or too far ahead
+        if (plan.find(picId) != plan.end()) continue;
+        auto it = picIdToFrameIdxMap.find(picId);
+        if (it != picIdToFrameIdxMap.end() && it->second >= startDisplayIndex && it->second < endDisplayIndex) continue;
+        imageLoader->cancel(picId, LoadType::Thumbnail);
+    }
+    prefetchIdxMap = std::move(plan);
+    for (int i = first; i < std::min(last, static_cast<int>(displayingItemIndices.size())); i++) {
+        if (const PicInfo* info = getThumbnailPicInfo(i)) imageLoader->prefetch(*info);
+    }
+}
+void DisplayController::cancelPrefetch() {
+    for (const auto& [picId, idx] : prefetchIdxMap) {
+        imageLoader->cancel(picId, LoadType::Thumbnail);
+    }
+    prefetchIdxMap.clear();
+}
+
+// hover
+
+void DisplayController::handleCellHovered(int displayIndex) {
+    if (displayIndex == hoverIndex) return;
+    if (hoverFrame) {
+        // the grid also reports leaving when the cursor moves onto the hover frame stacked above it
+        QPoint cursorPos = ui->picBrowseWidget->mapFromGlobal(QCursor::pos());
+        if (displayIndex < 0 && hoverFrame->geometry().contains(cursorPos)) return;
+        releaseHoverFrame();
+    }
+    if (!displaying || displayIndex < startDisplayIndex || displayIndex >= endDisplayIndex) return;
+
+    int displayItemIdx = displayingItemIndices[displayIndex];
+    PicItem* picItem = nullptr;
+    MetadataItem* metadataItem = nullptr;
+    switch (displayMode) {
+    case DisplayItemType::Pic:
+        picItem = &displayItems->picItems[displayItemIdx];
+        if (picItem->metadataCount > 0) {
+            metadataItem = &displayItems->metadataItems[picItem->metadataStartIndex];
+        }
+        break;
+    case DisplayItemType::Metadata:
+        metadataItem = &displayItems->metadataItems[displayItemIdx];
+        if (metadataItem->picCount == 0) return;
+        picItem = &displayItems->picItems[metadataItem->picStartIndex];
+        break;
+    }
+    hoverFrame = picFramePool->acquire(picItem, metadataItem, searchField);
+    hoverIndex = displayIndex;
+    Vec2 pos = getPicFramePosition(displayIndex);
+    hoverFrame->move(pos.x, pos.y);
+    hoverFrame->raise();
+}
+void DisplayController::updateHoverFromCursor() {
+    QWidget* viewport = ui->picBrowseScrollArea->viewport();
+    if (!viewport->rect().contains(viewport->mapFromGlobal(QCursor::pos()))) return; // leave events handle the rest
+    handleCellHovered(picGrid->cellAt(picGrid->mapFromGlobal(QCursor::pos())));
+}
+void DisplayController::releaseHoverFrame() {
+    if (!hoverFrame) return;
+    picFramePool->release(hoverFrame);
+    hoverFrame = nullptr;
+    int displayIndex = hoverIndex;
+    hoverIndex = -1;
+    // releasing cancels the frame's loads, request the thumbnail again if the cell is still waiting for it
+    if (!displaying || displayIndex < startDisplayIndex || displayIndex >= endDisplayIndex) return;
+    if (const PicInfo* info = getThumbnailPicInfo(displayIndex)) {
+        if (auto img = imageLoader->getImage(*info, LoadType::Thumbnail)) picGrid->setThumbnail(displayIndex, std::move(img));
+    }
+}
+
 // Event handlers
 
 void DisplayController::handleWindowResize() {
@@ -236,7 +390,7 @@ void DisplayController::handleWindowResize() {
     if (newPicsPerRow != picsPerRow) { // make sure resizing does not change or shift displaying content
         picsPerRow = newPicsPerRow;
         scrollBarValue = MARGIN + (lookingAt / picsPerRow) * (PIC_FRAME_HEIGHT + SPACING) + currentDisplayOffset;
-        totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (sortedItemIndices.size() / picsPerRow + 1);
+        totalHeight = MARGIN * 2 + (PIC_FRAME_HEIGHT + SPACING) * (matchCount / picsPerRow + 1);
         ui->picBrowseWidget->setMinimumHeight(totalHeight);
         ui->picBrowseScrollArea->verticalScrollBar()->setValue(scrollBarValue);
     }
@@ -244,7 +398,11 @@ void DisplayController::handleWindowResize() {
         displayPicFrames();
         for (int i = startDisplayIndex; i < endDisplayIndex; i++) {
             Vec2 pos = getPicFramePosition(i);
-            picFrames[i]->move(pos.x, pos.y);
+            picGrid->moveCell(i, QPoint(pos.x, pos.y));
+        }
+        if (hoverFrame) {
+            Vec2 pos = getPicFramePosition(hoverIndex);
+            hoverFrame->move(pos.x, pos.y);
         }
     }
     resizing = false;
@@ -256,27 +414,32 @@ void DisplayController::handleScrollBarValueChanged(int value) {
     int col = currentDisplayOffset / ((PIC_FRAME_WIDTH + SPACING) / picsPerRow);
     lookingAt = picsPerRow * (std::max(0, (scrollBarValue - MARGIN)) / (PIC_FRAME_HEIGHT + SPACING)) + col;
     displayPicFrames();
+    updateHoverFromCursor();
+    prefetchPlanner.addSample(value);
+    prefetchThumbnails();
+    imageLoader->reprioritize(); // frames that scrolled out were cancelled on release, the rest move with the viewport
 }
 
 // Sort and filter functions
 
 void DisplayController::sortDisplayItems(const SortContext& sortContext) {
+    sortCtx = sortContext; // appended items are sorted the same way
     if (!displayItems) return; // no display items to display
 
+    sortedItemIndices.resize(itemCount()); // includes items held back by appendDisplayItems
+    std::iota(sortedItemIndices.begin(), sortedItemIndices.end(), 0); // ties and SortBy::None keep result order
     if (displayMode == DisplayItemType::Pic) {
-        std::sort(sortedItemIndices.begin(), sortedItemIndices.end(), [&](int a, int b) {
-            return comparePicItems(displayItems->picItems[a], displayItems->picItems[b], sortContext);
-        });
+        sortPicItemIndices(sortedItemIndices, displayItems->picItems, sortContext);
     } else if (displayMode == DisplayItemType::Metadata) {
-        std::sort(sortedItemIndices.begin(), sortedItemIndices.end(), [&](int a, int b) {
-            return compareMetadataItems(displayItems->metadataItems[a], displayItems->metadataItems[b], sortContext);
-        });
+        sortMetadataItemIndices(sortedItemIndices, displayItems->metadataItems, sortContext);
     }
     clearDisplay();
     displayPicFrames();
 }
 void DisplayController::setFilterContext(const FilterContext& filterContext) {
     this->filterCtx = filterContext;
+    matchCount = filterColumns.evaluate(filterCtx, filterSelection);
+    if (displayItems) ui->statusbar->showMessage(QString("筛选后共 %1 个结果").arg(matchCount));
     clearDisplay();
     displayPicFrames();
 }
@@ -17,11 +17,15 @@
  */
 
 #pragma once
+#include "../widgets/pic_grid_widget.h"
 #include "../widgets/picture_frame.h"
 #include "context_controller.h"
+#include "filter_columns.h"
 #include "image_loader.h"
 #include "picture_frame_pool.h"
+#include "prefetch_planner.h"
 #include "service/model.h"
+#include "sorter.h"
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
@@ -48,9 +52,11 @@ class DisplayController {
 public:
     DisplayController(Ui::MainWindow* ui, ImageLoader* imageLoader);
     ~DisplayController();
-    void setup();
+    void setup(std::function<void(uint64_t)> findSimilarHandler);
 
     void setDisplayItems(DisplayItems* displayItems, SearchField searchField);
+    void appendDisplayItems(DisplayItems* displayItems); // takes ownership, items keep the current search field and sort
+    void finishDisplayItems();                           // the last chunk was appended, held back sorted items are shown
 
     void handleWindowResize();
     void handleScrollBarValueChanged(int value);
@@ -63,6 +69,9 @@ public:
 private:
     Ui::MainWindow* ui;
     std::unique_ptr<PicFramePool> picFramePool = nullptr;
+    PicGridWidget* picGrid = nullptr;   // owned by picBrowseWidget, paints every displayed cell
+    PictureFrame* hoverFrame = nullptr; // interactive frame placed over the hovered cell
+    int hoverIndex = -1;
     ImageLoader* imageLoader = nullptr;
 
     DisplayItemType displayMode = DisplayItemType::Pic;
@@ -72,12 +81,15 @@ private:
 
     bool displaying = false;                // when displaying, everything below should be valid
     std::vector<int> displayingItemIndices; // indices of displayItems filtered and currently being displayed
-    std::vector<PictureFrame*> picFrames;   // displaying PictureFrames, corresponds to displayingIndices
-    int startDisplayIndex = 0;              // [start, end) is the range of displaying PictureFrames in picFrames
+    int startDisplayIndex = 0;              // [start, end) is the range of cells in picGrid
     int endDisplayIndex = 0;                // and indices in displayingItemIndices currently being displayed
     std::unordered_map<uint64_t, int> picIdToFrameIdxMap;
 
+    SortContext sortCtx;
     FilterContext filterCtx;
+    FilterColumns filterColumns;           // filterable fields of displayItems
+    std::vector<uint64_t> filterSelection; // bit per display item, set when it matches filterCtx
+    size_t matchCount = 0;                 // set bits in filterSelection
     SearchField searchField = SearchField::None;
 
     int totalWidth = 0;
@@ -87,10 +99,29 @@ private:
     int picsPerRow = 1;
 
     int lookingAt = 0;
+    int visibleStartIndex = 0; // [start, end) of the display indices inside the viewport, the rest are preload rows
+    int visibleEndIndex = 0;
+    int frameStartIndex = 0; // [start, end) of the display indices that have or are getting a cell
+    int frameEndIndex = 0;
     bool resizing = false;
 
+    PrefetchPlanner prefetchPlanner;
+    std::unordered_map<uint64_t, int> prefetchIdxMap; // picture id -> display index of thumbnails requested ahead of frames
+
     Vec2 getPicFramePosition(int displayIndex) const;
     void displayPicFrames();
+    void showCell(int displayIndex);
+    void hideCell(int displayIndex);
     void clearDisplay();
+    size_t itemCount() const; // display items of the current display mode
     bool fillFilteredItemUntil(int count);
+    int thumbnailPriority(uint64_t picId) const; // visible frames first, then by distance from lookingAt
+    const PicInfo* getThumbnailPicInfo(int displayIndex) const;
+    void prefetchThumbnails(); // request thumbnails ahead of the frames in the scroll direction, cancel the rest
+    void cancelPrefetch();
+
+    // hover
+    void handleCellHovered(int displayIndex);
+    void updateHoverFromCursor(); // cells move under a still cursor when scrolling
+    void releaseHoverFrame();
 };
@@ -0,0 +1,257 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "filter_columns.h"
+#include "service/roaring_bitmap.h"
+#include <limits>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define FILTER_X86_KERNELS
+#include <immintrin.h>
+#ifdef _MSC_VER // msvc emits any intrinsic regardless of /arch, kernels are only called after the cpu check
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+constexpr size_t FILTER_BLOCK_ROWS = 32; // rows per simd iteration, half a selection word
+
+static uint16_t restrictBit(RestrictType restrictType) {
+    switch (restrictType) {
+    case RestrictType::AllAges:
+        return ALL_AGES_BIT;
+    case RestrictType::Sensitive:
+        return SENSITIVE_BIT;
+    case RestrictType::Questionable:
+        return QUESTIONABLE_BIT;
+    case RestrictType::R18:
+        return R18_BIT;
+    case RestrictType::R18G:
+        return R18G_BIT;
+    default:
+        return UNKNOWN_RESTRICT_BIT;
+    }
+}
+static uint16_t aiBit(AIType aiType) {
+    switch (aiType) {
+    case AIType::AI:
+        return AI_BIT;
+    case AIType::NotAI:
+        return NOT_AI_BIT;
+    default:
+        return UNKNOWN_AI_BIT;
+    }
+}
+static uint16_t formatBit(ImageFormat fileType) {
+    switch (fileType) {
+    case ImageFormat::PNG:
+        return PNG_BIT;
+    case ImageFormat::JPG:
+        return JPG_BIT;
+    case ImageFormat::GIF:
+        return GIF_BIT;
+    case ImageFormat::WebP:
+        return WEBP_BIT;
+    default:
+        return 0; // never filtered
+    }
+}
+static uint16_t platformBit(PlatformType platform) {
+    switch (platform) {
+    case PlatformType::Pixiv:
+        return PIXIV_BIT;
+    case PlatformType::Twitter:
+        return TWITTER_BIT;
+    default:
+        return 0;
+    }
+}
+
+// kernels, a row matches when it has no hidden bit and, if dimensions are given, its size is within range
+
+static void evaluateScalar(const uint16_t* categoryBits,
+                           const uint32_t* widths,
+                           const uint32_t* heights,
+                           size_t begin,
+                           size_t end,
+                           uint16_t hidden,
+                           const FilterContext& filterCtx,
+                           uint64_t* selection) {
+    for (size_t i = begin; i < end; i++) {
+        bool match = (categoryBits[i] & hidden) == 0;
+        if (widths) {
+            match = match && widths[i] >= filterCtx.minWidth && widths[i] <= filterCtx.maxWidth &&
+                    heights[i] >= filterCtx.minHeight && heights[i] <= filterCtx.maxHeight;
+        }
+        selection[i / 64] |= static_cast<uint64_t>(match) << (i % 64);
+    }
+}
+
+#ifdef FILTER_X86_KERNELS
+TARGET_AVX2 static uint32_t rangeMaskAVX2(const uint32_t* values, __m256i minimum, __m256i maximum) { // 8 rows
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+    __m256i inRange = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_max_epu32(v, minimum), v),
+                                       _mm256_cmpeq_epi32(_mm256_min_epu32(v, maximum), v));
+    return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(inRange)));
+}
+TARGET_AVX2 static size_t evaluateAVX2(const uint16_t* categoryBits, // returns the number of rows evaluated
+                                       const uint32_t* widths,
+                                       const uint32_t* heights,
+                                       size_t count,
+                                       uint16_t hidden,
+                                       const FilterContext& filterCtx,
+                                       uint64_t* selection) {
+    const __m256i hiddenMask = _mm256_set1_epi16(static_cast<short>(hidden));
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i minWidth = _mm256_set1_epi32(static_cast<int>(filterCtx.minWidth));
+    const __m256i maxWidth = _mm256_set1_epi32(static_cast<int>(filterCtx.maxWidth));
+    const __m256i minHeight = _mm256_set1_epi32(static_cast<int>(filterCtx.minHeight));
+    const __m256i maxHeight = _mm256_set1_epi32(static_cast<int>(filterCtx.maxHeight));
+
+    size_t blocks = count / FILTER_BLOCK_ROWS;
+    for (size_t block = 0; block < blocks; block++) {
+        size_t row = block * FILTER_BLOCK_ROWS;
+        __m256i bits0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(categoryBits + row));
+        __m256i bits1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(categoryBits + row + 16));
+        __m256i visible0 = _mm256_cmpeq_epi16(_mm256_and_si256(bits0, hiddenMask), zero);
+        __m256i visible1 = _mm256_cmpeq_epi16(_mm256_and_si256(bits1, hiddenMask), zero);
+        // packing interleaves the 128-bit lanes, the permute restores row order before taking one bit per byte
+        __m256i visible = _mm256_permute4x64_epi64(_mm256_packs_epi16(visible0, visible1), 0xD8);
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(visible));
+
+        if (widths && mask != 0) {
+            uint32_t sizeMask = 0;
+            for (size_t part = 0; part < FILTER_BLOCK_ROWS; part += 8) {
+                uint32_t partMask = rangeMaskAVX2(widths + row + part, minWidth, maxWidth) &
+                                    rangeMaskAVX2(heights + row + part, minHeight, maxHeight);
+                sizeMask |= partMask << part;
+            }
+            mask &= sizeMask;
+        }
+        selection[row / 64] |= static_cast<uint64_t>(mask) << (row % 64);
+    }
+    return blocks * FILTER_BLOCK_ROWS;
+}
+#endif
+
+static FilterKernel detectKernel() {
+#ifdef FILTER_X86_KERNELS
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return FilterKernel::Scalar;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] >> 27) & 1;
+    bool avx = (info[2] >> 28) & 1;
+    if (!osxsave || !avx) return FilterKernel::Scalar;
+    uint64_t xcr0 = _xgetbv(0); // register state the os saves on context switch
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] >> 5) & 1;
+    if (avx2 && (xcr0 & 0x06) == 0x06) return FilterKernel::AVX2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return FilterKernel::AVX2;
+#endif
+#endif
+    return FilterKernel::Scalar;
+}
+
+// FilterColumns implementation
+
+FilterKernel FilterColumns::activeKernel() {
+    static const FilterKernel kernel = detectKernel();
+    return kernel;
+}
+void FilterColumns::build(const DisplayItems& displayItems) {
+    clear();
+    if (displayItems.type == DisplayItemType::Pic) {
+        size_t count = displayItems.picItems.size();
+        categoryBits.reserve(count);
+        widths.reserve(count);
+        heights.reserve(count);
+        for (const PicItem& picItem : displayItems.picItems) {
+            const PicInfo& info = picItem.info;
+            uint16_t bits = formatBit(info.fileType) | restrictBit(info.restrictType) | aiBit(info.aiType);
+            if (info.sourceIdentifiers.empty()) bits |= NO_PLATFORM_BIT;
+            for (const auto& source : info.sourceIdentifiers) {
+                bits |= platformBit(source.platform);
+            }
+            categoryBits.push_back(bits);
+            widths.push_back(info.width);
+            heights.push_back(info.height);
+        }
+    } else {
+        categoryBits.reserve(displayItems.metadataItems.size());
+        for (const MetadataItem& metadataItem : displayItems.metadataItems) {
+            const Metadata& metadata = metadataItem.metadata;
+            uint16_t bits = platformBit(metadata.platformType) | restrictBit(metadata.restrictType) | aiBit(metadata.aiType);
+            if (metadata.platformType == PlatformType::Unknown) bits |= NO_PLATFORM_BIT;
+            categoryBits.push_back(bits);
+        }
+    }
+}
+void FilterColumns::clear() {
+    categoryBits.clear();
+    widths.clear();
+    heights.clear();
+}
+uint16_t FilterColumns::hiddenBits(const FilterContext& filterCtx) {
+    uint16_t hidden = 0;
+    if (!filterCtx.showUnknowPlatform) hidden |= NO_PLATFORM_BIT;
+    if (!filterCtx.showPixiv) hidden |= PIXIV_BIT;
+    if (!filterCtx.showTwitter) hidden |= TWITTER_BIT;
+    if (!filterCtx.showPNG) hidden |= PNG_BIT;
+    if (!filterCtx.showJPG) hidden |= JPG_BIT;
+    if (!filterCtx.showGIF) hidden |= GIF_BIT;
+    if (!filterCtx.showWEBP) hidden |= WEBP_BIT;
+    if (!filterCtx.showUnknowRestrict) hidden |= UNKNOWN_RESTRICT_BIT;
+    if (!filterCtx.showAllAge) hidden |= ALL_AGES_BIT;
+    if (!filterCtx.showSensitive) hidden |= SENSITIVE_BIT;
+    if (!filterCtx.showQuestionable) hidden |= QUESTIONABLE_BIT;
+    if (!filterCtx.showR18) hidden |= R18_BIT;
+    if (!filterCtx.showR18G) hidden |= R18G_BIT;
+    if (!filterCtx.showUnknowAI) hidden |= UNKNOWN_AI_BIT;
+    if (!filterCtx.showAI) hidden |= AI_BIT;
+    if (!filterCtx.showNonAI) hidden |= NOT_AI_BIT;
+    return hidden;
+}
+size_t FilterColumns::evaluate(const FilterContext& filterCtx, std::vector<uint64_t>& selection) const {
+    size_t count = size();
+    selection.assign((count + 63) / 64, 0);
+    uint16_t hidden = hiddenBits(filterCtx);
+    bool sizeFiltered = filterCtx.minWidth > 0 || filterCtx.minHeight > 0 ||
+                        filterCtx.maxWidth < std::numeric_limits<uint32_t>::max() ||
+                        filterCtx.maxHeight < std::numeric_limits<uint32_t>::max();
+    const uint32_t* widthColumn = (sizeFiltered && !widths.empty()) ? widths.data() : nullptr;
+    const uint32_t* heightColumn = widthColumn ? heights.data() : nullptr;
+
+    size_t evaluated = 0;
+#ifdef FILTER_X86_KERNELS
+    if (activeKernel() == FilterKernel::AVX2) {
+        evaluated = evaluateAVX2(categoryBits.data(), widthColumn, heightColumn, count, hidden, filterCtx, selection.data());
+    }
+#endif
+    evaluateScalar(categoryBits.data(), widthColumn, heightColumn, evaluated, count, hidden, filterCtx, selection.data());
+
+    size_t matches = 0;
+    for (uint64_t word : selection) {
+        matches += popcount64(word);
+    }
+    return matches;
+}
@@ -0,0 +1,69 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "context_controller.h"
+#include "service/model.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// one bit per filterable category value, an item is filtered out when it has any bit of a hidden category
+constexpr uint16_t NO_PLATFORM_BIT = 1 << 0; // picture without sources, post of unknown platform
+constexpr uint16_t PIXIV_BIT = 1 << 1;
+constexpr uint16_t TWITTER_BIT = 1 << 2;
+constexpr uint16_t PNG_BIT = 1 << 3;
+constexpr uint16_t JPG_BIT = 1 << 4;
+constexpr uint16_t GIF_BIT = 1 << 5;
+constexpr uint16_t WEBP_BIT = 1 << 6;
+constexpr uint16_t UNKNOWN_RESTRICT_BIT = 1 << 7;
+constexpr uint16_t ALL_AGES_BIT = 1 << 8;
+constexpr uint16_t SENSITIVE_BIT = 1 << 9;
+constexpr uint16_t QUESTIONABLE_BIT = 1 << 10;
+constexpr uint16_t R18_BIT = 1 << 11;
+constexpr uint16_t R18G_BIT = 1 << 12;
+constexpr uint16_t UNKNOWN_AI_BIT = 1 << 13;
+constexpr uint16_t AI_BIT = 1 << 14;
+constexpr uint16_t NOT_AI_BIT = 1 << 15;
+
+enum class FilterKernel { Scalar, AVX2 };
+
+// columnar snapshot of the filterable fields of display items, rows are in display item order
+// an item matches when it has no hidden category bit and, for pictures, its size is within the width and height bounds
+// filters are evaluated in bulk into a selection bitmap
+class FilterColumns {
+public:
+    void build(const DisplayItems& displayItems);
+    void clear();
+    size_t size() const { return categoryBits.size(); }
+
+    // bit i of selection is set when item i matches, returns the number of matching items
+    size_t evaluate(const FilterContext& filterCtx, std::vector<uint64_t>& selection) const;
+    static bool isSelected(const std::vector<uint64_t>& selection, size_t index) {
+        return (selection[index / 64] >> (index % 64)) & 1;
+    }
+
+    static FilterKernel activeKernel(); // best kernel supported by the running cpu
+
+private:
+    std::vector<uint16_t> categoryBits; // FilterBit flags of every item
+    std::vector<uint32_t> widths;       // empty for posts, which have no resolution filter
+    std::vector<uint32_t> heights;
+
+    static uint16_t hiddenBits(const FilterContext& filterCtx);
+};
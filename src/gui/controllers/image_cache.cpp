@@ -17,62 +17,190 @@
  */
 
 #include "image_cache.h"
+#include <algorithm>
+#include <vector>
 
+constexpr uint64_t SKETCH_SEEDS[4] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull};
+constexpr uint8_t MAX_FREQUENCY = 15;
+constexpr size_t SKETCH_RESET_SAMPLES = FREQUENCY_SKETCH_WIDTH * 10; // halve all counters after this many accesses
+
+static size_t sketchIndex(uint64_t id, size_t row) {
+    return static_cast<size_t>((id * SKETCH_SEEDS[row]) >> (64 - FREQUENCY_SKETCH_BITS));
+}
+
+ImageCache::ImageCache(size_t budgetBytes) : shards(std::make_unique<Shard[]>(IMAGE_CACHE_SHARDS)) {
+    splitBudget(budgetBytes);
+}
 void ImageCache::put(uint64_t id, std::unique_ptr<QImage> img) {
-    if (capacity == 0 || img == nullptr) return;
-    std::lock_guard<std::mutex> lock(mutex);
-    auto it = idToIndexMap.find(id);
-    if (it != idToIndexMap.end()) { // already in cache, do nothing
-        return;
-    } else { // not in cache, add new node
-        if (size < capacity) {
-            size_t index = size;
-            size += 1;
-            idToIndexMap[id] = index;
-            indexToIdMap[index] = id;
-            nodeArray[index] = {std::move(img), index, index}; // initialize prev and next to itself
-            if (size == 1) {
-                headIndex = tailIndex = index;
-            } else { // insert at head
-                nodeArray[index].next = headIndex;
-                nodeArray[index].prev = tailIndex;
-                nodeArray[headIndex].prev = index;
-                nodeArray[tailIndex].next = index;
-                headIndex = index;
-            }
-        } else { // cache is full, evict tail and add new node at head
-            // replace image
-            nodeArray[tailIndex].img = std::move(img);
-            // update mappings
-            idToIndexMap.erase(indexToIdMap[tailIndex]);
-            idToIndexMap[id] = tailIndex;
-            indexToIdMap[tailIndex] = id;
-            // move to head
-            headIndex = tailIndex;
-            tailIndex = nodeArray[tailIndex].prev;
+    if (img == nullptr) return;
+    size_t bytes = static_cast<size_t>(img->sizeInBytes());
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (budgetBytes == 0) return;
+    if (shard.entries.find(id) != shard.entries.end()) return; // already in cache, do nothing
+
+    shard.window.push_front({id, std::shared_ptr<QImage>(std::move(img)), bytes, Segment::Window});
+    shard.entries[id] = shard.window.begin();
+    shard.windowBytes += bytes;
+    while (shard.windowBytes > windowBudget && shard.window.size() > 1) { // the newest image stays until it is displayed
+        admit(shard, std::prev(shard.window.end()));
+    }
+}
+std::shared_ptr<QImage> ImageCache::get(uint64_t id) {
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    recordAccess(shard, id);
+    auto it = shard.entries.find(id);
+    if (it == shard.entries.end()) { // not found
+        shard.misses++;
+        return nullptr;
+    }
+    shard.hits++;
+
+    auto entry = it->second;
+    switch (entry->segment) {
+    case Segment::Window:
+        shard.window.splice(shard.window.begin(), shard.window, entry);
+        break;
+    case Segment::Probation: // used again after admission, promote
+        shard.probationBytes -= entry->bytes;
+        shard.protectedBytes += entry->bytes;
+        entry->segment = Segment::Protected;
+        shard.protectedImages.splice(shard.protectedImages.begin(), shard.probation, entry);
+        while (shard.protectedBytes > protectedBudget && shard.protectedImages.size() > 1) { // demote the oldest
+            auto demoted = std::prev(shard.protectedImages.end());
+            shard.protectedBytes -= demoted->bytes;
+            shard.probationBytes += demoted->bytes;
+            demoted->segment = Segment::Probation;
+            shard.probation.splice(shard.probation.begin(), shard.protectedImages, demoted);
         }
+        break;
+    case Segment::Protected:
+        shard.protectedImages.splice(shard.protectedImages.begin(), shard.protectedImages, entry);
+        break;
+    }
+    return entry->img;
+}
+bool ImageCache::contains(uint64_t id) const {
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.entries.find(id) != shard.entries.end();
+}
+void ImageCache::clear() {
+    for (size_t i = 0; i < IMAGE_CACHE_SHARDS; i++) {
+        Shard& shard = shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.window.clear();
+        shard.probation.clear();
+        shard.protectedImages.clear();
+        shard.windowBytes = shard.probationBytes = shard.protectedBytes = 0;
+    }
+}
+void ImageCache::setBudget(size_t budgetBytes) {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(IMAGE_CACHE_SHARDS);
+    for (size_t i = 0; i < IMAGE_CACHE_SHARDS; i++) { // loader threads read the budgets under their shard's lock
+        Shard& shard = shards[i];
+        locks.emplace_back(shard.mutex);
+        shard.entries.clear();
+        shard.window.clear();
+        shard.probation.clear();
+        shard.protectedImages.clear();
+        shard.windowBytes = shard.probationBytes = shard.protectedBytes = 0;
+    }
+    splitBudget(budgetBytes);
+}
+void ImageCache::splitBudget(size_t budgetBytes) {
+    this->budgetBytes = budgetBytes;
+    size_t shardBudget = budgetBytes / IMAGE_CACHE_SHARDS;
+    windowBudget = shardBudget * WINDOW_PERCENT / 100;
+    mainBudget = shardBudget - windowBudget;
+    protectedBudget = mainBudget * PROTECTED_PERCENT / 100;
+}
+ImageCacheStats ImageCache::stats() const {
+    ImageCacheStats stats;
+    for (size_t i = 0; i < IMAGE_CACHE_SHARDS; i++) {
+        Shard& shard = shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.misses += shard.misses;
+        stats.evictions += shard.evictions;
+        stats.rejections += shard.rejections;
+        stats.entries += shard.entries.size();
+        stats.bytes += shard.windowBytes + shard.probationBytes + shard.protectedBytes;
     }
+    return stats;
 }
 
-QImage* ImageCache::get(uint64_t id) {
-    std::lock_guard<std::mutex> lock(mutex);
-    auto it = idToIndexMap.find(id);
-    if (it == idToIndexMap.end()) return nullptr; // not found
+// eviction policy
 
-    size_t index = it->second;
-    if (index == tailIndex) {
-        headIndex = tailIndex;
-        tailIndex = nodeArray[index].prev;
-    } else if (index != headIndex) { // move to head
-        // remove from current position
-        nodeArray[nodeArray[index].prev].next = nodeArray[index].next;
-        nodeArray[nodeArray[index].next].prev = nodeArray[index].prev;
-        // insert at head
-        nodeArray[index].next = headIndex;
-        nodeArray[index].prev = tailIndex;
-        nodeArray[headIndex].prev = index;
-        nodeArray[tailIndex].next = index;
-        headIndex = index;
+void ImageCache::recordAccess(Shard& shard, uint64_t id) {
+    for (size_t row = 0; row < shard.sketch.size(); row++) {
+        uint8_t& counter = shard.sketch[row][sketchIndex(id, row)];
+        if (counter < MAX_FREQUENCY) counter++;
+    }
+    if (++shard.sketchSamples >= SKETCH_RESET_SAMPLES) { // age, so images popular a long time ago can be evicted
+        for (auto& row : shard.sketch) {
+            for (uint8_t& counter : row) {
+                counter >>= 1;
+            }
+        }
+        shard.sketchSamples /= 2;
+    }
+}
+uint8_t ImageCache::frequency(const Shard& shard, uint64_t id) {
+    uint8_t frequency = MAX_FREQUENCY;
+    for (size_t row = 0; row < shard.sketch.size(); row++) {
+        frequency = std::min(frequency, shard.sketch[row][sketchIndex(id, row)]);
+    }
+    return frequency;
+}
+void ImageCache::admit(Shard& shard, EntryList::iterator candidate) {
+    if (candidate->bytes > mainBudget) { // never fits
+        remove(shard, candidate);
+        shard.rejections++;
+        return;
+    }
+    uint8_t candidateFrequency = frequency(shard, candidate->id);
+    while (shard.probationBytes + shard.protectedBytes + candidate->bytes > mainBudget) {
+        EntryList& victims = shard.probation.empty() ? shard.protectedImages : shard.probation;
+        auto victim = std::prev(victims.end());
+        if (candidateFrequency <= frequency(shard, victim->id)) { // the victim is used at least as often, keep it
+            remove(shard, candidate);
+            shard.rejections++;
+            return;
+        }
+        remove(shard, victim);
+        shard.evictions++;
+    }
+    shard.windowBytes -= candidate->bytes;
+    shard.probationBytes += candidate->bytes;
+    candidate->segment = Segment::Probation;
+    shard.probation.splice(shard.probation.begin(), shard.window, candidate);
+}
+void ImageCache::remove(Shard& shard, EntryList::iterator entry) {
+    bytesOf(shard, entry->segment) -= entry->bytes;
+    shard.entries.erase(entry->id);
+    listOf(shard, entry->segment).erase(entry);
+}
+ImageCache::EntryList& ImageCache::listOf(Shard& shard, Segment segment) {
+    switch (segment) {
+    case Segment::Window:
+        return shard.window;
+    case Segment::Probation:
+        return shard.probation;
+    default:
+        return shard.protectedImages;
+    }
+}
+size_t& ImageCache::bytesOf(Shard& shard, Segment segment) {
+    switch (segment) {
+    case Segment::Window:
+        return shard.windowBytes;
+    case Segment::Probation:
+        return shard.probationBytes;
+    default:
+        return shard.protectedBytes;
     }
-    return nodeArray[index].img.get();
 }
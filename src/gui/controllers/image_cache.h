@@ -18,46 +18,86 @@
 
 #pragma once
 #include <QImage>
+#include <array>
 #include <cstdint>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
 
-struct ImageCacheNode {
-    std::unique_ptr<QImage> img;
-    size_t prev = 0;
-    size_t next = 0;
+constexpr size_t IMAGE_CACHE_SHARDS = 16; // picked by id, each shard has its own lock and budget
+constexpr size_t FREQUENCY_SKETCH_BITS = 10;
+constexpr size_t FREQUENCY_SKETCH_WIDTH = size_t(1) << FREQUENCY_SKETCH_BITS; // counters per row of a shard's sketch
+constexpr size_t WINDOW_PERCENT = 20;    // share of a shard's budget that takes every new image
+constexpr size_t PROTECTED_PERCENT = 80; // share of the main area kept for images used again after admission
+
+struct ImageCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t rejections = 0; // images leaving the window that lost admission to a more frequently used image
+    size_t entries = 0;
+    size_t bytes = 0;
+    double hitRate() const { return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0; }
 };
 
+// decoded image cache bounded by bytes, sharded by id, W-TinyLFU eviction in every shard
+// new images enter an LRU window, images leaving the window only replace the victim of the segmented LRU
+// main area if a count-min sketch says they are used more often, so one fast scroll can not flush the working set
 class ImageCache {
 public:
-    ImageCache(size_t capacity) : capacity(capacity) {
-        indexToIdMap = std::make_unique<uint64_t[]>(capacity);
-        nodeArray = std::make_unique<ImageCacheNode[]>(capacity);
-    }
-    ~ImageCache() { clear(); }
+    explicit ImageCache(size_t budgetBytes);
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
 
     void put(uint64_t id, std::unique_ptr<QImage> img);
-    QImage* get(uint64_t id);
-
-    void clear() {
-        std::lock_guard<std::mutex> lock(mutex);
-        for (size_t i = 0; i < size; ++i) {
-            nodeArray[i].img.reset();
-        }
-        size = 0;
-        idToIndexMap.clear();
-        headIndex = tailIndex = 0;
-    };
+    std::shared_ptr<QImage> get(uint64_t id); // shared, an eviction by a loader thread can not free an image in use
+    bool contains(uint64_t id) const;         // not counted as an access
+    void clear();                             // access frequencies and statistics are kept
+    void setBudget(size_t budgetBytes);       // drops the cached images, called once the settings are loaded
+    ImageCacheStats stats() const;
+    size_t budget() const { return budgetBytes; }
 
 private:
-    size_t capacity;
-    size_t size = 0;
-    std::unordered_map<uint64_t, size_t> idToIndexMap;
-    std::unique_ptr<uint64_t[]> indexToIdMap;
-    std::unique_ptr<ImageCacheNode[]> nodeArray;
-    size_t headIndex = 0;
-    size_t tailIndex = 0;
-
-    std::mutex mutex;
+    enum class Segment : uint8_t { Window, Probation, Protected };
+    struct Entry {
+        uint64_t id;
+        std::shared_ptr<QImage> img;
+        size_t bytes;
+        Segment segment;
+    };
+    using EntryList = std::list<Entry>; // most recently used first
+    struct Shard {
+        std::mutex mutex;
+        EntryList window;
+        EntryList probation;       // admitted from the window, not used since
+        EntryList protectedImages; // used again while on probation
+        std::unordered_map<uint64_t, EntryList::iterator> entries;
+        size_t windowBytes = 0;
+        size_t probationBytes = 0;
+        size_t protectedBytes = 0;
+
+        std::array<std::array<uint8_t, FREQUENCY_SKETCH_WIDTH>, 4> sketch{}; // count-min sketch of recent accesses
+        size_t sketchSamples = 0;
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t rejections = 0;
+    };
+
+    size_t budgetBytes;
+    size_t windowBudget;    // per shard
+    size_t mainBudget;      // per shard, probation and protected together
+    size_t protectedBudget; // per shard
+    std::unique_ptr<Shard[]> shards;
+
+    Shard& shardOf(uint64_t id) const { return shards[id % IMAGE_CACHE_SHARDS]; }
+    void splitBudget(size_t budgetBytes); // call with every shard locked or before the cache is shared
+    static void recordAccess(Shard& shard, uint64_t id);
+    static uint8_t frequency(const Shard& shard, uint64_t id);
+    void admit(Shard& shard, EntryList::iterator candidate); // move the window's oldest image into the main area or drop it
+    static void remove(Shard& shard, EntryList::iterator entry);
+    static EntryList& listOf(Shard& shard, Segment segment);
+    static size_t& bytesOf(Shard& shard, Segment segment);
 };
@@ -18,24 +18,33 @@
 
 #include "image_loader.h"
 #include "../main_window.h"
+#include "scaled_decoder.h"
 #include "utils/logger.h"
 #include <QCoreApplication>
 #include <QImageReader>
 
-constexpr size_t THUMBNAIL_RESOLUTION_LIMIT = 256;
-constexpr size_t PREVIEW_RESOLUTION_LIMIT = 512;
+constexpr int THUMBNAIL_RESOLUTION_LIMIT = THUMBNAIL_SIZE; // thumbnails are stored at the size they are decoded
+constexpr int PREVIEW_RESOLUTION_LIMIT = 512;
 
 const QEvent::Type ImageLoadCompleteEvent::EventType = static_cast<QEvent::Type>(QEvent::registerEventType());
 
-ImageLoader::ImageLoader(MainWindow* mainWindow, size_t numThreads) : mainWindow(mainWindow) {
+ImageLoader::ImageLoader(MainWindow* mainWindow, size_t cacheBudgetBytes, size_t numThreads)
+    : mainWindow(mainWindow), thumbnailCache(cacheBudgetBytes - cacheBudgetBytes / PREVIEW_CACHE_DIVISOR),
+      previewCache(cacheBudgetBytes / PREVIEW_CACHE_DIVISOR) {
     for (size_t i = 0; i < numThreads; ++i) {
         workers.emplace_back(&ImageLoader::workerFunction, this);
     }
 }
 ImageLoader::~ImageLoader() {
     stop();
+    for (LoadType loadType : {LoadType::Thumbnail, LoadType::Preview}) {
+        ImageCacheStats stats = getCacheStats(loadType);
+        Info() << (loadType == LoadType::Thumbnail ? "Thumbnail cache" : "Preview cache") << " hit rate:" << stats.hitRate()
+               << "Hits:" << stats.hits << "Misses:" << stats.misses << "Evictions:" << stats.evictions
+               << "Rejections:" << stats.rejections << "Size (MB):" << (stats.bytes >> 20);
+    }
 }
-QImage* ImageLoader::getImage(uint64_t picId, LoadType loadType) {
+std::shared_ptr<QImage> ImageLoader::getImage(uint64_t picId, LoadType loadType) {
     // check cache first
     if (loadType == LoadType::Thumbnail) {
         if (auto img = thumbnailCache.get(picId)) return img;
@@ -45,38 +54,116 @@ QImage* ImageLoader::getImage(uint64_t picId, LoadType loadType) {
     }
     return nullptr;
 }
-QImage* ImageLoader::getImage(const PicInfo& picInfo, LoadType loadType) {
+std::shared_ptr<QImage> ImageLoader::getImage(const PicInfo& picInfo, LoadType loadType, int previewDistance) {
     // check cache first
     if (auto img = getImage(picInfo.id, loadType)) return img;
 
     // cache miss, load image asynchronously
+    requestImage(picInfo, loadType, previewDistance);
+    return nullptr;
+}
+void ImageLoader::prefetch(const PicInfo& picInfo) {
+    if (thumbnailCache.contains(picInfo.id)) return;
+    requestImage(picInfo, LoadType::Thumbnail, 0);
+}
+void ImageLoader::requestImage(const PicInfo& picInfo, LoadType loadType, int previewDistance) {
     if (picInfo.filePaths.empty()) {
         Warn() << "No file paths available for PicInfo ID:" << picInfo.id;
-        return nullptr;
+        return;
     }
 
     std::lock_guard<std::mutex> lock(mutex);
+    int priority =
+        (loadType == LoadType::Thumbnail) ? thumbnailPriority(picInfo.id) : PREVIEW_LOAD_PRIORITY + std::max(0, previewDistance);
     auto& loadingSet = (loadType == LoadType::Thumbnail) ? loadingThumbnailIds : loadingPreviewIds;
     if (loadingSet.find(picInfo.id) != loadingSet.end()) {
-        return nullptr; // already queued or loading
+        setPriority(picInfo.id, loadType, priority); // already queued or loading, requested again, e.g. by a new center preview
+        return;
     }
 
     loadingSet.insert(picInfo.id);
-    taskQueue.push({loadType, picInfo.id, picInfo.filePaths});
+    enqueue({loadType, picInfo.id, picInfo.filePaths}, priority);
     condVar.notify_one();
-    return nullptr;
 }
-void ImageLoader::clearTasks() {
+ImageCacheStats ImageLoader::getCacheStats(LoadType loadType) const {
+    return (loadType == LoadType::Thumbnail) ? thumbnailCache.stats() : previewCache.stats();
+}
+void ImageLoader::setCacheBudget(size_t cacheBudgetBytes) {
+    thumbnailCache.setBudget(cacheBudgetBytes - cacheBudgetBytes / PREVIEW_CACHE_DIVISOR);
+    previewCache.setBudget(cacheBudgetBytes / PREVIEW_CACHE_DIVISOR);
+}
+void ImageLoader::setThumbnailPriority(std::function<int(uint64_t picId)> priorityFunction) {
+    std::lock_guard<std::mutex> lock(mutex);
+    thumbnailPriorityFunction = std::move(priorityFunction);
+}
+void ImageLoader::reprioritize() {
     std::lock_guard<std::mutex> lock(mutex);
-    while (!taskQueue.empty()) {
-        taskQueue.pop();
+    if (!thumbnailPriorityFunction) return;
+    for (auto& [picId, key] : queuedThumbnailKeys) {
+        int priority = thumbnailPriority(picId);
+        if (priority == key.first) continue;
+        auto node = taskQueue.extract(key);
+        key.first = priority;
+        node.key() = key;
+        taskQueue.insert(std::move(node));
     }
+}
+void ImageLoader::cancel(uint64_t picId, LoadType loadType) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& queuedKeys = (loadType == LoadType::Thumbnail) ? queuedThumbnailKeys : queuedPreviewKeys;
+    auto it = queuedKeys.find(picId);
+    if (it == queuedKeys.end()) return; // not queued, or already being decoded
+    taskQueue.erase(it->second);
+    queuedKeys.erase(it);
+    auto& loadingSet = (loadType == LoadType::Thumbnail) ? loadingThumbnailIds : loadingPreviewIds;
+    loadingSet.erase(picId);
+}
+void ImageLoader::clearTasks() {
+    std::lock_guard<std::mutex> lock(mutex);
+    taskQueue.clear();
+    queuedThumbnailKeys.clear();
+    queuedPreviewKeys.clear();
     loadingThumbnailIds.clear();
     loadingPreviewIds.clear();
 }
+int ImageLoader::thumbnailPriority(uint64_t picId) const {
+    return thumbnailPriorityFunction ? thumbnailPriorityFunction(picId) : LOWEST_LOAD_PRIORITY;
+}
+void ImageLoader::enqueue(ImageLoadTask&& task, int priority) {
+    TaskKey key{priority, taskSequence++};
+    auto& queuedKeys = (task.loadType == LoadType::Thumbnail) ? queuedThumbnailKeys : queuedPreviewKeys;
+    queuedKeys[task.id] = key;
+    taskQueue.emplace(key, std::move(task));
+}
+void ImageLoader::setPriority(uint64_t picId, LoadType loadType, int priority) {
+    auto& queuedKeys = (loadType == LoadType::Thumbnail) ? queuedThumbnailKeys : queuedPreviewKeys;
+    auto it = queuedKeys.find(picId);
+    if (it == queuedKeys.end() || it->second.first == priority) return; // being decoded or unchanged
+    auto node = taskQueue.extract(it->second);
+    it->second.first = priority;
+    node.key() = it->second;
+    taskQueue.insert(std::move(node));
+}
+void ImageLoader::generateThumbnails(const std::vector<std::pair<uint64_t, std::vector<std::filesystem::path>>>& pics) {
+    size_t queued = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [picId, filePaths] : pics) {
+        if (filePaths.empty() || thumbnailStore.contains(picId)) continue;
+        backgroundQueue.push({LoadType::Thumbnail, picId, filePaths, true});
+        queued++;
+    }
+    condVar.notify_all();
+    Info() << "Queued thumbnail generation for" << queued << "pictures.";
+}
 void ImageLoader::stop() {
     stopFlag.store(true);
     clearTasks();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!backgroundQueue.empty()) {
+            backgroundQueue.pop();
+        }
+    }
     condVar.notify_all();
     for (auto& worker : workers) {
         if (worker.joinable()) {
@@ -85,75 +172,106 @@ void ImageLoader::stop() {
     }
     workers.clear();
 }
+void ImageLoader::finishTask(const ImageLoadTask& task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& loadingSet = (task.loadType == LoadType::Thumbnail) ? loadingThumbnailIds : loadingPreviewIds;
+    loadingSet.erase(task.id);
+}
+std::unique_ptr<QImage> ImageLoader::readImage(const ImageLoadTask& task) const {
+    // get valid file path
+    QString filePathStr;
+    std::filesystem::path validFilePath;
+    for (const auto& filePath : task.filePaths) {
+        if (!std::filesystem::exists(filePath)) {
+            Warn() << "File does not exist:" << filePath;
+            continue;
+        }
+        filePathStr = QString::fromUtf8(filePath.u8string().c_str());
+        validFilePath = filePath;
+        break;
+    }
+
+    // jpeg and webp shrink while decoding, other formats and unsupported variants go through QImageReader
+    int resolutionLimit = (task.loadType == LoadType::Thumbnail) ? THUMBNAIL_RESOLUTION_LIMIT : PREVIEW_RESOLUTION_LIMIT;
+    if (!validFilePath.empty()) {
+        if (auto img = decodeScaledImage(validFilePath, resolutionLimit)) return img;
+    }
+
+    QImageReader reader(filePathStr);
+    if (!reader.canRead()) {
+        Warn() << "Cannot read image format:" << filePathStr;
+        return nullptr;
+    }
+    reader.setAutoTransform(true);
+
+    // read image
+    std::unique_ptr<QImage> img = std::make_unique<QImage>();
+    QSize originalSize = reader.size();
+    if (!originalSize.isValid()) originalSize = QSize(1, 1);
+    if (task.loadType == LoadType::Thumbnail &&
+        (originalSize.width() > THUMBNAIL_RESOLUTION_LIMIT || originalSize.height() > THUMBNAIL_RESOLUTION_LIMIT)) {
+        reader.setScaledSize(originalSize.scaled(THUMBNAIL_RESOLUTION_LIMIT, THUMBNAIL_RESOLUTION_LIMIT, Qt::KeepAspectRatio));
+    }
+    if (task.loadType == LoadType::Preview &&
+        (originalSize.width() > PREVIEW_RESOLUTION_LIMIT || originalSize.height() > PREVIEW_RESOLUTION_LIMIT)) {
+        reader.setScaledSize(originalSize.scaled(PREVIEW_RESOLUTION_LIMIT, PREVIEW_RESOLUTION_LIMIT, Qt::KeepAspectRatio));
+    }
+    if (!reader.read(img.get())) {
+        Warn() << "Failed to read image:" << filePathStr << ", Error:" << reader.errorString();
+        return nullptr;
+    }
+    return img;
+}
 void ImageLoader::workerFunction() {
     ImageLoadTask task;
     while (true) {
-        { // acquire task
+        { // acquire task, images waiting to be displayed go first, in priority order
             std::unique_lock<std::mutex> lock(mutex);
             if (stopFlag.load()) return;
-            condVar.wait(lock, [this]() { return !taskQueue.empty() || stopFlag.load(); });
-            if (stopFlag.load() && taskQueue.empty()) return;
-            task = taskQueue.front();
-            taskQueue.pop();
-        }
-
-        // get valid file path
-        QString filePathStr;
-        for (const auto& filePath : task.filePaths) {
-            if (!std::filesystem::exists(filePath)) {
-                Warn() << "File does not exist:" << filePath;
-                continue;
+            condVar.wait(lock, [this]() { return !taskQueue.empty() || !backgroundQueue.empty() || stopFlag.load(); });
+            if (stopFlag.load() && taskQueue.empty() && backgroundQueue.empty()) return;
+            if (!taskQueue.empty()) {
+                auto first = taskQueue.begin();
+                task = std::move(first->second);
+                taskQueue.erase(first);
+                auto& queuedKeys = (task.loadType == LoadType::Thumbnail) ? queuedThumbnailKeys : queuedPreviewKeys;
+                queuedKeys.erase(task.id);
+            } else {
+                task = backgroundQueue.front();
+                backgroundQueue.pop();
             }
-            filePathStr = QString::fromUtf8(filePath.u8string().c_str());
-            break;
         }
-        QImageReader reader(filePathStr);
-        if (!reader.canRead()) {
-            Warn() << "Cannot read image format:" << filePathStr;
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                auto& loadingSet = (task.loadType == LoadType::Thumbnail) ? loadingThumbnailIds : loadingPreviewIds;
-                loadingSet.erase(task.id);
-            }
+
+        if (task.storeOnly) {
+            if (thumbnailStore.contains(task.id)) continue;
+            if (auto img = readImage(task)) thumbnailStore.put(task.id, *img);
             continue;
         }
-        reader.setAutoTransform(true);
 
-        // read image
-        std::unique_ptr<QImage> img = std::make_unique<QImage>();
-        QSize originalSize = reader.size();
-        if (!originalSize.isValid()) originalSize = QSize(1, 1);
-        if (task.loadType == LoadType::Thumbnail &&
-            (originalSize.width() > THUMBNAIL_RESOLUTION_LIMIT || originalSize.height() > THUMBNAIL_RESOLUTION_LIMIT)) {
-            reader.setScaledSize(
-                originalSize.scaled(THUMBNAIL_RESOLUTION_LIMIT, THUMBNAIL_RESOLUTION_LIMIT, Qt::KeepAspectRatio));
-        }
-        if (task.loadType == LoadType::Preview &&
-            (originalSize.width() > PREVIEW_RESOLUTION_LIMIT || originalSize.height() > PREVIEW_RESOLUTION_LIMIT)) {
-            reader.setScaledSize(originalSize.scaled(PREVIEW_RESOLUTION_LIMIT, PREVIEW_RESOLUTION_LIMIT, Qt::KeepAspectRatio));
+        std::unique_ptr<QImage> img;
+        if (task.loadType == LoadType::Thumbnail) { // stored thumbnails are read from the memory mapped pack
+            img = thumbnailStore.get(task.id);
+            if (!img && thumbnailStore.contains(task.id)) thumbnailStore.invalidate(task.id); // corrupt blob, regenerate
         }
-        if (!reader.read(img.get())) {
-            Warn() << "Failed to read image:" << filePathStr << ", Error:" << reader.errorString();
-            {
-                std::lock_guard<std::mutex> lock(mutex);
-                auto& loadingSet = (task.loadType == LoadType::Thumbnail) ? loadingThumbnailIds : loadingPreviewIds;
-                loadingSet.erase(task.id);
+        if (!img) {
+            img = readImage(task);
+            if (!img) {
+                finishTask(task);
+                continue;
             }
-            continue;
+            if (task.loadType == LoadType::Thumbnail) thumbnailStore.put(task.id, *img);
         }
 
         // update cache
         if (task.loadType == LoadType::Thumbnail) {
+            // the picture grid paints thumbnails directly, convert here so the raster engine blits them on the ui thread
+            QImage::Format format = img->hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+            if (img->format() != format) img->convertTo(format);
             thumbnailCache.put(task.id, std::move(img));
         } else if (task.loadType == LoadType::Preview) {
             previewCache.put(task.id, std::move(img));
         }
-
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            auto& loadingSet = (task.loadType == LoadType::Thumbnail) ? loadingThumbnailIds : loadingPreviewIds;
-            loadingSet.erase(task.id);
-        }
+        finishTask(task);
 
         QCoreApplication::postEvent(mainWindow, new ImageLoadCompleteEvent({task.loadType, task.id}));
     }
@@ -19,14 +19,19 @@
 #pragma once
 #include "image_cache.h"
 #include "service/model.h"
+#include "thumbnail_store.h"
 #include <QEvent>
 #include <QImage>
 #include <atomic>
+#include <climits>
 #include <condition_variable>
 #include <filesystem>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -34,13 +39,21 @@ class MainWindow;
 
 enum class LoadType { Thumbnail, Preview };
 
-const size_t THUMBNAIL_CACHE_CAPACITY = 200;
-const size_t PREVIEW_CACHE_CAPACITY = 50;
+constexpr size_t DEFAULT_IMAGE_CACHE_BUDGET = size_t(512) << 20; // decoded bytes of thumbnails and previews together
+constexpr size_t PREVIEW_CACHE_DIVISOR = 4;                       // previews get a quarter of the budget
+
+// load priorities, smaller loads first
+constexpr int PREVIEW_LOAD_PRIORITY = 0;            // + distance from the previewed picture, the user is hovering over it
+constexpr int VISIBLE_THUMBNAIL_PRIORITY = 1 << 16; // + distance from the picture being looked at
+constexpr int PRELOAD_THUMBNAIL_PRIORITY = 1 << 24; // + distance, rows above and below the viewport
+constexpr int PREFETCH_THUMBNAIL_PRIORITY = 1 << 28; // + distance, predicted rows ahead of the scroll direction
+constexpr int LOWEST_LOAD_PRIORITY = INT_MAX;
 
 struct ImageLoadTask {
     LoadType loadType;
     uint64_t id;
     std::vector<std::filesystem::path> filePaths;
+    bool storeOnly = false; // bulk thumbnail generation, the result only goes to the thumbnail store
 };
 
 struct ImageLoadResult {
@@ -58,26 +71,53 @@ public:
 class ImageLoader {
 public:
     ImageLoader(MainWindow* mainWindow,
+                size_t cacheBudgetBytes = DEFAULT_IMAGE_CACHE_BUDGET,
                 size_t numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / 2));
     ~ImageLoader();
 
-    QImage* getImage(const PicInfo& picInfo, LoadType loadType);
-    QImage* getImage(uint64_t picId, LoadType loadType);
-    void clearTasks();
+    std::shared_ptr<QImage> getImage(const PicInfo& picInfo,
+                                     LoadType loadType,
+                                     int previewDistance = 0); // distance from the previewed picture ranks previews
+    std::shared_ptr<QImage> getImage(uint64_t picId, LoadType loadType);
+    void prefetch(const PicInfo& picInfo); // queue a thumbnail load without counting a cache access
+    ImageCacheStats getCacheStats(LoadType loadType) const;
+    void setCacheBudget(size_t cacheBudgetBytes); // drops cached images, call before the first image is requested
+    void clearTasks();       // background thumbnail generation is kept
+    void generateThumbnails( // runs when no visible image is waiting, skips stored thumbnails
+        const std::vector<std::pair<uint64_t, std::vector<std::filesystem::path>>>& pics);
+
+    // queued thumbnails are ranked by the priority function, it is only called on the gui thread
+    void setThumbnailPriority(std::function<int(uint64_t picId)> priorityFunction);
+    void reprioritize();                            // re-rank queued thumbnails, call when the viewport moves
+    void cancel(uint64_t picId, LoadType loadType); // drop a queued task, a task being decoded still completes
 
 private:
     void stop();
     void workerFunction();
+    std::unique_ptr<QImage> readImage(const ImageLoadTask& task) const; // decode the original file, scaled for the load type
+    void finishTask(const ImageLoadTask& task);
+    void requestImage(const PicInfo& picInfo, LoadType loadType, int previewDistance); // queue unless already loading
+    int thumbnailPriority(uint64_t picId) const;
+    void enqueue(ImageLoadTask&& task, int priority);                  // call with mutex held
+    void setPriority(uint64_t picId, LoadType loadType, int priority); // call with mutex held
     MainWindow* mainWindow;
     std::vector<std::thread> workers;
-    std::queue<ImageLoadTask> taskQueue;
+
+    using TaskKey = std::pair<int, uint64_t>;                  // (priority, sequence), equal priorities load in request order
+    std::map<TaskKey, ImageLoadTask> taskQueue;                // images waiting to be displayed, smallest key first
+    std::unordered_map<uint64_t, TaskKey> queuedThumbnailKeys; // queued tasks by picture id, to reprioritize and cancel
+    std::unordered_map<uint64_t, TaskKey> queuedPreviewKeys;
+    uint64_t taskSequence = 0;
+    std::function<int(uint64_t)> thumbnailPriorityFunction;
+    std::queue<ImageLoadTask> backgroundQueue; // storeOnly tasks
     std::mutex mutex;
     std::condition_variable condVar;
     std::atomic<bool> stopFlag{false};
 
-    std::unordered_set<uint64_t> loadingThumbnailIds;
+    std::unordered_set<uint64_t> loadingThumbnailIds; // queued or being decoded
     std::unordered_set<uint64_t> loadingPreviewIds;
 
-    ImageCache thumbnailCache{THUMBNAIL_CACHE_CAPACITY};
-    ImageCache previewCache{PREVIEW_CACHE_CAPACITY};
+    ImageCache thumbnailCache;
+    ImageCache previewCache;
+    ThumbnailStore thumbnailStore; // decoded thumbnails persisted across runs
 };
@@ -19,12 +19,14 @@
 #pragma once
 #include "../widgets/picture_frame.h"
 #include "service/model.h"
+#include <functional>
 #include <queue>
 #include <unordered_set>
 
 class PicFramePool {
 public:
-    PicFramePool(QWidget* parentWidget, ImageLoader* imageLoader) : parentWidget(parentWidget), imageLoader(imageLoader) {};
+    PicFramePool(QWidget* parentWidget, ImageLoader* imageLoader, std::function<void(uint64_t)> findSimilarHandler)
+        : parentWidget(parentWidget), imageLoader(imageLoader), findSimilarHandler(std::move(findSimilarHandler)) {};
     ~PicFramePool() {
         while (!availableFrames.empty()) {
             delete availableFrames.front();
@@ -42,6 +44,7 @@ public:
             frame->updateDisplayItem(picItem, metadataItem, searchField);
         } else {
             frame = new PictureFrame(parentWidget, picItem, metadataItem, *imageLoader, searchField);
+            if (findSimilarHandler) QObject::connect(frame, &PictureFrame::findSimilarSignal, frame, findSimilarHandler);
         }
         occupiedFrames.insert(frame);
         frame->show();
@@ -50,6 +53,7 @@ public:
     void release(PictureFrame* frame) {
         if (occupiedFrames.find(frame) == occupiedFrames.end()) return;
 
+        frame->cancelImageLoads(); // scrolled out of the preload rows, its images are no longer needed
         frame->reset();
         frame->hide();
         occupiedFrames.erase(frame);
@@ -62,4 +66,5 @@ private:
 
     QWidget* parentWidget = nullptr;
     ImageLoader* imageLoader = nullptr;
+    std::function<void(uint64_t)> findSimilarHandler; // called with the picture id chosen from a frame's context menu
 };
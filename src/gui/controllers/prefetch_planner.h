@@ -0,0 +1,64 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+constexpr double PREFETCH_SECONDS = 2.0;              // thumbnails are requested this far ahead at the current speed
+constexpr int MAX_PREFETCH_ROWS = 40;                 // several screens, bounded so a fling does not queue the whole grid
+constexpr double VELOCITY_SMOOTHING = 0.3;            // weight of the newest sample in the moving average
+constexpr std::chrono::milliseconds SCROLL_IDLE{250}; // a longer gap between scroll events starts from rest
+
+class PrefetchPlanner { // tracks scroll velocity to plan thumbnail loads ahead of the viewport
+public:
+    void addSample(int scrollValue) {
+        auto now = std::chrono::steady_clock::now();
+        if (hasSample && now - lastTime < SCROLL_IDLE) {
+            double seconds = std::max(std::chrono::duration<double>(now - lastTime).count(), 0.001);
+            double sample = (scrollValue - lastValue) / seconds;
+            velocity = VELOCITY_SMOOTHING * sample + (1.0 - VELOCITY_SMOOTHING) * velocity;
+        } else {
+            velocity = 0.0;
+        }
+        if (scrollValue != lastValue) direction = scrollValue > lastValue ? 1 : -1;
+        hasSample = true;
+        lastTime = now;
+        lastValue = scrollValue;
+    }
+    void reset() {
+        hasSample = false;
+        velocity = 0.0;
+        direction = 0;
+        lastValue = 0;
+    }
+    int getDirection() const { return direction; } // 1 down, -1 up, 0 not scrolled yet
+    int lookaheadRows(int rowHeight) const {       // at least one row once the user has scrolled
+        if (direction == 0 || rowHeight <= 0) return 0;
+        int rows = static_cast<int>(std::ceil(std::abs(velocity) * PREFETCH_SECONDS / rowHeight));
+        return std::clamp(rows, 1, MAX_PREFETCH_ROWS);
+    }
+
+private:
+    bool hasSample = false;
+    std::chrono::steady_clock::time_point lastTime;
+    int lastValue = 0;
+    double velocity = 0.0; // pixels per second, positive when scrolling down
+    int direction = 0;
+};
@@ -0,0 +1,192 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scaled_decoder.h"
+#include <QFile>
+#include <QTransform>
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio> // jpeglib.h needs FILE
+#include <cstring>
+#include <jpeglib.h>
+#include <webp/decode.h>
+
+static QSize targetSize(int width, int height, int limit) { // keep aspect ratio, never upscale
+    if (width <= limit && height <= limit) return QSize(width, height);
+    return QSize(width, height).scaled(limit, limit, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+}
+
+// exif orientation
+
+static uint32_t readExifValue(const uchar* p, size_t bytes, bool bigEndian) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= static_cast<uint32_t>(p[bigEndian ? i : bytes - 1 - i]) << (8 * (bytes - 1 - i));
+    }
+    return value;
+}
+static int exifOrientation(const jpeg_saved_marker_ptr markers) { // 1 to 8, 1 if missing
+    for (jpeg_saved_marker_ptr marker = markers; marker; marker = marker->next) {
+        const uchar* data = marker->data;
+        size_t size = marker->data_length;
+        if (marker->marker != JPEG_APP0 + 1 || size < 14 || std::memcmp(data, "Exif\0\0", 6) != 0) continue;
+        const uchar* tiff = data + 6;
+        size_t tiffSize = size - 6;
+        bool bigEndian = tiff[0] == 'M';
+        if (!bigEndian && tiff[0] != 'I') return 1;
+        size_t ifdOffset = readExifValue(tiff + 4, 4, bigEndian); // size_t so the bounds math below can not wrap
+        if (ifdOffset + 2 > tiffSize) return 1;
+        size_t entryCount = std::min<size_t>(readExifValue(tiff + ifdOffset, 2, bigEndian), (tiffSize - ifdOffset - 2) / 12);
+        for (size_t i = 0; i < entryCount; i++) {
+            size_t entry = ifdOffset + 2 + i * 12;
+            if (readExifValue(tiff + entry, 2, bigEndian) != 0x0112) continue; // orientation tag, a short
+            uint32_t orientation = readExifValue(tiff + entry + 8, 2, bigEndian);
+            return (orientation >= 1 && orientation <= 8) ? static_cast<int>(orientation) : 1;
+        }
+        return 1;
+    }
+    return 1;
+}
+static QImage applyOrientation(const QImage& image, int orientation) { // same mapping as QImageReader::setAutoTransform
+    static constexpr bool MIRROR[9] = {false, false, true, true, false, false, false, true, true};
+    static constexpr bool FLIP[9] = {false, false, false, true, true, true, false, false, true};
+    static constexpr bool ROTATE_90[9] = {false, false, false, false, false, true, true, true, true};
+    if (orientation <= 1 || orientation > 8) return image;
+    QImage result = image.mirrored(MIRROR[orientation], FLIP[orientation]);
+    if (ROTATE_90[orientation]) result = result.transformed(QTransform().rotate(90));
+    return result;
+}
+
+// jpeg
+
+struct JpegErrorManager {
+    jpeg_error_mgr base;
+    jmp_buf jump;
+};
+static void jpegErrorExit(j_common_ptr cinfo) { // the default handler exits the process
+    longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+}
+static void jpegOutputMessage(j_common_ptr) {} // warnings of slightly broken files are not interesting here
+
+// outputs live in the caller, values changed between setjmp and longjmp are indeterminate in this frame
+static bool readJpeg(const uchar* data, size_t size, int limit, QImage* image, QSize* target, int* orientation) {
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager errorManager;
+    cinfo.err = jpeg_std_error(&errorManager.base);
+    errorManager.base.error_exit = jpegErrorExit;
+    errorManager.base.output_message = jpegOutputMessage;
+    if (setjmp(errorManager.jump)) { // corrupt data
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, static_cast<unsigned long>(size));
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF); // exif
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK || cinfo.jpeg_color_space == JCS_CMYK ||
+        cinfo.jpeg_color_space == JCS_YCCK) { // qt knows how to invert adobe cmyk, leave those to it
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    *orientation = exifOrientation(cinfo.marker_list);
+
+    // largest power of two reduction that still covers the target, the idct then only computes the needed coefficients
+    *target = targetSize(static_cast<int>(cinfo.image_width), static_cast<int>(cinfo.image_height), limit);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+    for (unsigned int denom = 8; denom > 1; denom /= 2) {
+        if ((cinfo.image_width + denom - 1) / denom >= static_cast<unsigned int>(target->width()) &&
+            (cinfo.image_height + denom - 1) / denom >= static_cast<unsigned int>(target->height())) {
+            cinfo.scale_denom = denom;
+            break;
+        }
+    }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    cinfo.out_color_space = JCS_EXT_BGRX; // Format_RGB32 byte order, the filler byte is 0xff
+#else
+    cinfo.out_color_space = JCS_EXT_XRGB;
+#endif
+    jpeg_start_decompress(&cinfo);
+    *image = QImage(static_cast<int>(cinfo.output_width), static_cast<int>(cinfo.output_height), QImage::Format_RGB32);
+    if (image->isNull()) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = image->scanLine(static_cast<int>(cinfo.output_scanline));
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+std::unique_ptr<QImage> decodeScaledJpeg(const uchar* data, size_t size, int limit) {
+    auto image = std::make_unique<QImage>();
+    QSize target;
+    int orientation = 1;
+    if (!readJpeg(data, size, limit, image.get(), &target, &orientation)) return nullptr;
+
+    if (image->width() > target.width() || image->height() > target.height()) { // at most 2x left to scale
+        *image = image->scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    if (orientation != 1) *image = applyOrientation(*image, orientation);
+    return image;
+}
+
+// webp
+
+std::unique_ptr<QImage> decodeScaledWebp(const uchar* data, size_t size, int limit) {
+    WebPDecoderConfig config;
+    if (!WebPInitDecoderConfig(&config)) return nullptr;
+    if (WebPGetFeatures(data, size, &config.input) != VP8_STATUS_OK || config.input.has_animation) return nullptr;
+
+    QSize target = targetSize(config.input.width, config.input.height, limit);
+    auto image = std::make_unique<QImage>(target, config.input.has_alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    if (image->isNull()) return nullptr;
+    if (target.width() != config.input.width || target.height() != config.input.height) {
+        config.options.use_scaling = 1; // rows are scaled as they are decoded, no full size buffer
+        config.options.scaled_width = target.width();
+        config.options.scaled_height = target.height();
+    }
+    config.output.colorspace = MODE_BGRA; // bgra byte order on little-endian, opaque images get 0xff alpha
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = image->bits();
+    config.output.u.RGBA.stride = static_cast<int>(image->bytesPerLine());
+    config.output.u.RGBA.size = static_cast<size_t>(image->sizeInBytes());
+    bool decoded = WebPDecode(data, size, &config) == VP8_STATUS_OK;
+    WebPFreeDecBuffer(&config.output); // no-op for external memory
+    return decoded ? std::move(image) : nullptr;
+}
+
+// dispatch by signature
+
+std::unique_ptr<QImage> decodeScaledImage(const std::filesystem::path& filePath, int limit) {
+    QFile file(QString::fromUtf8(filePath.u8string().c_str()));
+    if (!file.open(QIODevice::ReadOnly)) return nullptr;
+    qint64 size = file.size();
+    if (size < 12) return nullptr;
+    const uchar* data = file.map(0, size); // unmapped when file is destroyed
+    if (!data) return nullptr;
+
+    if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        return decodeScaledJpeg(data, static_cast<size_t>(size), limit);
+    }
+    if (std::memcmp(data, "RIFF", 4) == 0 && std::memcmp(data + 8, "WEBP", 4) == 0) {
+        return decodeScaledWebp(data, static_cast<size_t>(size), limit);
+    }
+    return nullptr;
+}
@@ -0,0 +1,32 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QImage>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+// decoders that shrink while decoding instead of decoding at full resolution and scaling afterwards
+// jpeg: libjpeg idct scaling by 1/2, 1/4 or 1/8, webp: libwebp scaled output
+// the result fits in limit x limit, nullptr if the file is another format or uses a feature these paths skip,
+// e.g. cmyk jpeg or animated webp, callers then fall back to QImageReader
+
+std::unique_ptr<QImage> decodeScaledImage(const std::filesystem::path& filePath, int limit);
+std::unique_ptr<QImage> decodeScaledJpeg(const uchar* data, size_t size, int limit);
+std::unique_ptr<QImage> decodeScaledWebp(const uchar* data, size_t size, int limit);
@@ -0,0 +1,282 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sorter.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+constexpr int RADIX_BITS = 8;
+constexpr size_t RADIX_BUCKETS = 1 << RADIX_BITS;
+constexpr uint64_t RADIX_MASK = RADIX_BUCKETS - 1;
+constexpr uint64_t SIGN_BIT = 1ull << 63;
+
+static size_t sortThreadCount(size_t count) {
+    if (count < PARALLEL_SORT_THRESHOLD) return 1;
+    size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    return std::min({hardwareThreads, MAX_SORT_THREADS, count / (PARALLEL_SORT_THRESHOLD / 2)});
+}
+template <typename Func> // calls func(chunk, begin, end) for threadCount contiguous chunks of [0, count), the same for every call
+static void forEachChunk(size_t count, size_t threadCount, Func&& func) {
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount - 1);
+    for (size_t chunk = 1; chunk < threadCount; chunk++) {
+        threads.emplace_back([&func, count, threadCount, chunk]() {
+            func(chunk, count * chunk / threadCount, count * (chunk + 1) / threadCount);
+        });
+    }
+    func(0, 0, count / threadCount);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// stable lsd radix sort, values are permuted together with keys
+static void radixSort(std::vector<uint64_t>& keys, std::vector<int>& values) {
+    size_t count = keys.size();
+    size_t threadCount = sortThreadCount(count);
+
+    // a pass over a digit that is the same in every key would not move anything
+    std::vector<uint64_t> chunkOr(threadCount, 0);
+    std::vector<uint64_t> chunkAnd(threadCount, ~0ull);
+    forEachChunk(count, threadCount, [&](size_t chunk, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            chunkOr[chunk] |= keys[i];
+            chunkAnd[chunk] &= keys[i];
+        }
+    });
+    uint64_t anyBits = 0;
+    uint64_t allBits = ~0ull;
+    for (size_t chunk = 0; chunk < threadCount; chunk++) {
+        anyBits |= chunkOr[chunk];
+        allBits &= chunkAnd[chunk];
+    }
+    uint64_t varyingBits = anyBits ^ allBits;
+
+    std::vector<uint64_t> keyBuffer(count);
+    std::vector<int> valueBuffer(count);
+    std::vector<std::array<size_t, RADIX_BUCKETS>> offsets(threadCount);
+    for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+        if (((varyingBits >> shift) & RADIX_MASK) == 0) continue;
+
+        forEachChunk(count, threadCount, [&](size_t chunk, size_t begin, size_t end) {
+            auto& histogram = offsets[chunk];
+            histogram.fill(0);
+            for (size_t i = begin; i < end; i++) {
+                histogram[(keys[i] >> shift) & RADIX_MASK]++;
+            }
+        });
+        size_t offset = 0; // digit major, chunk minor, so equal digits keep their order across chunks
+        for (size_t digit = 0; digit < RADIX_BUCKETS; digit++) {
+            for (size_t chunk = 0; chunk < threadCount; chunk++) {
+                size_t digitCount = offsets[chunk][digit];
+                offsets[chunk][digit] = offset;
+                offset += digitCount;
+            }
+        }
+        forEachChunk(count, threadCount, [&](size_t chunk, size_t begin, size_t end) {
+            auto& positions = offsets[chunk];
+            for (size_t i = begin; i < end; i++) {
+                size_t position = positions[(keys[i] >> shift) & RADIX_MASK]++;
+                keyBuffer[position] = keys[i];
+                valueBuffer[position] = values[i];
+            }
+        });
+        keys.swap(keyBuffer);
+        values.swap(valueBuffer);
+    }
+}
+
+// key extraction
+
+static uint64_t signedKey(int64_t value) { // order preserving map of signed integers onto unsigned keys
+    return static_cast<uint64_t>(value) ^ SIGN_BIT;
+}
+static uint64_t floatKey(float value) { // order preserving for non-negative floats
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+static std::vector<uint64_t> internFilenames(const std::vector<int>& indices, const std::vector<PicItem>& picItems) {
+    // every filename is built once, then ranked, equal names share an ordinal
+    size_t count = indices.size();
+    size_t threadCount = sortThreadCount(count);
+    std::vector<std::string> names(count);
+    forEachChunk(count, threadCount, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const auto& filePaths = picItems[indices[i]].info.filePaths;
+            if (!filePaths.empty()) names[i] = filePaths[0].filename().string();
+        }
+    });
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    auto nameLess = [&names](uint32_t a, uint32_t b) { return names[a] < names[b]; };
+    forEachChunk(count, threadCount, [&](size_t, size_t begin, size_t end) {
+        std::sort(order.begin() + begin, order.begin() + end, nameLess);
+    });
+    for (size_t width = 1; width < threadCount; width *= 2) { // merge sorted neighbours in rounds
+        std::vector<std::thread> threads;
+        for (size_t chunk = 0; chunk + width < threadCount; chunk += 2 * width) {
+            size_t begin = count * chunk / threadCount;
+            size_t middle = count * (chunk + width) / threadCount;
+            size_t end = count * std::min(chunk + 2 * width, threadCount) / threadCount;
+            threads.emplace_back([&order, &nameLess, begin, middle, end]() {
+                std::inplace_merge(order.begin() + begin, order.begin() + middle, order.begin() + end, nameLess);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    std::vector<uint64_t> ordinals(count);
+    uint64_t ordinal = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && names[order[i]] != names[order[i - 1]]) ordinal++;
+        ordinals[order[i]] = ordinal;
+    }
+    return ordinals;
+}
+static std::vector<uint64_t> extractPicKeys(const std::vector<int>& indices,
+                                            const std::vector<PicItem>& picItems,
+                                            const SortContext& sortContext) {
+    if (sortContext.sortBy == SortBy::Filename) return internFilenames(indices, picItems);
+
+    size_t count = indices.size();
+    std::vector<uint64_t> keys(count);
+    forEachChunk(count, sortThreadCount(count), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const PicInfo& info = picItems[indices[i]].info;
+            switch (sortContext.sortBy) {
+            case SortBy::ID:
+                keys[i] = info.id;
+                break;
+            case SortBy::DownloadDate:
+                keys[i] = signedKey(parseIsoTime(info.downloadTime));
+                break;
+            case SortBy::EditDate:
+                keys[i] = signedKey(parseIsoTime(info.editTime));
+                break;
+            case SortBy::Size:
+                keys[i] = info.size;
+                break;
+            case SortBy::Width:
+                keys[i] = info.width;
+                break;
+            case SortBy::Height:
+                keys[i] = info.height;
+                break;
+            case SortBy::Ratio:
+                keys[i] = floatKey(std::abs(sortContext.ratio - info.getRatio()));
+                break;
+            default:
+                keys[i] = 0;
+                break;
+            }
+        }
+    });
+    return keys;
+}
+
+static void sortIndicesByKeys(std::vector<int>& indices, std::vector<uint64_t>& keys, bool descending) {
+    if (descending) { // complementing keys reverses their order but keeps ties in place
+        for (auto& key : keys) {
+            key = ~key;
+        }
+    }
+    radixSort(keys, indices);
+}
+void sortPicItemIndices(std::vector<int>& indices, const std::vector<PicItem>& picItems, const SortContext& sortContext) {
+    if (sortContext.sortBy == SortBy::None) return;
+    std::vector<uint64_t> keys = extractPicKeys(indices, picItems, sortContext);
+    // ratio is always closest first
+    bool descending = sortContext.sortOrder == SortOrder::Descending && sortContext.sortBy != SortBy::Ratio;
+    sortIndicesByKeys(indices, keys, descending);
+}
+void sortMetadataItemIndices(std::vector<int>& indices,
+                             const std::vector<MetadataItem>& metadataItems,
+                             const SortContext& sortContext) {
+    if (sortContext.sortBy != SortBy::ID && sortContext.sortBy != SortBy::DownloadDate) return; // other keys are per file
+
+    size_t count = indices.size();
+    std::vector<uint64_t> keys(count);
+    forEachChunk(count, sortThreadCount(count), [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Metadata& metadata = metadataItems[indices[i]].metadata;
+            keys[i] = signedKey(sortContext.sortBy == SortBy::ID ? metadata.id : parseIsoTime(metadata.date));
+        }
+    });
+    sortIndicesByKeys(indices, keys, sortContext.sortOrder == SortOrder::Descending);
+}
+
+// date parsing
+
+int64_t parseIsoTime(const std::string& time) {
+    constexpr int64_t INVALID_TIME = std::numeric_limits<int64_t>::min();
+    const char* p = time.c_str();
+    auto readNumber = [&p](int digits, int& number) {
+        number = 0;
+        for (int i = 0; i < digits; i++, p++) {
+            if (*p < '0' || *p > '9') return false;
+            number = number * 10 + (*p - '0');
+        }
+        return true;
+    };
+    auto skip = [&p](char c) {
+        if (*p != c) return false;
+        p++;
+        return true;
+    };
+
+    int year, month, day;
+    int hour = 0, minute = 0, second = 0;
+    int offsetSeconds = 0;
+    if (!readNumber(4, year) || !skip('-') || !readNumber(2, month) || !skip('-') || !readNumber(2, day)) return INVALID_TIME;
+    if (year < 1 || month < 1 || month > 12 || day < 1 || day > 31) return INVALID_TIME;
+    if (skip('T') || skip(' ')) {
+        if (!readNumber(2, hour) || !skip(':') || !readNumber(2, minute)) return INVALID_TIME;
+        if (skip(':') && !readNumber(2, second)) return INVALID_TIME;
+        if (skip('.')) { // fractions of a second are ignored, such times tie with the rest of their second
+            while (*p >= '0' && *p <= '9')
+                p++;
+        }
+        if (*p == '+' || *p == '-') { // utc offset, +hh:mm, +hhmm or +hh
+            int sign = *p == '-' ? -1 : 1;
+            p++;
+            int offsetHours, offsetMinutes = 0;
+            if (!readNumber(2, offsetHours)) return INVALID_TIME;
+            skip(':');
+            if (*p != '\0' && !readNumber(2, offsetMinutes)) return INVALID_TIME;
+            offsetSeconds = sign * (offsetHours * 3600 + offsetMinutes * 60);
+        }
+    }
+
+    // days since 1970-01-01 of a proleptic gregorian date, year is at least 1 so no era is negative
+    int shiftedYear = year - (month <= 2 ? 1 : 0); // years start in march so the leap day is the last day
+    int era = shiftedYear / 400;
+    int yearOfEra = shiftedYear - era * 400;
+    int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    int64_t days = static_cast<int64_t>(era) * 146097 + dayOfEra - 719468;
+    return days * 86400 + hour * 3600 + minute * 60 + second - offsetSeconds;
+}
@@ -0,0 +1,37 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "context_controller.h"
+#include "service/model.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr size_t PARALLEL_SORT_THRESHOLD = 1 << 15; // smaller inputs are sorted on the calling thread
+constexpr size_t MAX_SORT_THREADS = 8;
+
+// sort stage for display items: one compact integer key is extracted per item, then (key, index) pairs are radix sorted,
+// so no comparison touches a path or a date string. Items with equal keys keep their order in indices
+void sortPicItemIndices(std::vector<int>& indices, const std::vector<PicItem>& picItems, const SortContext& sortContext);
+void sortMetadataItemIndices(std::vector<int>& indices,
+                             const std::vector<MetadataItem>& metadataItems,
+                             const SortContext& sortContext);
+
+int64_t parseIsoTime(const std::string& time); // seconds since epoch, INT64_MIN if the string is not an ISO 8601 date
@@ -0,0 +1,279 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "thumbnail_store.h"
+#include "utils/logger.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <webp/decode.h>
+#include <webp/encode.h>
+
+static QString toQString(const std::filesystem::path& path) {
+    return QString::fromUtf8(path.u8string().c_str());
+}
+
+// initialize
+
+ThumbnailStore::ThumbnailStore(const std::filesystem::path& packFilePath)
+    : packFilePath(packFilePath), indexFilePath(packFilePath.string() + ".idx") {
+    opened = open();
+    if (!opened) Warn() << "Thumbnail store unavailable, thumbnails will be decoded from original files.";
+}
+ThumbnailStore::~ThumbnailStore() {
+    if (mapped) packFile.unmap(mapped);
+    packFile.close();
+    indexFile.close();
+}
+bool ThumbnailStore::open() {
+    packFile.setFileName(toQString(packFilePath));
+    indexFile.setFileName(toQString(indexFilePath));
+    if (!packFile.open(QIODevice::ReadWrite) || !indexFile.open(QIODevice::ReadWrite)) {
+        Error() << "Failed to open thumbnail store:" << packFile.errorString() << indexFile.errorString();
+        return false;
+    }
+    if (!loadIndex()) {
+        if (packFile.size() > 0) Warn() << "Thumbnail store is outdated or corrupt, recreating:" << packFilePath.string();
+        if (!reset()) {
+            Error() << "Failed to create thumbnail store:" << packFile.errorString();
+            return false;
+        }
+    }
+    if (deadBytes > liveBytes && !compact()) { // the store stays usable without compaction
+        Warn() << "Failed to compact thumbnail store, dead bytes:" << deadBytes;
+        if (!packFile.isOpen() || !indexFile.isOpen()) return false;
+    }
+    Info() << "Thumbnail store loaded. Thumbnails:" << locations.size() << "Size (MB):" << packSize / (1024 * 1024);
+    return true;
+}
+ThumbnailStore::FileHeader ThumbnailStore::makeHeader() {
+    FileHeader header{};
+    std::memcpy(header.magic, "WGTP", sizeof(header.magic));
+    header.version = THUMBNAIL_PACK_VERSION;
+    header.thumbnailSize = THUMBNAIL_SIZE;
+    return header;
+}
+bool ThumbnailStore::isValidHeader(const FileHeader& header) {
+    return std::memcmp(header.magic, "WGTP", sizeof(header.magic)) == 0 && header.version == THUMBNAIL_PACK_VERSION &&
+           header.thumbnailSize == THUMBNAIL_SIZE;
+}
+bool ThumbnailStore::reset() {
+    locations.clear();
+    liveBytes = 0;
+    deadBytes = 0;
+    FileHeader header = makeHeader();
+    if (!packFile.resize(0) || !indexFile.resize(0) || !packFile.seek(0) || !indexFile.seek(0)) return false;
+    if (packFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header) ||
+        indexFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)) {
+        return false;
+    }
+    packSize = sizeof(FileHeader);
+    return packFile.flush() && indexFile.flush();
+}
+bool ThumbnailStore::loadIndex() {
+    locations.clear();
+    liveBytes = 0;
+    deadBytes = 0;
+    packSize = sizeof(FileHeader);
+
+    FileHeader packHeader{};
+    FileHeader indexHeader{};
+    if (!packFile.seek(0) || !indexFile.seek(0)) return false;
+    if (packFile.read(reinterpret_cast<char*>(&packHeader), sizeof(packHeader)) != sizeof(packHeader) ||
+        indexFile.read(reinterpret_cast<char*>(&indexHeader), sizeof(indexHeader)) != sizeof(indexHeader)) {
+        return false;
+    }
+    if (!isValidHeader(packHeader) || !isValidHeader(indexHeader)) return false;
+
+    const auto packFileSize = static_cast<uint64_t>(packFile.size());
+    QByteArray entries = indexFile.readAll();
+    size_t entryCount = static_cast<size_t>(entries.size()) / sizeof(IndexEntry); // a torn trailing entry is ignored
+    for (size_t i = 0; i < entryCount; i++) {
+        IndexEntry entry;
+        std::memcpy(&entry, entries.constData() + i * sizeof(IndexEntry), sizeof(IndexEntry));
+        auto it = locations.find(entry.id);
+        if (it != locations.end()) { // replaced or invalidated
+            liveBytes -= it->second.size;
+            deadBytes += it->second.size;
+            locations.erase(it);
+        }
+        if (entry.size == 0) continue;
+        if (entry.offset < sizeof(FileHeader) || entry.offset + entry.size > packFileSize) continue; // blob never completed
+        locations[entry.id] = {entry.offset, entry.size};
+        liveBytes += entry.size;
+        packSize = std::max(packSize, entry.offset + entry.size);
+    }
+    // later appends overwrite whatever follows the last indexed blob
+    return indexFile.resize(sizeof(FileHeader) + entryCount * sizeof(IndexEntry));
+}
+bool ThumbnailStore::compact() {
+    // copy live blobs into new files in their original order, then swap the files in
+    std::filesystem::path newPackPath = packFilePath.string() + ".tmp";
+    std::filesystem::path newIndexPath = indexFilePath.string() + ".tmp";
+    QFile newPack(toQString(newPackPath));
+    QFile newIndex(toQString(newIndexPath));
+    if (!newPack.open(QIODevice::WriteOnly | QIODevice::Truncate) || !newIndex.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    uchar* source = packFile.map(0, packFile.size());
+    if (!source) return false;
+
+    std::vector<std::pair<uint64_t, BlobLocation>> liveBlobs(locations.begin(), locations.end());
+    std::sort(liveBlobs.begin(), liveBlobs.end(), [](const auto& a, const auto& b) { return a.second.offset < b.second.offset; });
+
+    FileHeader header = makeHeader();
+    bool written = newPack.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+                   newIndex.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    std::unordered_map<uint64_t, BlobLocation> newLocations;
+    uint64_t offset = sizeof(FileHeader);
+    for (const auto& [id, location] : liveBlobs) {
+        if (!written) break;
+        IndexEntry entry{id, offset, location.size, 0};
+        written = newPack.write(reinterpret_cast<const char*>(source + location.offset), location.size) == location.size &&
+                  newIndex.write(reinterpret_cast<const char*>(&entry), sizeof(entry)) == sizeof(entry);
+        newLocations[id] = {offset, location.size};
+        offset += location.size;
+    }
+    packFile.unmap(source);
+    written = written && newPack.flush() && newIndex.flush();
+    newPack.close();
+    newIndex.close();
+    if (!written) {
+        QFile::remove(toQString(newPackPath));
+        QFile::remove(toQString(newIndexPath));
+        return false;
+    }
+
+    packFile.close();
+    indexFile.close();
+    std::error_code packError;
+    std::error_code indexError;
+    std::filesystem::rename(newPackPath, packFilePath, packError);
+    std::filesystem::rename(newIndexPath, indexFilePath, indexError);
+    if (packError || indexError || !packFile.open(QIODevice::ReadWrite) || !indexFile.open(QIODevice::ReadWrite)) {
+        Error() << "Failed to replace thumbnail store files:" << packError.message() << indexError.message();
+        return false; // the headers no longer match, so the next start recreates the store
+    }
+    Info() << "Thumbnail store compacted. Reclaimed (MB):" << deadBytes / (1024 * 1024);
+    locations = std::move(newLocations);
+    packSize = offset;
+    deadBytes = 0;
+    return true;
+}
+
+// reads and writes
+
+bool ThumbnailStore::contains(uint64_t id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return locations.find(id) != locations.end();
+}
+size_t ThumbnailStore::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return locations.size();
+}
+void ThumbnailStore::remap() const {
+    if (mapped) {
+        packFile.unmap(mapped);
+        mapped = nullptr;
+        mappedSize = 0;
+    }
+    qint64 fileSize = packFile.size();
+    mapped = packFile.map(0, fileSize);
+    if (!mapped) {
+        Warn() << "Failed to map thumbnail store:" << packFile.errorString();
+        return;
+    }
+    mappedSize = static_cast<uint64_t>(fileSize);
+}
+std::unique_ptr<QImage> ThumbnailStore::get(uint64_t id) const {
+    if (!opened) return nullptr;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = locations.find(id);
+    if (it == locations.end()) return nullptr;
+    if (it->second.offset + it->second.size > mappedSize) { // appended after the last mapping
+        lock.unlock();
+        {
+            std::unique_lock<std::shared_mutex> exclusiveLock(mutex);
+            if (packSize > mappedSize) remap();
+        }
+        lock.lock();
+        it = locations.find(id); // may have been invalidated meanwhile
+        if (it == locations.end() || it->second.offset + it->second.size > mappedSize) return nullptr;
+    }
+
+    // decode straight from the mapping, blobs are never overwritten while mapped
+    const uint8_t* data = mapped + it->second.offset;
+    size_t dataSize = it->second.size;
+    int width = 0;
+    int height = 0;
+    if (!WebPGetInfo(data, dataSize, &width, &height)) return nullptr;
+    auto image = std::make_unique<QImage>(width, height, QImage::Format_ARGB32); // bgra byte order on little-endian
+    if (!WebPDecodeBGRAInto(
+            data, dataSize, image->bits(), static_cast<size_t>(image->sizeInBytes()), image->bytesPerLine())) {
+        return nullptr;
+    }
+    return image;
+}
+bool ThumbnailStore::appendIndexEntry(const IndexEntry& entry) {
+    if (!indexFile.seek(indexFile.size()) ||
+        indexFile.write(reinterpret_cast<const char*>(&entry), sizeof(entry)) != sizeof(entry) || !indexFile.flush()) {
+        Error() << "Failed to write thumbnail index:" << indexFile.errorString();
+        return false;
+    }
+    return true;
+}
+bool ThumbnailStore::put(uint64_t id, const QImage& thumbnail) {
+    if (!opened || thumbnail.isNull()) return false;
+    if (contains(id)) return true; // identical files share one thumbnail
+
+    // encode before taking the lock, only the append is serialized
+    QImage image = thumbnail.convertToFormat(QImage::Format_ARGB32);
+    uint8_t* blob = nullptr;
+    size_t blobSize =
+        WebPEncodeBGRA(image.constBits(), image.width(), image.height(), image.bytesPerLine(), THUMBNAIL_QUALITY, &blob);
+    if (blobSize == 0) {
+        Warn() << "Failed to encode thumbnail:" << id;
+        return false;
+    }
+    std::unique_ptr<uint8_t, void (*)(void*)> blobGuard(blob, WebPFree);
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (locations.find(id) != locations.end()) return true; // stored by another worker meanwhile
+    if (!packFile.seek(static_cast<qint64>(packSize)) ||
+        packFile.write(reinterpret_cast<const char*>(blob), static_cast<qint64>(blobSize)) != static_cast<qint64>(blobSize) ||
+        !packFile.flush()) {
+        Error() << "Failed to write thumbnail store:" << packFile.errorString();
+        return false;
+    }
+    if (!appendIndexEntry({id, packSize, static_cast<uint32_t>(blobSize), 0})) return false;
+    locations[id] = {packSize, static_cast<uint32_t>(blobSize)};
+    liveBytes += blobSize;
+    packSize += blobSize;
+    return true;
+}
+void ThumbnailStore::invalidate(uint64_t id) {
+    if (!opened) return;
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = locations.find(id);
+    if (it == locations.end()) return;
+    if (!appendIndexEntry({id, 0, 0, 0})) return;
+    liveBytes -= it->second.size;
+    deadBytes += it->second.size;
+    locations.erase(it);
+}
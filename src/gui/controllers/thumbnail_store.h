@@ -0,0 +1,92 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <QFile>
+#include <QImage>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+const std::string DEFAULT_THUMBNAIL_PACK_FILE = "thumbnails.pack"; // index is stored next to it as thumbnails.pack.idx
+
+constexpr uint32_t THUMBNAIL_PACK_VERSION = 1;
+constexpr int THUMBNAIL_SIZE = 256;       // longest side of stored thumbnails, changing it recreates the store
+constexpr float THUMBNAIL_QUALITY = 80.f; // webp quality
+
+// content-addressed thumbnail store, pictures are keyed by their xxhash id so identical files share one thumbnail
+// pack file: header, then webp blobs appended back to back, read through a memory map
+// index file: header, then (id, offset, size) entries appended on every write, size 0 marks an invalidated id
+class ThumbnailStore {
+public:
+    explicit ThumbnailStore(const std::filesystem::path& packFilePath = DEFAULT_THUMBNAIL_PACK_FILE);
+    ~ThumbnailStore();
+    ThumbnailStore(const ThumbnailStore&) = delete;
+    ThumbnailStore& operator=(const ThumbnailStore&) = delete;
+
+    bool contains(uint64_t id) const;
+    std::unique_ptr<QImage> get(uint64_t id) const; // nullptr if not stored or the blob is corrupt
+    bool put(uint64_t id, const QImage& thumbnail);  // thumbnail should already be scaled to THUMBNAIL_SIZE
+    void invalidate(uint64_t id);
+    size_t size() const;
+
+private:
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t thumbnailSize;
+        uint32_t reserved;
+    };
+    struct IndexEntry {
+        uint64_t id;
+        uint64_t offset;
+        uint32_t size;
+        uint32_t reserved;
+    };
+    struct BlobLocation {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    std::filesystem::path packFilePath;
+    std::filesystem::path indexFilePath;
+    mutable QFile packFile;
+    QFile indexFile;
+    bool opened = false;
+
+    std::unordered_map<uint64_t, BlobLocation> locations; // id -> blob in pack file
+    uint64_t packSize = 0;                                // end of the last complete blob
+    uint64_t liveBytes = 0;
+    uint64_t deadBytes = 0; // blobs of invalidated or replaced ids, reclaimed by compaction on open
+
+    mutable uchar* mapped = nullptr; // mapping of [0, mappedSize) of the pack file, grown lazily by get
+    mutable uint64_t mappedSize = 0;
+    mutable std::shared_mutex mutex; // shared for reads from the mapping, exclusive for appends and remapping
+
+    bool open();
+    bool reset(); // recreate both files empty
+    bool loadIndex();
+    bool compact();
+    bool appendIndexEntry(const IndexEntry& entry);
+    void remap() const; // call with the exclusive lock held
+    static FileHeader makeHeader();
+    static bool isValidHeader(const FileHeader& header);
+};
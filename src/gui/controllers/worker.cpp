@@ -18,6 +18,7 @@
 
 #include "worker.h"
 #include "service/database.h"
+#include "utils/settings.h"
 #include <QImageReader>
 
 DatabaseWorker::DatabaseWorker(QObject* parent) : QObject(parent), database{DbMode::Query} { // search worker
@@ -45,43 +46,214 @@ void DatabaseWorker::searchPics(const SearchContext& searchCtx, size_t requestId
         displayType = DisplayItemType::Pic;
     }
 
+    // recent searches are answered from the result cache, which is dropped whenever a commit changed the database
+    // the generation is read first, so a search overlapping a commit is cached under the old generation
+    SearchCacheKey cacheKey = makeSearchCacheKey(searchCtx);
+    uint64_t generation = database.getGeneration();
+    bool databaseChanged = generation != searchCacheGeneration;
+    if (databaseChanged) {
+        searchCache.clear();
+        searchCacheIdCount = 0;
+        searchCacheGeneration = generation;
+    }
+    for (auto it = searchCache.begin(); it != searchCache.end(); ++it) {
+        if (!(it->key == cacheKey)) continue;
+        searchCache.splice(searchCache.begin(), searchCache, it); // most recently used first
+        const SearchCacheEntry& entry = searchCache.front();
+        if (!sendResults(entry.resultIds, requestId, nullptr)) return;
+        emit searchComplete(entry.availableTags, entry.availablePlatformTags, entry.resultIds.size(), requestId);
+        return;
+    }
+
     // skip search if criteria unchanged
     // the search feature includes three parts: tag search, platform tag search, text search
     // each part can be cached separately, no need to redo the part if criteria unchanged
-    if (includedTags != lastIncludedTags || excludedTags != lastExcludedTags) {
+    // tag searches use the in-memory index, sql search is the fallback if the index could not be built
+    // a cancelled search may have cached partial results, so everything is redone after one
+    std::shared_ptr<const TagIndex> tagIndex = database.getTagIndex();
+    bool indexChanged = tagIndex != lastTagIndex || lastSearchCancelled || databaseChanged;
+    lastTagIndex = tagIndex;
+    lastSearchCancelled = true; // until the search stages below complete
+    if (includedTags != lastIncludedTags || excludedTags != lastExcludedTags || indexChanged) {
         lastIncludedTags = includedTags;
         lastExcludedTags = excludedTags;
-        lastTagSearchResult = database.tagSearch(includedTags, excludedTags);
+        if (tagIndex) {
+            lastTagSearchBitmap = tagIndex->search(includedTags, excludedTags);
+        } else {
+            lastTagSearchResult = database.tagSearch(includedTags, excludedTags);
+        }
     }
-    if (includedPlatformTags != lastIncludedPlatformTags || excludedPlatformTags != lastExcludedPlatformTags) {
+    if (isCancelled(requestId)) return;
+    if (includedPlatformTags != lastIncludedPlatformTags || excludedPlatformTags != lastExcludedPlatformTags || indexChanged) {
         lastIncludedPlatformTags = includedPlatformTags;
         lastExcludedPlatformTags = excludedPlatformTags;
-        lastPlatformTagSearchResult = database.platformTagSearch(includedPlatformTags, excludedPlatformTags);
+        if (tagIndex) {
+            lastPlatformTagSearchBitmap = tagIndex->platformTagSearch(includedPlatformTags, excludedPlatformTags);
+        } else {
+            lastPlatformTagSearchResult = database.platformTagSearch(includedPlatformTags, excludedPlatformTags);
+        }
     }
-    if (platform != lastPlatformType || searchField != lastSearchField || searchText != lastSearchText) {
+    if (isCancelled(requestId)) return;
+    if (platform != lastPlatformType || searchField != lastSearchField || searchText != lastSearchText || indexChanged) {
         lastPlatformType = platform;
         lastSearchField = searchField;
         lastSearchText = searchText;
-        lastTextSearchResult = database.textSearch(searchText, platform, searchField);
+        lastTextSearchResult = database.rankedTextSearch(searchText, platform, searchField);
+        if (tagIndex) {
+            lastTextSearchOrdinals = tagIndex->toMetadataOrdinals(lastTextSearchResult);
+            lastTextSearchBitmap = RoaringBitmap::fromValues(lastTextSearchOrdinals);
+        }
     }
+    if (isCancelled(requestId)) return;
+    lastSearchCancelled = false;
 
     // intersect all search results
+    RoaringBitmap resultOrdinals; // picture ordinals, or metadata ordinals when displaying metadata
+    SearchResultIds resultIds =
+        tagIndex ? intersectIndexResults(*tagIndex, displayType, platformTagSearchApplied, textSearchApplied, resultOrdinals)
+                 : intersectSqlResults(displayType, platformTagSearchApplied, textSearchApplied);
+
+    // load and send the results, without the tag index available tags are gathered from the loaded items
+    FacetCounts facetCounts;
+    if (!sendResults(resultIds, requestId, tagIndex ? nullptr : &facetCounts)) return;
+
+    // count available tags, with the tag index every count is one bitmap intersection
+    std::vector<TagFacet> tagFacets;
+    std::vector<TagFacet> platformTagFacets;
+    if (tagIndex) {
+        size_t tagLimit = MAX_AVAILABLE_TAGS + includedTags.size(); // included tags are counted but not listed
+        size_t platformTagLimit = MAX_AVAILABLE_TAGS + includedPlatformTags.size();
+        if (displayType == DisplayItemType::Pic) {
+            tagFacets = tagIndex->tagFacets(resultOrdinals, tagLimit, Settings::approximateTagCounts);
+            platformTagFacets = tagIndex->platformTagFacets(tagIndex->picsToMetadata(resultOrdinals), platformTagLimit);
+        } else {
+            tagFacets = tagIndex->tagFacets(tagIndex->metadataToPics(resultOrdinals), tagLimit, Settings::approximateTagCounts);
+            platformTagFacets = tagIndex->platformTagFacets(resultOrdinals, platformTagLimit);
+        }
+    } else {
+        for (const auto& [tagId, count] : facetCounts.tagCount) {
+            tagFacets.push_back(TagFacet{tagId, static_cast<uint32_t>(count)});
+        }
+        for (const auto& [tagId, count] : facetCounts.platformTagCount) {
+            platformTagFacets.push_back(TagFacet{tagId, static_cast<uint32_t>(count)});
+        }
+    }
+
+    // prepare available tags
+    std::vector<TagCount> availableTags;
+    std::vector<PlatformTagCount> availablePlatformTags;
+    for (const auto& [tagId, count] : tagFacets) {
+        if (includedTags.find(tagId) != includedTags.end() || excludedTags.find(tagId) != excludedTags.end()) {
+            continue; // skip tags already in filter
+        }
+        TagCount tagCountEntry;
+        tagCountEntry.tag = database.getStringTag(tagId);
+        tagCountEntry.tagId = tagId;
+        tagCountEntry.count = count;
+        availableTags.push_back(tagCountEntry);
+    }
+    for (const auto& [tagId, count] : platformTagFacets) {
+        if (includedPlatformTags.find(tagId) != includedPlatformTags.end() ||
+            excludedPlatformTags.find(tagId) != excludedPlatformTags.end()) {
+            continue; // skip tags already in filter
+        }
+        PlatformTagCount tagCountEntry;
+        tagCountEntry.tag = database.getPlatformStringTag(tagId);
+        tagCountEntry.tagId = tagId;
+        tagCountEntry.count = count;
+        availablePlatformTags.push_back(tagCountEntry);
+    }
+    std::sort(availableTags.begin(), availableTags.end(), [](const TagCount& a, const TagCount& b) { return b.count < a.count; });
+    std::sort(availablePlatformTags.begin(),
+              availablePlatformTags.end(),
+              [](const PlatformTagCount& a, const PlatformTagCount& b) { return b.count < a.count; });
+
+    emit searchComplete(availableTags, availablePlatformTags, resultIds.size(), requestId);
+
+    // cache the complete result, least recently used entries are evicted past the entry or id limit
+    SearchCacheEntry entry{std::move(cacheKey), std::move(resultIds), std::move(availableTags), std::move(availablePlatformTags)};
+    size_t idCount = entry.idCount();
+    if (idCount > SEARCH_CACHE_MAX_IDS) return;
+    searchCache.push_front(std::move(entry));
+    searchCacheIdCount += idCount;
+    while (searchCache.size() > SEARCH_CACHE_CAPACITY || searchCacheIdCount > SEARCH_CACHE_MAX_IDS) {
+        searchCacheIdCount -= searchCache.back().idCount();
+        searchCache.pop_back();
+    }
+}
+void DatabaseWorker::findSimilarPics(uint64_t picId, size_t requestId) {
+    std::vector<SimilarPic> similarPics = database.findSimilarPics(picId, SIMILAR_PICS_COUNT);
+    std::vector<uint64_t> picIds;
+    picIds.reserve(similarPics.size() + 1);
+    picIds.push_back(picId); // queried picture first for reference
+    for (const auto& similarPic : similarPics) {
+        picIds.push_back(similarPic.picId);
+    }
     DisplayItems* displayItems = new DisplayItems();
+    fillPicItems(displayItems, picIds);
+    if (isCancelled(requestId)) {
+        delete displayItems;
+        return;
+    }
+    emit similarSearchComplete(displayItems, requestId);
+}
+void DatabaseWorker::cancelSearches(size_t latestRequestId) {
+    this->latestRequestId.store(latestRequestId);
+    database.interrupt(); // stops a long running query, the request id check discards what it returned
+}
+DatabaseWorker::SearchResultIds DatabaseWorker::intersectIndexResults(const TagIndex& tagIndex,
+                                                                      DisplayItemType displayType,
+                                                                      bool platformTagSearchApplied,
+                                                                      bool textSearchApplied,
+                                                                      RoaringBitmap& resultOrdinals) {
+    SearchResultIds resultIds;
+    resultIds.type = displayType;
     if (displayType == DisplayItemType::Metadata) {
-        std::vector<PlatformID> intersectedResult;
-        if (textSearchApplied && platformTagSearchApplied) {
-            const auto& small = lastTextSearchResult.size() < lastPlatformTagSearchResult.size() ? lastTextSearchResult
-                                                                                                 : lastPlatformTagSearchResult;
-            const auto& large = lastTextSearchResult.size() < lastPlatformTagSearchResult.size() ? lastPlatformTagSearchResult
-                                                                                                 : lastTextSearchResult;
-            for (const auto& id : small) {
-                if (large.find(id) != large.end()) {
-                    intersectedResult.push_back(id);
+        std::vector<uint32_t> intersectedResult;
+        if (textSearchApplied) { // keep text search ranking
+            for (uint32_t ordinal : lastTextSearchOrdinals) {
+                if (!platformTagSearchApplied || lastPlatformTagSearchBitmap.contains(ordinal)) {
+                    intersectedResult.push_back(ordinal);
                 }
             }
-        } else if (textSearchApplied) {
+        } else if (platformTagSearchApplied) {
+            intersectedResult = lastPlatformTagSearchBitmap.toVector();
+        }
+
+        resultIds.metadataIds.reserve(intersectedResult.size());
+        resultIds.metadataPicIds.reserve(intersectedResult.size());
+        for (uint32_t ordinal : intersectedResult) {
+            resultIds.metadataIds.push_back(tagIndex.getMetadataId(ordinal));
+            resultIds.metadataPicIds.push_back(tagIndex.getMetadataPicIds(ordinal));
+        }
+        resultOrdinals = RoaringBitmap::fromValues(std::move(intersectedResult));
+    } else if (displayType == DisplayItemType::Pic) { // tag search is always applied
+        // platform tag and text results are mapped to picture ordinals, so every intersection is a bitmap operation
+        RoaringBitmap intersectedResult = lastTagSearchBitmap;
+        if (platformTagSearchApplied && !intersectedResult.empty()) {
+            intersectedResult &= tagIndex.metadataToPics(lastPlatformTagSearchBitmap);
+        }
+        if (textSearchApplied && !intersectedResult.empty()) {
+            intersectedResult &= tagIndex.metadataToPics(lastTextSearchBitmap);
+        }
+
+        resultIds.picIds.reserve(intersectedResult.cardinality());
+        intersectedResult.forEach([&](uint32_t ordinal) { resultIds.picIds.push_back(tagIndex.getPicId(ordinal)); });
+        resultOrdinals = std::move(intersectedResult);
+    }
+    return resultIds;
+}
+DatabaseWorker::SearchResultIds
+DatabaseWorker::intersectSqlResults(DisplayItemType displayType, bool platformTagSearchApplied, bool textSearchApplied) {
+    SearchResultIds resultIds;
+    resultIds.type = displayType;
+    if (displayType == DisplayItemType::Metadata) {
+        std::vector<PlatformID> intersectedResult;
+        if (textSearchApplied) { // keep text search ranking
             for (const auto& id : lastTextSearchResult) {
-                intersectedResult.push_back(id);
+                if (!platformTagSearchApplied || lastPlatformTagSearchResult.find(id) != lastPlatformTagSearchResult.end()) {
+                    intersectedResult.push_back(id);
+                }
             }
         } else if (platformTagSearchApplied) {
             for (const auto& id : lastPlatformTagSearchResult) {
@@ -89,20 +261,11 @@ void DatabaseWorker::searchPics(const SearchContext& searchCtx, size_t requestId
             }
         }
 
-        displayItems->type = DisplayItemType::Metadata;
-        displayItems->metadataItems.reserve(intersectedResult.size());
-        displayItems->picItems.reserve(intersectedResult.size());
-        size_t metadataIdx = 0;
-        size_t picIdx = 0;
+        resultIds.metadataPicIds.reserve(intersectedResult.size());
         for (const auto& platformID : intersectedResult) {
-            auto picIds = database.getMetadataPicIds(platformID);
-            displayItems->metadataItems.emplace_back(MetadataItem{database.getMetadata(platformID), picIdx, picIds.size()});
-            for (const auto& picId : picIds) {
-                displayItems->picItems.emplace_back(PicItem{database.getPicInfo(picId), metadataIdx, 1});
-                picIdx++;
-            }
-            metadataIdx++;
+            resultIds.metadataPicIds.push_back(database.getMetadataPicIds(platformID));
         }
+        resultIds.metadataIds = std::move(intersectedResult);
     } else if (displayType == DisplayItemType::Pic) { // tag search is always applied
         std::vector<uint64_t> intersectedResult;
         std::unordered_set<uint64_t> platformTagSearchIntersectedResult;
@@ -168,28 +331,91 @@ void DatabaseWorker::searchPics(const SearchContext& searchCtx, size_t requestId
                 intersectedResult.push_back(id);
             }
         }
-        displayItems->type = DisplayItemType::Pic;
-        displayItems->picItems.reserve(intersectedResult.size());
-        displayItems->metadataItems.reserve(intersectedResult.size());
-        size_t picIdx = 0;
-        size_t metadataIdx = 0;
-        for (const auto& id : intersectedResult) {
-            PicInfo picInfo = database.getPicInfo(id);
-            displayItems->picItems.emplace_back(PicItem{picInfo, metadataIdx, picInfo.sourceIdentifiers.size()});
-            for (const auto& identifier : picInfo.sourceIdentifiers) {
-                displayItems->metadataItems.emplace_back(MetadataItem{database.getMetadata(identifier), picIdx, 1});
-                metadataIdx++;
-            }
+        resultIds.picIds = std::move(intersectedResult);
+    }
+    return resultIds;
+}
+bool DatabaseWorker::sendResults(const SearchResultIds& resultIds, size_t requestId, FacetCounts* facetCounts) {
+    // results are sent in growing chunks so the first screen shows up before the whole result is loaded
+    size_t chunkSize = FIRST_RESULT_CHUNK_SIZE;
+    size_t begin = 0;
+    do {
+        size_t end = std::min(begin + chunkSize, resultIds.size());
+        DisplayItems* displayItems = fillResultChunk(resultIds, begin, end);
+        if (facetCounts) facetCounts->add(*displayItems);
+        if (isCancelled(requestId)) { // the chunk may also be incomplete if its queries were interrupted
+            delete displayItems;
+            return false;
+        }
+        emit searchResultsChunk(displayItems, begin == 0, requestId);
+        begin = end;
+        chunkSize = std::min(chunkSize * 2, MAX_RESULT_CHUNK_SIZE);
+    } while (begin < resultIds.size());
+    return true;
+}
+DisplayItems* DatabaseWorker::fillResultChunk(const SearchResultIds& resultIds, size_t begin, size_t end) {
+    DisplayItems* displayItems = new DisplayItems();
+    if (resultIds.type == DisplayItemType::Metadata) {
+        std::vector<PlatformID> metadataIds(resultIds.metadataIds.begin() + begin, resultIds.metadataIds.begin() + end);
+        std::vector<std::vector<uint64_t>> metadataPicIds(resultIds.metadataPicIds.begin() + begin,
+                                                          resultIds.metadataPicIds.begin() + end);
+        fillMetadataItems(displayItems, metadataIds, metadataPicIds);
+    } else {
+        std::vector<uint64_t> picIds(resultIds.picIds.begin() + begin, resultIds.picIds.begin() + end);
+        fillPicItems(displayItems, picIds);
+    }
+    return displayItems;
+}
+void DatabaseWorker::fillMetadataItems(DisplayItems* displayItems,
+                                       const std::vector<PlatformID>& metadataIds,
+                                       const std::vector<std::vector<uint64_t>>& metadataPicIds) {
+    std::vector<uint64_t> picIds;
+    for (const auto& ids : metadataPicIds) {
+        picIds.insert(picIds.end(), ids.begin(), ids.end());
+    }
+    std::vector<Metadata> metadatas = database.getMetadatas(metadataIds);
+    std::vector<PicInfo> picInfos = database.getPicInfos(picIds);
+
+    displayItems->type = DisplayItemType::Metadata;
+    displayItems->metadataItems.reserve(metadatas.size());
+    displayItems->picItems.reserve(picInfos.size());
+    size_t picIdx = 0;
+    for (size_t metadataIdx = 0; metadataIdx < metadatas.size(); metadataIdx++) {
+        size_t picCount = metadataPicIds[metadataIdx].size();
+        if (picIdx + picCount > picInfos.size()) break; // query interrupted by a newer search
+        displayItems->metadataItems.emplace_back(MetadataItem{std::move(metadatas[metadataIdx]), picIdx, picCount});
+        for (size_t i = 0; i < picCount; i++) {
+            displayItems->picItems.emplace_back(PicItem{std::move(picInfos[picIdx]), metadataIdx, 1});
             picIdx++;
         }
     }
+}
+void DatabaseWorker::fillPicItems(DisplayItems* displayItems, const std::vector<uint64_t>& picIds) {
+    std::vector<PicInfo> picInfos = database.getPicInfos(picIds);
+    std::vector<PlatformID> sourceIds;
+    for (const auto& picInfo : picInfos) {
+        for (const auto& identifier : picInfo.sourceIdentifiers) {
+            sourceIds.push_back(PlatformID{identifier.platform, identifier.platformID});
+        }
+    }
+    std::vector<Metadata> metadatas = database.getMetadatas(sourceIds);
 
-    // gather available tags from resultItems
-    std::unordered_map<uint32_t, int> tagCount;
-    std::unordered_map<uint32_t, int> platformTagCount;
-    std::unordered_set<PlatformID> countedMetadata; // to avoid double counting metadata tags
-    std::unordered_set<uint64_t> countedPics;       // to avoid double counting pic tags
-    for (const auto& item : displayItems->picItems) {
+    displayItems->type = DisplayItemType::Pic;
+    displayItems->picItems.reserve(picInfos.size());
+    displayItems->metadataItems.reserve(metadatas.size());
+    size_t metadataIdx = 0;
+    for (size_t picIdx = 0; picIdx < picInfos.size(); picIdx++) {
+        size_t sourceCount = picInfos[picIdx].sourceIdentifiers.size();
+        if (metadataIdx + sourceCount > metadatas.size()) break; // query interrupted by a newer search
+        displayItems->picItems.emplace_back(PicItem{std::move(picInfos[picIdx]), metadataIdx, sourceCount});
+        for (size_t i = 0; i < sourceCount; i++) {
+            displayItems->metadataItems.emplace_back(MetadataItem{std::move(metadatas[metadataIdx]), picIdx, 1});
+            metadataIdx++;
+        }
+    }
+}
+void DatabaseWorker::FacetCounts::add(const DisplayItems& displayItems) {
+    for (const auto& item : displayItems.picItems) {
         const auto& pic = item.info;
         if (countedPics.find(pic.id) != countedPics.end()) continue;
         countedPics.insert(pic.id);
@@ -197,7 +423,7 @@ void DatabaseWorker::searchPics(const SearchContext& searchCtx, size_t requestId
             tagCount[picTag.tagId]++;
         }
     }
-    for (const auto& metadataItem : displayItems->metadataItems) {
+    for (const auto& metadataItem : displayItems.metadataItems) {
         const auto& metadata = metadataItem.metadata;
         if (countedMetadata.find(metadata.getPlatformID()) != countedMetadata.end()) continue;
         countedMetadata.insert(metadata.getPlatformID());
@@ -205,35 +431,22 @@ void DatabaseWorker::searchPics(const SearchContext& searchCtx, size_t requestId
             platformTagCount[tagId]++;
         }
     }
-
-    // prepare available tags
-    std::vector<TagCount> availableTags;
-    std::vector<PlatformTagCount> availablePlatformTags;
-    for (const auto& [tagId, count] : tagCount) {
-        if (includedTags.find(tagId) != includedTags.end() || excludedTags.find(tagId) != excludedTags.end()) {
-            continue; // skip tags already in filter
-        }
-        TagCount tagCountEntry;
-        tagCountEntry.tag = database.getStringTag(tagId);
-        tagCountEntry.tagId = tagId;
-        tagCountEntry.count = count;
-        availableTags.push_back(tagCountEntry);
-    }
-    for (const auto& [tagId, count] : platformTagCount) {
-        if (includedPlatformTags.find(tagId) != includedPlatformTags.end() ||
-            excludedPlatformTags.find(tagId) != excludedPlatformTags.end()) {
-            continue; // skip tags already in filter
-        }
-        PlatformTagCount tagCountEntry;
-        tagCountEntry.tag = database.getPlatformStringTag(tagId);
-        tagCountEntry.tagId = tagId;
-        tagCountEntry.count = count;
-        availablePlatformTags.push_back(tagCountEntry);
+}
+DatabaseWorker::SearchCacheKey DatabaseWorker::makeSearchCacheKey(const SearchContext& searchCtx) {
+    auto sorted = [](const std::unordered_set<uint32_t>& tagIds) {
+        std::vector<uint32_t> result(tagIds.begin(), tagIds.end());
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    SearchCacheKey key;
+    key.includedTags = sorted(searchCtx.includedTags);
+    key.excludedTags = sorted(searchCtx.excludedTags);
+    key.includedPlatformTags = sorted(searchCtx.includedPlatformTags);
+    key.excludedPlatformTags = sorted(searchCtx.excludedPlatformTags);
+    if (!searchCtx.searchText.empty() && searchCtx.searchField != SearchField::None) { // platform only affects text search
+        key.searchPlatform = searchCtx.searchPlatform;
+        key.searchField = searchCtx.searchField;
+        key.searchText = searchCtx.searchText;
     }
-    std::sort(availableTags.begin(), availableTags.end(), [](const TagCount& a, const TagCount& b) { return b.count < a.count; });
-    std::sort(availablePlatformTags.begin(),
-              availablePlatformTags.end(),
-              [](const PlatformTagCount& a, const PlatformTagCount& b) { return b.count < a.count; });
-
-    emit searchComplete(displayItems, availableTags, availablePlatformTags, requestId);
+    return key;
 }
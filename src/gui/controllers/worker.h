@@ -22,7 +22,16 @@
 #include "service/database.h"
 #include <QObject>
 #include <QPixmap>
+#include <atomic>
 #include <filesystem>
+#include <list>
+
+constexpr size_t SIMILAR_PICS_COUNT = 200;      // nearest pictures shown by a similar picture search
+constexpr size_t FIRST_RESULT_CHUNK_SIZE = 256; // enough for the first screen, later chunks double in size
+constexpr size_t MAX_RESULT_CHUNK_SIZE = 1 << 15;
+constexpr size_t SEARCH_CACHE_CAPACITY = 16;     // recent searches kept with their results and available tags
+constexpr size_t SEARCH_CACHE_MAX_IDS = 1 << 22; // ids held by all cached results, about 32 MB
+constexpr size_t MAX_AVAILABLE_TAGS = 5000;      // most frequent tags of a result listed in each tag panel
 
 class DatabaseWorker : public QObject { // database search worker in another thread
     Q_OBJECT
@@ -31,15 +40,81 @@ public:
     ~DatabaseWorker();
 
     void searchPics(const SearchContext& searchCtx, size_t requestId);
+    void findSimilarPics(uint64_t picId, size_t requestId);
+    void cancelSearches(size_t latestRequestId); // called from the ui thread before sending a newer request
 
 signals:
-    void searchComplete(DisplayItems* displayItems,
-                        const std::vector<TagCount> availableTags,
+    // results are streamed in chunks in result order, the receiver owns displayItems
+    void searchResultsChunk(DisplayItems* displayItems, bool firstChunk, size_t requestId);
+    void searchComplete(const std::vector<TagCount> availableTags, // sent after the last chunk
                         const std::vector<PlatformTagCount> availablePlatformTags,
+                        size_t resultCount,
                         size_t requestId);
+    void similarSearchComplete(DisplayItems* displayItems, size_t requestId);
 
 private:
     PicDatabase database;
+    std::atomic<size_t> latestRequestId{0};
+    bool isCancelled(size_t requestId) const { return requestId < latestRequestId.load(); }
+
+    struct SearchResultIds {
+        DisplayItemType type = DisplayItemType::Pic;
+        std::vector<uint64_t> picIds;                      // pictures to display
+        std::vector<PlatformID> metadataIds;               // or posts to display
+        std::vector<std::vector<uint64_t>> metadataPicIds; // and the pictures of each post
+        size_t size() const { return type == DisplayItemType::Pic ? picIds.size() : metadataIds.size(); }
+    };
+    struct FacetCounts { // available tags of the loaded results, used when there is no tag index
+        std::unordered_map<uint32_t, int> tagCount;
+        std::unordered_map<uint32_t, int> platformTagCount;
+        std::unordered_set<PlatformID> countedMetadata; // to avoid double counting metadata tags
+        std::unordered_set<uint64_t> countedPics;       // to avoid double counting pic tags
+        void add(const DisplayItems& displayItems);
+    };
+    struct SearchCacheKey { // search context with sorted tags, text search fields are empty when it is not applied
+        std::vector<uint32_t> includedTags;
+        std::vector<uint32_t> excludedTags;
+        std::vector<uint32_t> includedPlatformTags;
+        std::vector<uint32_t> excludedPlatformTags;
+        PlatformType searchPlatform = PlatformType::Unknown;
+        SearchField searchField = SearchField::None;
+        std::string searchText;
+        bool operator==(const SearchCacheKey& other) const {
+            return includedTags == other.includedTags && excludedTags == other.excludedTags &&
+                   includedPlatformTags == other.includedPlatformTags && excludedPlatformTags == other.excludedPlatformTags &&
+                   searchPlatform == other.searchPlatform && searchField == other.searchField && searchText == other.searchText;
+        }
+    };
+    struct SearchCacheEntry {
+        SearchCacheKey key;
+        SearchResultIds resultIds;
+        std::vector<TagCount> availableTags;
+        std::vector<PlatformTagCount> availablePlatformTags;
+        size_t idCount() const {
+            size_t count = resultIds.picIds.size() + resultIds.metadataIds.size();
+            for (const auto& picIds : resultIds.metadataPicIds) {
+                count += picIds.size();
+            }
+            return count;
+        }
+    };
+    std::list<SearchCacheEntry> searchCache; // most recently used first
+    size_t searchCacheIdCount = 0;
+    uint64_t searchCacheGeneration = 0; // database generation the cached results were computed at
+    static SearchCacheKey makeSearchCacheKey(const SearchContext& searchCtx);
+
+    bool sendResults(const SearchResultIds& resultIds, size_t requestId, FacetCounts* facetCounts); // false if cancelled
+    SearchResultIds intersectIndexResults(const TagIndex& tagIndex,
+                                          DisplayItemType displayType,
+                                          bool platformTagSearchApplied,
+                                          bool textSearchApplied,
+                                          RoaringBitmap& resultOrdinals);
+    SearchResultIds intersectSqlResults(DisplayItemType displayType, bool platformTagSearchApplied, bool textSearchApplied);
+    DisplayItems* fillResultChunk(const SearchResultIds& resultIds, size_t begin, size_t end);
+    void fillMetadataItems(DisplayItems* displayItems, // batch load posts and their pictures
+                           const std::vector<PlatformID>& metadataIds,
+                           const std::vector<std::vector<uint64_t>>& metadataPicIds);
+    void fillPicItems(DisplayItems* displayItems, const std::vector<uint64_t>& picIds); // batch load pictures and their posts
 
     std::unordered_set<uint32_t> lastIncludedTags;
     std::unordered_set<uint32_t> lastExcludedTags;
@@ -49,7 +124,14 @@ private:
     SearchField lastSearchField = SearchField::None;
     std::string lastSearchText;
 
+    std::shared_ptr<const TagIndex> lastTagIndex; // index the cached bitmaps refer to, ordinals change on rebuild
+    bool lastSearchCancelled = false;             // the cached results below may be partial
+
     std::unordered_set<uint64_t> lastTagSearchResult;
     std::unordered_set<PlatformID> lastPlatformTagSearchResult;
-    std::unordered_set<PlatformID> lastTextSearchResult;
+    std::vector<PlatformID> lastTextSearchResult; // best match first
+    RoaringBitmap lastTagSearchBitmap;            // picture ordinals
+    RoaringBitmap lastPlatformTagSearchBitmap;    // metadata ordinals
+    RoaringBitmap lastTextSearchBitmap;           // metadata ordinals
+    std::vector<uint32_t> lastTextSearchOrdinals; // metadata ordinals, best match first
 };
@@ -32,9 +32,10 @@ const QEvent::Type TaggingProgressReportEvent::EventType = static_cast<QEvent::T
 
 MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), ui(new Ui::MainWindow), displayController(ui, &imageLoader) {
     ui->setupUi(this);
-    displayController.setup();
+    displayController.setup([this](uint64_t picId) { similarPicSearch(picId); });
 
     Settings::loadSettings();
+    imageLoader.setCacheBudget(static_cast<size_t>(Settings::imageCacheSizeMB) << 20); // members are built before this
     resize(Settings::windowWidth, Settings::windowHeight);
     if (Settings::autoImportOnStartup) handleImportExistingDirectoriesAction();
 
@@ -45,6 +46,7 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), ui(new Ui::MainWi
     displayTags();
 
     initTagger();
+    updateWatchedDirectories();
 }
 MainWindow::~MainWindow() {
     delete ui;
@@ -72,6 +74,7 @@ void MainWindow::fillComboBox() {
     ui->searchComboBox->addItem("作者名");
     ui->searchComboBox->addItem("作者别名");
     ui->searchComboBox->addItem("标题");
+    ui->searchComboBox->addItem("描述");
     ui->searchComboBox->setCurrentIndex(0);
 
     ui->sortComboBox->addItem("无");
@@ -90,10 +93,13 @@ void MainWindow::fillComboBox() {
 }
 void MainWindow::initWorkerThreads() {
     searchWorkerThread = new QThread(this);
-    DatabaseWorker* searchWorker = new DatabaseWorker();
+    searchWorker = new DatabaseWorker();
     searchWorker->moveToThread(searchWorkerThread);
     connect(this, &MainWindow::searchPics, searchWorker, &DatabaseWorker::searchPics);
+    connect(searchWorker, &DatabaseWorker::searchResultsChunk, this, &MainWindow::handleSearchChunk);
     connect(searchWorker, &DatabaseWorker::searchComplete, this, &MainWindow::handleSearchResults);
+    connect(this, &MainWindow::findSimilarPics, searchWorker, &DatabaseWorker::findSimilarPics);
+    connect(searchWorker, &DatabaseWorker::similarSearchComplete, this, &MainWindow::handleSimilarSearchResults);
     connect(searchWorkerThread, &QThread::finished, searchWorker, &QObject::deleteLater);
     searchWorkerThread->start();
 }
@@ -180,6 +186,8 @@ void MainWindow::connectSignalSlots() {
             &MainWindow::handleImportPowerfulPixivDownloaderAction);
     connect(ui->importGallery_dlTwitterAction, &QAction::triggered, this, &MainWindow::handleImportGallery_dlTwitterAction);
     connect(ui->importExistingDirectoriesAction, &QAction::triggered, this, &MainWindow::handleImportExistingDirectoriesAction);
+    connect(ui->recountTagsAction, &QAction::triggered, this, &MainWindow::handleRecountTagsAction);
+    connect(&directoryWatcher, &DirectoryWatcher::changesReady, this, &MainWindow::handleWatchedChanges);
     connect(ui->showAboutAction, &QAction::triggered, this, &MainWindow::handleShowAboutAction);
     connect(ui->showSettingsAction, &QAction::triggered, this, &MainWindow::handleShowSettingsAction);
     connect(ui->startTaggingAction, &QAction::triggered, this, &MainWindow::handleStartTaggingAction);
@@ -593,26 +601,52 @@ void MainWindow::tagSearch(const QString& text) {
 // Main search function
 void MainWindow::picSearch() {
     imageLoader.clearTasks();
+    searchRequestId++;
+    searchWorker->cancelSearches(searchRequestId); // the running search is superseded either way
     if (isSearchCriteriaEmpty()) {
         displayTags();
         return;
     }
     ui->statusbar->showMessage("正在搜索...");
-    searchRequestId++;
     emit searchPics(searchCtx, searchRequestId);
 }
-void MainWindow::handleSearchResults(DisplayItems* displayItems,
-                                     const std::vector<TagCount>& availableTags,
+void MainWindow::handleSearchChunk(DisplayItems* displayItems, bool firstChunk, size_t requestId) {
+    if (requestId != searchRequestId) {
+        delete displayItems;
+        return;
+    }
+    if (firstChunk) {
+        displayController.setDisplayItems(displayItems, searchCtx.searchField);
+        displayController.sortDisplayItems(sortCtx);
+    } else {
+        displayController.appendDisplayItems(displayItems);
+    }
+}
+void MainWindow::handleSearchResults(const std::vector<TagCount>& availableTags,
                                      const std::vector<PlatformTagCount>& availablePlatformTags,
+                                     size_t resultCount,
                                      size_t requestId) {
     if (requestId != searchRequestId) return;
-    displayController.setDisplayItems(displayItems, searchCtx.searchField);
-    displayController.sortDisplayItems(sortCtx);
+    displayController.finishDisplayItems(); // sent after the last chunk
     displayTags(availableTags, availablePlatformTags);
-    ui->statusbar->showMessage("搜索完成，共找到 " +
-                               QString::number(displayItems->type == DisplayItemType::Pic ? displayItems->picItems.size()
-                                                                                          : displayItems->metadataItems.size()) +
-                               " 个结果");
+    ui->statusbar->showMessage("搜索完成，共找到 " + QString::number(resultCount) + " 个结果");
+}
+void MainWindow::similarPicSearch(uint64_t picId) {
+    imageLoader.clearTasks();
+    ui->statusbar->showMessage("正在查找相似图片...");
+    searchRequestId++;
+    searchWorker->cancelSearches(searchRequestId);
+    emit findSimilarPics(picId, searchRequestId);
+}
+void MainWindow::handleSimilarSearchResults(DisplayItems* displayItems, size_t requestId) {
+    if (requestId != searchRequestId) {
+        delete displayItems;
+        return;
+    }
+    displayController.setDisplayItems(displayItems, SearchField::None);
+    displayController.sortDisplayItems(sortCtx);
+    displayTags();
+    ui->statusbar->showMessage("查找完成，共找到 " + QString::number(displayItems->picItems.size() - 1) + " 张相似图片");
 }
 
 // Functions for window resizing and layout
@@ -651,6 +685,10 @@ bool MainWindow::event(QEvent* event) {
 }
 
 void MainWindow::displayImportProgress(size_t progress, size_t total) {
+    if (watchImportRunning) { // background import, no progress is shown
+        if (progress >= total) finalizeWatchImport(total);
+        return;
+    }
     if (progress >= total) { // import complete
         finalizeImport(total);
         return;
@@ -682,16 +720,20 @@ void MainWindow::finalizeImport(size_t totalImported) {
         if (std::find(Settings::picDirectories.begin(), Settings::picDirectories.end(), std::pair{importedPath, parserType}) ==
             Settings::picDirectories.end()) {
             Settings::picDirectories.emplace_back(importedPath, parserType);
+            updateWatchedDirectories();
         }
+        imageLoader.generateThumbnails(importer.getImportedPictures()); // pre-build thumbnails of the new pictures
         importer.finish();
     } else { // re-importing from multiple directories
         dirsToImport.pop_back();
+        vanishedFileCount += importer.getVanishedFiles().size();
+        imageLoader.generateThumbnails(importer.getImportedPictures());
         importer.finish();
         if (!dirsToImport.empty()) {
             ui->progressBar->setValue(0);
             taskStartTime = std::chrono::steady_clock::now();
             ui->progressStatusLabel->setText(QString("- / - | 速度：- 文件每秒 | 剩余时间：- 秒"));
-            importer.startImportFromDirectory(dirsToImport.back().first, dirsToImport.back().second);
+            importer.startImportFromDirectory(dirsToImport.back().first, dirsToImport.back().second, true);
             Info() << "Re-importing pictures from directory: " << dirsToImport.back().first.string();
             return;
         }
@@ -701,11 +743,16 @@ void MainWindow::finalizeImport(size_t totalImported) {
     ui->progressWidget->hide();
     ui->progressLabel->setText("");
     ui->progressStatusLabel->setText("");
-    ui->statusbar->showMessage(
+    QString message =
         "图片导入完成，共扫描 " + QString::number(totalImported) + " 文件，用时 " +
         QString::number(
             std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - taskStartTime).count()) +
-        " 秒");
+        " 秒";
+    if (vanishedFileCount > 0) {
+        message += "，" + QString::number(vanishedFileCount) + " 个已导入文件不存在";
+        vanishedFileCount = 0;
+    }
+    ui->statusbar->showMessage(message);
 
     loadTags(); // load new tags from database
     if (isSearchCriteriaEmpty()) {
@@ -777,6 +824,7 @@ void MainWindow::cancelTask() {
 
         importer.forceStop();
         dirsToImport.clear();
+        watchImportRunning = false;
 
         ui->statusbar->showMessage("导入任务已取消。");
         Info() << "Import task cancelled.";
@@ -850,13 +898,66 @@ void MainWindow::handleImportExistingDirectoriesAction() {
         Info() << "No existing directories to re-import.";
         return;
     }
-    importer.startImportFromDirectory(dirsToImport.back().first, dirsToImport.back().second);
+    vanishedFileCount = 0;
+    importer.startImportFromDirectory(dirsToImport.back().first, dirsToImport.back().second, true); // incremental rescan
     Info() << "Re-importing pictures from directory: " << dirsToImport.back().first.string();
     ui->progressWidget->show();
     ui->progressBar->setValue(0);
     ui->progressLabel->setText("正在重新扫描已导入文件夹...");
     taskStartTime = std::chrono::steady_clock::now();
 }
+void MainWindow::handleRecountTagsAction() {
+    if (haveOngoingTask()) { // an import or tagging task is changing the counts
+        ui->statusbar->showMessage("已有任务正在进行中，请稍后再试。");
+        return;
+    }
+    database.beginTransaction();
+    database.rebuildTagCounts();
+    database.rebuildPlatformTagCounts();
+    if (!database.commitTransaction()) {
+        database.rollbackTransaction();
+        ui->statusbar->showMessage("重新统计标签数量失败。");
+        Error() << "Failed to recount tags.";
+        return;
+    }
+    loadTags();
+    if (isSearchCriteriaEmpty()) {
+        picSearch();
+    }
+    ui->statusbar->showMessage("标签数量已重新统计。");
+    Info() << "Recounted tags.";
+}
+void MainWindow::updateWatchedDirectories() {
+    directoryWatcher.setRoots(Settings::watchPicDirectories ? Settings::picDirectories
+                                                            : std::vector<std::pair<std::filesystem::path, ParserType>>{});
+}
+void MainWindow::handleWatchedChanges() {
+    if (haveOngoingTask()) { // changes keep accumulating until the running task is done
+        directoryWatcher.postpone();
+        return;
+    }
+    WatchedChanges changes = directoryWatcher.takeChanges();
+    if (changes.directories.empty()) return;
+    watchImportRunning = true;
+    importer.startImportFromDirectories(changes.directories, changes.parserType);
+    Info() << "Importing changes of watched directories:" << changes.directories.size();
+}
+void MainWindow::finalizeWatchImport(size_t totalImported) {
+    imageLoader.generateThumbnails(importer.getImportedPictures());
+    importer.finish();
+    watchImportRunning = false;
+    if (directoryWatcher.hasChanges()) directoryWatcher.postpone(); // changes of another parser type or during the import
+    if (totalImported == 0) return;
+
+    ui->statusbar->showMessage("已自动导入 " + QString::number(totalImported) + " 个新增或修改的文件");
+    loadTags();
+    if (isSearchCriteriaEmpty()) {
+        picSearch();
+    }
+    Info() << "Imported files of watched directories:" << totalImported;
+
+    if (Settings::autoTagAfterImport) handleStartTaggingAction();
+}
 void MainWindow::handleShowAboutAction() {
     if (!aboutDialog) {
         aboutDialog = new AboutDialog(this);
@@ -872,6 +973,7 @@ void MainWindow::handleShowSettingsAction() {
         settingsDialog = new SettingsDialog(this);
         settingsDialog->setAttribute(Qt::WA_DeleteOnClose);
         connect(settingsDialog, &QObject::destroyed, this, [this]() { settingsDialog = nullptr; });
+        connect(settingsDialog, &QDialog::accepted, this, &MainWindow::updateWatchedDirectories);
     }
     settingsDialog->show();
     settingsDialog->raise();
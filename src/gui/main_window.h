@@ -19,6 +19,7 @@
 #pragma once
 #include "about_dialog.h"
 #include "controllers/context_controller.h"
+#include "controllers/directory_watcher.h"
 #include "controllers/display_controller.h"
 #include "controllers/image_loader.h"
 #include "controllers/worker.h"
@@ -77,6 +78,7 @@ public:
 
 signals:
     void searchPics(const SearchContext& ctx, size_t requestId);
+    void findSimilarPics(uint64_t picId, size_t requestId);
 
 protected:
     bool firstShow_ = true;
@@ -89,6 +91,7 @@ private:
     Ui::MainWindow* ui;
     PicDatabase database;
     QThread* searchWorkerThread = nullptr;
+    DatabaseWorker* searchWorker = nullptr; // lives in searchWorkerThread, only cancelSearches is called directly
     ImageLoader imageLoader{this};           // Blazing fast!!!
     Importer importer{reportImportProgress}; // Blazing fast!!!
     Tagger tagger{reportTaggingProgress};
@@ -171,12 +174,21 @@ private:
     // Action handlers
     std::chrono::steady_clock::time_point taskStartTime;
     std::vector<std::pair<std::filesystem::path, ParserType>> dirsToImport; // paths to import with specified parser types
+    size_t vanishedFileCount = 0;                                          // imported files the current rescan did not find
     void handleImportNewPicsAction();
     void handleImportPowerfulPixivDownloaderAction(); // specify parser type pixiv
     void handleImportGallery_dlTwitterAction();       // specify parser type twitter
     void handleImportExistingDirectoriesAction();
+    void handleRecountTagsAction(); // repairs tag counts that drifted from picture_tags
     void handleStartTaggingAction();
 
+    // watch mode, new files in picDirectories are imported in the background
+    DirectoryWatcher directoryWatcher;
+    bool watchImportRunning = false;
+    void updateWatchedDirectories();
+    void handleWatchedChanges();
+    void finalizeWatchImport(size_t totalImported);
+
     AboutDialog* aboutDialog = nullptr;
     void handleShowAboutAction();
     SettingsDialog* settingsDialog = nullptr;
@@ -194,10 +206,13 @@ private:
     // searching
     size_t searchRequestId = 0; // to identify latest search request
     void picSearch();
-    void handleSearchResults(DisplayItems* displayItems,
-                             const std::vector<TagCount>& availableTags,
+    void handleSearchChunk(DisplayItems* displayItems, bool firstChunk, size_t requestId);
+    void handleSearchResults(const std::vector<TagCount>& availableTags,
                              const std::vector<PlatformTagCount>& availablePlatformTags,
+                             size_t resultCount,
                              size_t requestId);
+    void similarPicSearch(uint64_t picId); // requested from a PictureFrame context menu
+    void handleSimilarSearchResults(DisplayItems* displayItems, size_t requestId);
     void displayTags(const std::vector<TagCount>& tags = {}, const std::vector<PlatformTagCount>& platformTags = {});
     bool isSearchCriteriaEmpty() const { return searchCtx.searchText.empty() && isSelectedTagsEmpty(); };
 
@@ -67,6 +67,8 @@ void SettingsDialog::setupTableWidget() const {
 void SettingsDialog::loadSettings() {
     importOnStartup = Settings::autoImportOnStartup;
     ui->importOnStartCheckBox->setChecked(importOnStartup);
+    watchPicDirectories = Settings::watchPicDirectories;
+    ui->watchPicDirsCheckBox->setChecked(watchPicDirectories);
 
     autoTagAfterImport = Settings::autoTagAfterImport;
     ui->autoTagAfterImportCheckBox->setChecked(autoTagAfterImport);
@@ -84,6 +86,8 @@ void SettingsDialog::loadSettings() {
 void SettingsDialog::saveSettings() {
     importOnStartup = ui->importOnStartCheckBox->isChecked();
     Settings::autoImportOnStartup = importOnStartup;
+    watchPicDirectories = ui->watchPicDirsCheckBox->isChecked();
+    Settings::watchPicDirectories = watchPicDirectories;
 
     picDirectories.clear();
     for (int i = 0; i < ui->picDirsTable->rowCount(); ++i) {
@@ -41,6 +41,7 @@ public:
 private:
     Ui::SettingsDialog* ui;
     bool importOnStartup;
+    bool watchPicDirectories;
     std::vector<std::pair<std::filesystem::path, ParserType>> picDirectories;
     bool autoTagAfterImport;
     std::filesystem::path autoTaggerDLLPath;
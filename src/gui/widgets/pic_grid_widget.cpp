@@ -0,0 +1,150 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pic_grid_widget.h"
+#include <QFontMetrics>
+#include <QMouseEvent>
+#include <QPaintEvent>
+#include <QStyle>
+#include <QStyleOptionFrame>
+
+PicGridWidget::PicGridWidget(QWidget* parent) : QWidget(parent) {
+    setMouseTracking(true);
+    setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
+    boldFont = font();
+    boldFont.setBold(true);
+}
+
+// cells
+
+void PicGridWidget::setCell(int index, const QRect& rect, const FrameTexts& texts) {
+    int textWidth = rect.width() - 2 * CELL_PADDING;
+    Cell& cell = cells[index];
+    if (cell.rect.isValid()) update(cell.rect);
+    cell.rect = rect;
+    cell.thumbnail = nullptr;
+    cell.title = makeText(texts.title, texts.titleHighlighted, textWidth);
+    cell.illustrator = makeText(texts.illustrator, texts.illustratorHighlighted, textWidth / 2);
+    cell.id = makeText(texts.id, texts.idHighlighted, textWidth / 2);
+    cell.resolution = makeText(texts.resolution, false, textWidth / 2);
+    cell.fileTypeAndSize = makeText(texts.fileTypeAndSize, false, textWidth / 2);
+    cell.titleHighlighted = texts.titleHighlighted;
+    cell.illustratorHighlighted = texts.illustratorHighlighted;
+    cell.idHighlighted = texts.idHighlighted;
+    update(rect);
+}
+void PicGridWidget::moveCell(int index, const QPoint& pos) {
+    auto it = cells.find(index);
+    if (it == cells.end() || it->second.rect.topLeft() == pos) return;
+    update(it->second.rect);
+    it->second.rect.moveTopLeft(pos);
+    update(it->second.rect);
+}
+void PicGridWidget::setThumbnail(int index, std::shared_ptr<QImage> thumbnail) {
+    auto it = cells.find(index);
+    if (it == cells.end()) return;
+    it->second.thumbnail = std::move(thumbnail);
+    update(it->second.rect);
+}
+void PicGridWidget::removeCell(int index) {
+    auto it = cells.find(index);
+    if (it == cells.end()) return;
+    update(it->second.rect);
+    cells.erase(it);
+}
+void PicGridWidget::clearCells() {
+    cells.clear();
+    update();
+}
+int PicGridWidget::cellAt(const QPoint& pos) const {
+    for (const auto& [index, cell] : cells) { // at most a few hundred cells, only called on mouse events
+        if (cell.rect.contains(pos)) return index;
+    }
+    return -1;
+}
+QStaticText PicGridWidget::makeText(const QString& text, bool bold, int width) const {
+    QFontMetrics metrics(bold ? boldFont : font());
+    QStaticText staticText(metrics.elidedText(text, Qt::ElideRight, width));
+    staticText.setTextFormat(Qt::PlainText);
+    staticText.prepare(QTransform(), bold ? boldFont : font());
+    return staticText;
+}
+
+// painting
+
+void PicGridWidget::paintEvent(QPaintEvent* event) {
+    QPainter painter(this);
+    for (const auto& [index, cell] : cells) {
+        if (cell.rect.intersects(event->rect())) paintCell(painter, cell);
+    }
+}
+void PicGridWidget::paintCell(QPainter& painter, const Cell& cell) const {
+    QStyleOptionFrame frameOption; // same box border as the QFrame in picture_frame.ui
+    frameOption.initFrom(this);
+    frameOption.rect = cell.rect;
+    frameOption.frameShape = QFrame::Box;
+    frameOption.lineWidth = 1;
+    frameOption.midLineWidth = 0;
+    style()->drawControl(QStyle::CE_ShapedFrame, &frameOption, &painter, this);
+
+    QRect imageRect(cell.rect.left() + CELL_PADDING,
+                    cell.rect.top() + CELL_PADDING,
+                    cell.rect.width() - 2 * CELL_PADDING,
+                    CELL_IMAGE_HEIGHT);
+    if (cell.thumbnail && !cell.thumbnail->isNull()) { // centered and cropped like a QLabel pixmap, never scaled here
+        QRect target(QPoint(0, 0), cell.thumbnail->size());
+        target.moveCenter(imageRect.center());
+        QRect visible = target.intersected(imageRect);
+        painter.drawImage(visible.topLeft(), *cell.thumbnail, visible.translated(-target.topLeft()));
+    }
+
+    int left = cell.rect.left() + CELL_PADDING;
+    int right = cell.rect.right() - CELL_PADDING;
+    int top = cell.rect.bottom() - CELL_PADDING - CELL_INFO_HEIGHT;
+    int titleTop = top + (CELL_TITLE_HEIGHT - painter.fontMetrics().height()) / 2;
+    int firstRowTop = top + CELL_TITLE_HEIGHT + (CELL_INFO_ROW_HEIGHT - painter.fontMetrics().height()) / 2;
+    int secondRowTop = firstRowTop + CELL_INFO_ROW_HEIGHT;
+
+    auto drawText = [&](int x, int y, const QStaticText& text, bool bold, bool alignRight) {
+        if (text.text().isEmpty()) return;
+        painter.setFont(bold ? boldFont : font());
+        if (alignRight) x -= static_cast<int>(text.size().width());
+        painter.drawStaticText(x, y, text);
+    };
+    drawText(left, titleTop, cell.title, cell.titleHighlighted, false);
+    drawText(left, firstRowTop, cell.illustrator, cell.illustratorHighlighted, false);
+    drawText(right, firstRowTop, cell.resolution, false, true);
+    drawText(left, secondRowTop, cell.id, cell.idHighlighted, false);
+    drawText(right, secondRowTop, cell.fileTypeAndSize, false, true);
+    painter.setFont(font());
+}
+
+// hit testing
+
+void PicGridWidget::mouseMoveEvent(QMouseEvent* event) {
+    QWidget::mouseMoveEvent(event);
+    emit cellHovered(cellAt(event->position().toPoint()));
+}
+void PicGridWidget::mousePressEvent(QMouseEvent* event) { // a press without a move, e.g. right after scrolling
+    QWidget::mousePressEvent(event);
+    emit cellHovered(cellAt(event->position().toPoint()));
+}
+void PicGridWidget::leaveEvent(QEvent* event) {
+    QWidget::leaveEvent(event);
+    emit cellHovered(-1);
+}
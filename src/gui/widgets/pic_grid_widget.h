@@ -0,0 +1,76 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "picture_frame.h"
+#include <QImage>
+#include <QPainter>
+#include <QRect>
+#include <QStaticText>
+#include <QWidget>
+#include <memory>
+#include <unordered_map>
+
+// cell geometry mirrors picture_frame.ui, keep in sync
+constexpr int CELL_PADDING = 9;
+constexpr int CELL_IMAGE_HEIGHT = 218;
+constexpr int CELL_INFO_HEIGHT = 86;
+constexpr int CELL_TITLE_HEIGHT = 35;
+constexpr int CELL_INFO_ROW_HEIGHT = 20;
+
+// paints every displayed picture frame into one widget, PictureFrame widgets are only used for the hovered cell
+class PicGridWidget : public QWidget {
+    Q_OBJECT
+public:
+    explicit PicGridWidget(QWidget* parent = nullptr);
+
+    void setCell(int index, const QRect& rect, const FrameTexts& texts); // index is the display index
+    void moveCell(int index, const QPoint& pos);
+    void setThumbnail(int index, std::shared_ptr<QImage> thumbnail);
+    void removeCell(int index);
+    void clearCells();
+    int cellAt(const QPoint& pos) const; // -1 if no cell is at pos
+
+signals:
+    void cellHovered(int index); // sent on every mouse move, -1 when the cursor is not over any cell
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+    void mouseMoveEvent(QMouseEvent* event) override;
+    void mousePressEvent(QMouseEvent* event) override;
+    void leaveEvent(QEvent* event) override;
+
+private:
+    struct Cell {
+        QRect rect;
+        std::shared_ptr<QImage> thumbnail; // premultiplied by ImageLoader, drawn without conversion
+        QStaticText title;                 // elided to the cell width, layouts are cached by QStaticText
+        QStaticText illustrator;
+        QStaticText id;
+        QStaticText resolution;
+        QStaticText fileTypeAndSize;
+        bool titleHighlighted = false;
+        bool illustratorHighlighted = false;
+        bool idHighlighted = false;
+    };
+    std::unordered_map<int, Cell> cells;
+    QFont boldFont;
+
+    void paintCell(QPainter& painter, const Cell& cell) const;
+    QStaticText makeText(const QString& text, bool bold, int width) const;
+};
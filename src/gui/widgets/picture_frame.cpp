@@ -19,6 +19,9 @@
 #include "picture_frame.h"
 #include "../controllers/image_loader.h"
 #include "ui_picture_frame.h"
+#include <QContextMenuEvent>
+#include <QMenu>
+#include <algorithm>
 
 QString getFileTypeStr(ImageFormat fileType) {
     switch (fileType) {
@@ -34,6 +37,14 @@ QString getFileTypeStr(ImageFormat fileType) {
         return {"Unknown"};
     }
 }
+QString getResolutionStr(const PicInfo& picInfo) {
+    return QString("%1x%2").arg(picInfo.width).arg(picInfo.height);
+}
+QString getFileTypeAndSizeStr(const PicInfo& picInfo) {
+    return QString("%1 | %2 MB")
+        .arg(getFileTypeStr(picInfo.fileType))
+        .arg(static_cast<double>(picInfo.size) / (1024 * 1024), 0, 'f', 2);
+}
 static size_t wrapIndex(int index, size_t count) {
     if (count == 0) return 0;
     int m = index % static_cast<int>(count);
@@ -50,6 +61,69 @@ const std::string TWITTER_AUTHOR_URL = "https://twitter.com/";
 
 constexpr size_t PRELOAD_PREVIEW_COUNT = 2;
 
+FrameTexts getFrameTexts(const PicItem* picItem, const MetadataItem* metadataItem, SearchField searchField) {
+    FrameTexts texts;
+    // show metadata if available, otherwise show filename and disable links
+    if (metadataItem) {
+        switch (metadataItem->metadata.platformType) {
+        case PlatformType::Pixiv:
+            texts.title = QString::fromStdString(metadataItem->metadata.title);
+            texts.illustrator = QString::fromStdString(metadataItem->metadata.authorName);
+            texts.id = QString("pid: %1").arg(QString::number(metadataItem->metadata.id));
+            texts.hasLinks = true;
+            break;
+        case PlatformType::Twitter: {
+            QString description = QString::fromStdString(metadataItem->metadata.description).split('\n').first();
+            if (description.length() > MAX_TITLE_LENGTH) {
+                description = description.left(MAX_TITLE_LENGTH) + "...";
+            }
+            texts.title = description;
+            texts.illustrator = QString::fromStdString(metadataItem->metadata.authorNick);
+            texts.id = QString("@%1").arg(QString::fromStdString(metadataItem->metadata.authorName));
+            texts.hasLinks = true;
+            break;
+        }
+        default:
+            texts.title = QString::fromStdString(metadataItem->metadata.title);
+            texts.id = QString::number(metadataItem->metadata.id);
+            break;
+        }
+    } else if (picItem) {
+        QString filename = QString::fromStdString(picItem->info.filePaths.begin()->filename().string());
+        if (filename.length() > MAX_TITLE_LENGTH) {
+            filename = filename.left(MAX_TITLE_LENGTH) + "...";
+        }
+        texts.title = filename;
+        texts.id = "N/A";
+    }
+
+    // a post with several pictures shows its picture count until one is previewed
+    if (metadataItem && metadataItem->picCount > 1) {
+        texts.fileTypeAndSize = QString("%1 pics").arg(metadataItem->picCount);
+    } else if (picItem) {
+        texts.resolution = getResolutionStr(picItem->info);
+        texts.fileTypeAndSize = getFileTypeAndSizeStr(picItem->info);
+    }
+
+    switch (searchField) { // highlight search result
+    case SearchField::Title:
+    case SearchField::Description:
+        texts.titleHighlighted = true;
+        break;
+    case SearchField::AuthorID:
+    case SearchField::AuthorName:
+    case SearchField::AuthorNick:
+        texts.illustratorHighlighted = true;
+        break;
+    case SearchField::PlatformID:
+        texts.idHighlighted = true;
+        break;
+    default:
+        break;
+    }
+    return texts;
+}
+
 // initialize
 
 PictureFrame::PictureFrame(
@@ -94,66 +168,29 @@ void PictureFrame::reset() {
 
     released = true;
 }
+void PictureFrame::cancelImageLoads() const {
+    if (released || !picItem) return;
+    imageLoader.cancel(picItem->info.id, LoadType::Thumbnail);
+    if (!metadataItem) return; // previews are only loaded for items with metadata, see loadPreviewImage
+    for (size_t i = 0; i < metadataItem->picCount; i++) {
+        imageLoader.cancel((picItem + i)->info.id, LoadType::Preview);
+    }
+}
 
 void PictureFrame::showInfo(SearchField searchField) const {
     if (released) return;
     showPicInfo();
 
+    FrameTexts texts = getFrameTexts(picItem, metadataItem, searchField);
     ui->titleLabel->setResponsive(false);
-    // show metadata if available, otherwise show filename and disable links
-    if (metadataItem) { // display metadata if available, otherwise show filename and disable links
-        switch (metadataItem->metadata.platformType) {
-        case PlatformType::Pixiv:
-            ui->titleLabel->setText(QString::fromStdString(metadataItem->metadata.title));
-            ui->illustratorLabel->setText(QString::fromStdString(metadataItem->metadata.authorName));
-            ui->idLabel->setText(QString("pid: %1").arg(QString::number(metadataItem->metadata.id)));
-            break;
-        case PlatformType::Twitter: {
-            QString description = QString::fromStdString(metadataItem->metadata.description).split('\n').first();
-            if (description.length() > MAX_TITLE_LENGTH) {
-                description = description.left(MAX_TITLE_LENGTH) + "...";
-            }
-            ui->titleLabel->setText(description);
-            ui->illustratorLabel->setText(QString::fromStdString(metadataItem->metadata.authorNick));
-            ui->idLabel->setText(QString("@%1").arg(QString::fromStdString(metadataItem->metadata.authorName)));
-            break;
-        }
-        default:
-            ui->titleLabel->setText(QString::fromStdString(metadataItem->metadata.title));
-            ui->idLabel->setText(QString::number(metadataItem->metadata.id));
-            ui->illustratorLabel->setResponsive(false);
-            ui->idLabel->setResponsive(false);
-            break;
-        }
-    } else { // no metadata, show filename and disable links
-        QString filename = QString::fromStdString(picItem->info.filePaths.begin()->filename().string());
-        if (filename.length() > MAX_TITLE_LENGTH) {
-            filename = filename.left(MAX_TITLE_LENGTH) + "...";
-        }
-        ui->titleLabel->setText(filename);
-        ui->idLabel->setText("N/A");
-        ui->illustratorLabel->setResponsive(false);
-        ui->idLabel->setResponsive(false);
-    }
-
-    switch (searchField) { // highlight search result
-    case SearchField::Title: {
-        ui->titleLabel->setHighlighted(true);
-        break;
-    }
-    case SearchField::AuthorID:
-    case SearchField::AuthorName:
-    case SearchField::AuthorNick: {
-        ui->illustratorLabel->setHighlighted(true);
-        break;
-    }
-    case SearchField::PlatformID: {
-        ui->idLabel->setHighlighted(true);
-        break;
-    }
-    default:
-        break;
-    }
+    ui->titleLabel->setText(texts.title);
+    ui->illustratorLabel->setText(texts.illustrator);
+    ui->idLabel->setText(texts.id);
+    ui->illustratorLabel->setResponsive(texts.hasLinks);
+    ui->idLabel->setResponsive(texts.hasLinks);
+    ui->titleLabel->setHighlighted(texts.titleHighlighted);
+    ui->illustratorLabel->setHighlighted(texts.illustratorHighlighted);
+    ui->idLabel->setHighlighted(texts.idHighlighted);
 }
 void PictureFrame::showPicInfo() const {
     if (released) return;
@@ -170,10 +207,8 @@ void PictureFrame::showPicInfo(size_t index) const {
     if (released) return;
     if (metadataItem && index >= metadataItem->picCount) return;
     const PicInfo& currentPic = (picItem + index)->info;
-    ui->resolutionLabel->setText(QString("%1x%2").arg(currentPic.width).arg(currentPic.height));
-    ui->fileTypeAndSizeLabel->setText(QString("%1 | %2 MB")
-                                          .arg(getFileTypeStr(currentPic.fileType))
-                                          .arg(static_cast<double>(currentPic.size) / (1024 * 1024), 0, 'f', 2));
+    ui->resolutionLabel->setText(getResolutionStr(currentPic));
+    ui->fileTypeAndSizeLabel->setText(getFileTypeAndSizeStr(currentPic));
     ui->resolutionLabel->setResponsive(true);
     ui->fileTypeAndSizeLabel->setResponsive(true);
 }
@@ -228,6 +263,21 @@ bool PictureFrame::eventFilter(QObject* watched, QEvent* event) {
 
     return QFrame::eventFilter(watched, event);
 }
+void PictureFrame::contextMenuEvent(QContextMenuEvent* event) {
+    if (released || !picItem) return;
+    const PicInfo& info = (picItem + previewingIndex)->info; // the previewed picture of a post
+    bool hasFeatureHash = std::any_of(info.featureHash.begin(), info.featureHash.end(), [](uint8_t b) { return b != 0; });
+
+    QMenu menu(this);
+    QAction* similarAction = menu.addAction("查找相似图片");
+    similarAction->setEnabled(hasFeatureHash); // feature hashes are computed by the tagger
+    uint64_t picId = info.id;
+    hidePreview();
+    if (menu.exec(event->globalPos()) == similarAction) {
+        emit findSimilarSignal(picId);
+    }
+    event->accept();
+}
 void PictureFrame::loadPreviewImage() const {
     if (released || !picItem || !metadataItem) return;
 
@@ -240,9 +290,9 @@ void PictureFrame::loadPreviewImage() const {
         const size_t left = wrapIndex(static_cast<int>(center) - static_cast<int>(offset), count);
         const size_t right = wrapIndex(static_cast<int>(center) + static_cast<int>(offset), count);
 
-        imageLoader.getImage((picItem + left)->info, LoadType::Preview);
+        imageLoader.getImage((picItem + left)->info, LoadType::Preview, static_cast<int>(offset));
         if (right != left) {
-            imageLoader.getImage((picItem + right)->info, LoadType::Preview);
+            imageLoader.getImage((picItem + right)->info, LoadType::Preview, static_cast<int>(offset));
         }
     }
 }
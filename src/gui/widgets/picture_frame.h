@@ -37,6 +37,21 @@ namespace Ui {
 class PictureFrame;
 }
 
+struct FrameTexts { // label texts of a frame that is not previewing, also painted by PicGridWidget
+    QString title;
+    QString illustrator;
+    QString id;
+    QString resolution;
+    QString fileTypeAndSize;
+    bool hasLinks = false; // illustrator and id open platform urls
+    bool titleHighlighted = false;
+    bool illustratorHighlighted = false;
+    bool idHighlighted = false;
+};
+FrameTexts getFrameTexts(const PicItem* picItem, const MetadataItem* metadataItem, SearchField searchField);
+QString getResolutionStr(const PicInfo& picInfo);
+QString getFileTypeAndSizeStr(const PicInfo& picInfo);
+
 class PictureFrame : public QFrame {
     Q_OBJECT
 public:
@@ -50,6 +65,7 @@ public:
     void displayImage(uint64_t picId, LoadType loadType); // asynchronous loaded image will be displayed through this function
 
     void reset();
+    void cancelImageLoads() const; // drop queued thumbnail and preview loads of the displayed item
     void updateDisplayItem(const PicItem* newPicItem, const MetadataItem* newMetadataItem, SearchField searchField) {
         picItem = newPicItem;
         metadataItem = newMetadataItem;
@@ -58,6 +74,9 @@ public:
         showThumbnail();
     }
 
+signals:
+    void findSimilarSignal(uint64_t picId);
+
 protected:
     void leaveEvent(QEvent* event) override {
         QFrame::leaveEvent(event);
@@ -66,6 +85,7 @@ protected:
         showPicInfo();
     }
     bool eventFilter(QObject* obj, QEvent* event) override;
+    void contextMenuEvent(QContextMenuEvent* event) override;
 
 private:
     Ui::PictureFrame* ui;
@@ -0,0 +1,148 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// bounded lock-free multi-producer single-consumer ring, each slot carries a sequence number telling
+// whether it is free for the producer of that lap or filled for the consumer
+// push waits while the ring is full and pop waits while it is empty, both only touch the mutex when they have to wait
+template <typename T> class BoundedMpscQueue {
+public:
+    explicit BoundedMpscQueue(size_t capacity) { // capacity is rounded up to a power of two
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots = std::make_unique<Slot[]>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    BoundedMpscQueue(const BoundedMpscQueue&) = delete;
+    BoundedMpscQueue& operator=(const BoundedMpscQueue&) = delete;
+
+    bool push(T&& value) { // any thread, false if the queue is closed
+        for (int tries = 0; !closed.load(); tries++) {
+            if (tryPush(value)) {
+                wake(consumerWaiting, notEmpty);
+                return true;
+            }
+            if (tries < SPIN_TRIES) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(parkMutex);
+            producersWaiting.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in wake
+            notFull.wait(lock, [this]() { return closed.load() || hasFreeSlot(); });
+            producersWaiting.fetch_sub(1);
+        }
+        return false;
+    }
+    bool pop(T& value) { // consumer thread only, false once the queue is closed and drained
+        for (int tries = 0;; tries++) {
+            if (tryPop(value)) {
+                wake(producersWaiting, notFull);
+                return true;
+            }
+            if (closed.load()) return tryPop(value);
+            if (tries < SPIN_TRIES) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(parkMutex);
+            consumerWaiting.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            notEmpty.wait(lock, [this]() { return closed.load() || hasItem(); });
+            consumerWaiting.fetch_sub(1);
+        }
+    }
+    void close() { // wakes every waiting thread, call after the last push returned unless the rest is discarded
+        closed.store(true);
+        std::lock_guard<std::mutex> lock(parkMutex);
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    static constexpr int SPIN_TRIES = 64; // yields before waiting on the condition variable
+
+    struct Slot {
+        std::atomic<size_t> sequence{0}; // position for the next producer, position + 1 once filled
+        T value;
+    };
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) size_t dequeuePos = 0; // only touched by the consumer
+    std::atomic<bool> closed{false};
+
+    std::mutex parkMutex; // only taken by threads about to wait and by the ones waking them
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::atomic<int> consumerWaiting{0};
+    std::atomic<int> producersWaiting{0};
+
+    bool tryPush(T& value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[pos & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) { // free for this lap, claim it
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) { // still holds the item of the previous lap
+                return false;
+            } else { // another producer claimed it
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool tryPop(T& value) {
+        Slot& slot = slots[dequeuePos & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) return false; // empty or still being written
+        value = std::move(slot.value);
+        slot.sequence.store(dequeuePos + mask + 1, std::memory_order_release); // free for the next lap
+        dequeuePos++;
+        return true;
+    }
+    bool hasFreeSlot() const {
+        size_t pos = enqueuePos.load();
+        return slots[pos & mask].sequence.load() >= pos;
+    }
+    bool hasItem() const { return slots[dequeuePos & mask].sequence.load() == dequeuePos + 1; }
+    void wake(std::atomic<int>& waiting, std::condition_variable& condition) {
+        // either the waiter registered before this fence and is notified, or its predicate sees the new state
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) == 0) return;
+        std::lock_guard<std::mutex> lock(parkMutex);
+        condition.notify_all();
+    }
+};
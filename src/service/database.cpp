@@ -21,6 +21,7 @@
 #include "parser.h"
 #include <cstdint>
 #include <filesystem>
+#include <sys/stat.h>
 
 // utility functions
 
@@ -45,6 +46,19 @@ std::vector<std::filesystem::path> collectFiles(const std::filesystem::path& dir
     Info() << "Total files collected:" << files.size() << "from directory:" << directory.string();
     return files;
 }
+bool statFile(const std::filesystem::path& filePath, FileStat& fileStat) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_wstat64(filePath.c_str(), &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(filePath.c_str(), &st) != 0) return false;
+#endif
+    fileStat.size = static_cast<int64_t>(st.st_size);
+    fileStat.mtime = static_cast<int64_t>(st.st_mtime);
+    fileStat.inode = static_cast<uint64_t>(st.st_ino);
+    return true;
+}
 
 // PicDatabase class implementation
 
@@ -55,12 +69,29 @@ PicDatabase::PicDatabase(const std::string& databaseFile, DbMode mode) {
     if (mode == DbMode::Import) initImportedFiles(); // only needed in import mode, to avoid parsing duplicate files
 }
 PicDatabase::~PicDatabase() {
+    if (statementCacheStats.misses > 0) {
+        Info() << "Statement cache hits:" << statementCacheStats.hits << "misses:" << statementCacheStats.misses;
+    }
+    for (auto& stmt : statementCache) { // statements must be finalized before closing the connection
+        stmt = SQLiteStatement();
+    }
     if (db) {
         sqlite3_close(db);
         db = nullptr;
     }
 }
 
+CachedStatement PicDatabase::prepareCached(StatementId id, const char* sql) const {
+    SQLiteStatement& stmt = statementCache[static_cast<size_t>(id)];
+    if (stmt.get()) {
+        statementCacheStats.hits++;
+    } else {
+        statementCacheStats.misses++;
+        stmt = prepare(sql);
+    }
+    return CachedStatement(stmt.get());
+}
+
 // init functions
 
 void PicDatabase::initDatabase(const std::string& databaseFile) {
@@ -72,6 +103,7 @@ void PicDatabase::initDatabase(const std::string& databaseFile) {
         Error() << "Failed to create tables";
         return;
     }
+    fullTextIndexAvailable = initFullTextIndex();
     Info() << "Database initialized";
 }
 bool PicDatabase::createTables() const {
@@ -206,6 +238,9 @@ bool PicDatabase::createTables() const {
         CREATE TABLE IF NOT EXISTS imported_files (
             dir_id INTEGER NOT NULL,
             filename TEXT NOT NULL,
+            file_size INTEGER DEFAULT NULL,
+            mtime INTEGER DEFAULT NULL,
+            inode INTEGER DEFAULT NULL,
             
             PRIMARY KEY (dir_id, filename),
 
@@ -262,9 +297,83 @@ bool PicDatabase::createTables() const {
             return false;
         }
     }
+    // databases created before file stats were recorded, their files get stats on the next rescan
+    SQLiteStatement stmt = prepare("SELECT 1 FROM pragma_table_info('imported_files') WHERE name = 'file_size'");
+    if (stmt.get() && sqlite3_step(stmt.get()) != SQLITE_ROW) {
+        for (const char* column : {"file_size", "mtime", "inode"}) {
+            if (!execute(std::string("ALTER TABLE imported_files ADD COLUMN ") + column + " INTEGER DEFAULT NULL")) {
+                Error() << "Failed to add column to imported_files:" << sqlite3_errmsg(db);
+                rollbackTransaction();
+                return false;
+            }
+        }
+    }
     commitTransaction();
     return true;
 }
+bool PicDatabase::initFullTextIndex() const {
+    // trigram full-text index over metadata text fields, external content table kept in sync by triggers
+    auto indexExists = [this]() {
+        SQLiteStatement stmt = prepare("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'picture_metadata_fts'");
+        return stmt.get() && sqlite3_step(stmt.get()) == SQLITE_ROW;
+    };
+    if (indexExists()) return true;
+
+    const std::vector<std::string> statements = {
+        R"(
+        CREATE VIRTUAL TABLE IF NOT EXISTS picture_metadata_fts USING fts5(
+            author_name, author_nick, title, description,
+            content = 'picture_metadata', tokenize = 'trigram'
+        )
+    )",
+        R"(
+        CREATE TRIGGER IF NOT EXISTS picture_metadata_fts_insert AFTER INSERT ON picture_metadata BEGIN
+            INSERT INTO picture_metadata_fts(rowid, author_name, author_nick, title, description)
+            VALUES (new.rowid, new.author_name, new.author_nick, new.title, new.description);
+        END
+    )",
+        R"(
+        CREATE TRIGGER IF NOT EXISTS picture_metadata_fts_delete AFTER DELETE ON picture_metadata BEGIN
+            INSERT INTO picture_metadata_fts(picture_metadata_fts, rowid, author_name, author_nick, title, description)
+            VALUES ('delete', old.rowid, old.author_name, old.author_nick, old.title, old.description);
+        END
+    )",
+        R"(
+        CREATE TRIGGER IF NOT EXISTS picture_metadata_fts_update
+        AFTER UPDATE OF author_name, author_nick, title, description ON picture_metadata BEGIN
+            INSERT INTO picture_metadata_fts(picture_metadata_fts, rowid, author_name, author_nick, title, description)
+            VALUES ('delete', old.rowid, old.author_name, old.author_nick, old.title, old.description);
+            INSERT INTO picture_metadata_fts(rowid, author_name, author_nick, title, description)
+            VALUES (new.rowid, new.author_name, new.author_nick, new.title, new.description);
+        END
+    )",
+        "INSERT INTO picture_metadata_fts(picture_metadata_fts) VALUES ('rebuild')"}; // index existing metadata
+    // connections opened together race to create the index, the write lock lets only one of them build it
+    constexpr int SETUP_LOCK_TIMEOUT_MS = 10000; // the others wait for its commit instead of failing with SQLITE_BUSY
+    sqlite3_busy_timeout(db, SETUP_LOCK_TIMEOUT_MS);
+    bool locked = beginTransaction(true);
+    sqlite3_busy_timeout(db, 0);
+    if (!locked) return indexExists();
+    if (indexExists()) { // created by another connection before the lock was taken
+        rollbackTransaction();
+        return true;
+    }
+    for (const auto& sql : statements) {
+        if (!execute(sql)) {
+            std::string error = sqlite3_errmsg(db);
+            rollbackTransaction();
+            if (indexExists()) return true;
+            Warn() << "Full-text index unavailable, text search falls back to LIKE:" << error;
+            return false;
+        }
+    }
+    if (!commitTransaction()) {
+        rollbackTransaction();
+        return indexExists();
+    }
+    Info() << "Full-text index created";
+    return true;
+}
 void PicDatabase::initTagMapping() const {
     if (cache.tagMappingLoaded()) return;
 
@@ -307,9 +416,9 @@ void PicDatabase::initTagMapping() const {
 void PicDatabase::initImportedFiles() const {
     if (cache.importedFileLoaded()) return;
     SQLiteStatement stmt;
-    std::unordered_map<std::string, std::unordered_set<std::string>> importedFiles;
+    std::unordered_map<std::string, std::unordered_map<std::string, FileStat>> importedFiles;
     stmt = prepare(R"(
-        SELECT id.dir_path, f.filename
+        SELECT id.dir_path, f.filename, f.file_size, f.mtime, f.inode
         FROM imported_files f
         JOIN imported_directories id ON f.dir_id = id.dir_id
     )");
@@ -323,19 +432,192 @@ void PicDatabase::initImportedFiles() const {
         if (dirPathCStr && fileNameCStr) {
             std::string dirPath(dirPathCStr);
             std::string fileName(fileNameCStr);
-            importedFiles[dirPath].insert(fileName);
+            FileStat fileStat;
+            if (sqlite3_column_type(stmt.get(), 2) != SQLITE_NULL) {
+                fileStat.size = sqlite3_column_int64(stmt.get(), 2);
+                fileStat.mtime = sqlite3_column_int64(stmt.get(), 3);
+                fileStat.inode = int64_to_uint64(sqlite3_column_int64(stmt.get(), 4));
+            }
+            importedFiles[dirPath][fileName] = fileStat;
         }
     }
     cache.loadImportedFiles(std::move(importedFiles));
     Info() << "Imported files tracking initialized. Directories:" << importedFiles.size();
 }
+std::shared_ptr<const TagIndex> PicDatabase::initTagIndex() const {
+    auto index = std::make_shared<TagIndex>();
+    SQLiteStatement stmt;
+    int rc = SQLITE_DONE;
+    auto buildFailed = [this]() -> std::shared_ptr<const TagIndex> { // a partial index would drop pictures from searches
+        Warn() << "Tag index not loaded, reading the tables stopped:" << sqlite3_errmsg(db);
+        return nullptr;
+    };
+
+    // assign dense ordinals to pictures, same order as picture_tags primary key
+    stmt = prepare("SELECT id FROM pictures ORDER BY id ASC");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for fetching picture ids.";
+        return nullptr;
+    }
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        uint64_t picId = int64_to_uint64(sqlite3_column_int64(stmt.get(), 0));
+        index->picOrdinals[picId] = static_cast<uint32_t>(index->picIds.size());
+        index->picIds.push_back(picId);
+    }
+    if (rc != SQLITE_DONE) return buildFailed();
+
+    // ordinals arrive in ascending order, so every bitmap is built by appending
+    stmt = prepare("SELECT id, tag_id FROM picture_tags ORDER BY id ASC");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for fetching picture tags.";
+        return nullptr;
+    }
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        uint64_t picId = int64_to_uint64(sqlite3_column_int64(stmt.get(), 0));
+        auto tagId = static_cast<uint32_t>(sqlite3_column_int(stmt.get(), 1));
+        auto it = index->picOrdinals.find(picId);
+        if (it == index->picOrdinals.end()) continue; // dangling row, foreign keys are off during import
+        if (tagId >= index->tagBitmaps.size()) index->tagBitmaps.resize(tagId + 1);
+        index->tagBitmaps[tagId].add(it->second);
+    }
+    if (rc != SQLITE_DONE) return buildFailed();
+
+    // assign dense ordinals to metadata, same order as picture_metadata_tags and picture_source primary keys
+    stmt = prepare("SELECT platform, platform_id FROM picture_metadata ORDER BY platform ASC, platform_id ASC");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for fetching metadata ids.";
+        return nullptr;
+    }
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        PlatformID platformID{};
+        platformID.platform = static_cast<PlatformType>(sqlite3_column_int(stmt.get(), 0));
+        platformID.platformID = sqlite3_column_int64(stmt.get(), 1);
+        index->metadataOrdinals[platformID] = static_cast<uint32_t>(index->metadataIds.size());
+        index->metadataIds.push_back(platformID);
+    }
+    if (rc != SQLITE_DONE) return buildFailed();
+
+    stmt = prepare("SELECT platform, platform_id, tag_id FROM picture_metadata_tags ORDER BY platform ASC, platform_id ASC");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for fetching metadata tags.";
+        return nullptr;
+    }
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        PlatformID platformID{};
+        platformID.platform = static_cast<PlatformType>(sqlite3_column_int(stmt.get(), 0));
+        platformID.platformID = sqlite3_column_int64(stmt.get(), 1);
+        auto tagId = static_cast<uint32_t>(sqlite3_column_int(stmt.get(), 2));
+        auto it = index->metadataOrdinals.find(platformID);
+        if (it == index->metadataOrdinals.end()) continue;
+        if (tagId >= index->platformTagBitmaps.size()) index->platformTagBitmaps.resize(tagId + 1);
+        index->platformTagBitmaps[tagId].add(it->second);
+    }
+    if (rc != SQLITE_DONE) return buildFailed();
+
+    // pictures of each metadata, stored contiguously so posts can be expanded without per-post queries
+    std::vector<std::vector<uint32_t>> metadataPics(index->metadataIds.size());
+    stmt = prepare(
+        "SELECT platform, platform_id, id FROM picture_source ORDER BY platform ASC, platform_id ASC, image_index ASC");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for fetching picture sources.";
+        return nullptr;
+    }
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        PlatformID platformID{};
+        platformID.platform = static_cast<PlatformType>(sqlite3_column_int(stmt.get(), 0));
+        platformID.platformID = sqlite3_column_int64(stmt.get(), 1);
+        uint64_t picId = int64_to_uint64(sqlite3_column_int64(stmt.get(), 2));
+        auto metadataIt = index->metadataOrdinals.find(platformID);
+        auto picIt = index->picOrdinals.find(picId);
+        if (metadataIt == index->metadataOrdinals.end() || picIt == index->picOrdinals.end()) continue; // no metadata file
+        metadataPics[metadataIt->second].push_back(picIt->second);
+    }
+    if (rc != SQLITE_DONE) return buildFailed();
+    index->metadataPicOffsets.reserve(metadataPics.size() + 1);
+    index->metadataPicOffsets.push_back(0);
+    for (const auto& pics : metadataPics) {
+        index->metadataPics.insert(index->metadataPics.end(), pics.begin(), pics.end());
+        index->metadataPicOffsets.push_back(static_cast<uint32_t>(index->metadataPics.size()));
+    }
+    // and the reverse relation, filled by counting sort so metadata ordinals stay ascending per picture
+    index->picMetadataOffsets.assign(index->picIds.size() + 1, 0);
+    for (uint32_t picOrdinal : index->metadataPics) {
+        index->picMetadataOffsets[picOrdinal + 1]++;
+    }
+    for (size_t i = 1; i < index->picMetadataOffsets.size(); i++) {
+        index->picMetadataOffsets[i] += index->picMetadataOffsets[i - 1];
+    }
+    index->picMetadata.resize(index->metadataPics.size());
+    std::vector<uint32_t> fillPositions(index->picMetadataOffsets.begin(), index->picMetadataOffsets.end() - 1);
+    for (uint32_t metadataOrdinal = 0; metadataOrdinal < metadataPics.size(); metadataOrdinal++) {
+        for (uint32_t picOrdinal : metadataPics[metadataOrdinal]) {
+            index->picMetadata[fillPositions[picOrdinal]++] = metadataOrdinal;
+        }
+    }
+
+    // facet counting visits tags from the most frequent one and stops once the rest cannot make the top list
+    auto sortByCardinality = [](const std::vector<RoaringBitmap>& bitmaps) {
+        std::vector<uint32_t> tagIds;
+        for (uint32_t tagId = 0; tagId < bitmaps.size(); tagId++) {
+            if (!bitmaps[tagId].empty()) tagIds.push_back(tagId);
+        }
+        std::stable_sort(tagIds.begin(), tagIds.end(), [&bitmaps](uint32_t a, uint32_t b) {
+            return bitmaps[a].cardinality() > bitmaps[b].cardinality();
+        });
+        return tagIds;
+    };
+    index->tagsByCardinality = sortByCardinality(index->tagBitmaps);
+    index->platformTagsByCardinality = sortByCardinality(index->platformTagBitmaps);
+
+    size_t indexBytes = 0;
+    for (const auto& bitmap : index->tagBitmaps) {
+        indexBytes += bitmap.sizeInBytes();
+    }
+    for (const auto& bitmap : index->platformTagBitmaps) {
+        indexBytes += bitmap.sizeInBytes();
+    }
+    Info() << "Tag index loaded. Pictures:" << index->picIds.size() << "Tags:" << index->tagBitmaps.size()
+           << "Metadata:" << index->metadataIds.size() << "Platform tags:" << index->platformTagBitmaps.size()
+           << "Bitmap size (KB):" << indexBytes / 1024;
+    return index;
+}
+std::shared_ptr<const FeatureHashIndex> PicDatabase::initFeatureHashIndex() const {
+    auto index = std::make_shared<FeatureHashIndex>();
+    int rc = SQLITE_DONE;
+    SQLiteStatement stmt = prepare("SELECT COUNT(*) FROM pictures WHERE length(feature_hash) = ?");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for counting feature hashes.";
+        return nullptr;
+    }
+    sqlite3_bind_int(stmt.get(), 1, static_cast<int>(FEATURE_HASH_BYTES));
+    if (sqlite3_step(stmt.get()) == SQLITE_ROW) index->reserve(static_cast<size_t>(sqlite3_column_int64(stmt.get(), 0)));
+
+    // untagged pictures have no feature hash and are left out
+    stmt = prepare("SELECT id, feature_hash FROM pictures WHERE length(feature_hash) = ? ORDER BY id ASC");
+    if (!stmt.get()) {
+        Error() << "Failed to prepare statement for fetching feature hashes.";
+        return nullptr;
+    }
+    sqlite3_bind_int(stmt.get(), 1, static_cast<int>(FEATURE_HASH_BYTES));
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        uint64_t picId = int64_to_uint64(sqlite3_column_int64(stmt.get(), 0));
+        index->add(picId, static_cast<const uint8_t*>(sqlite3_column_blob(stmt.get(), 1)));
+    }
+    if (rc != SQLITE_DONE) { // interrupted by a newer search, a partial index would miss similar pictures
+        Warn() << "Feature hash index not loaded, reading feature hashes stopped:" << sqlite3_errmsg(db);
+        return nullptr;
+    }
+    Info() << "Feature hash index loaded. Pictures:" << index->size() << "Size (KB):" << index->sizeInBytes() / 1024
+           << "Kernel:" << FeatureHashIndex::kernelName(FeatureHashIndex::activeKernel());
+    return index;
+}
 
 // insert functions
 
 bool PicDatabase::insertPicture(const ParsedPicture& picInfo) const {
-    SQLiteStatement stmt;
+    CachedStatement stmt;
     // insert into pictures table
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::InsertPicture, R"(
         INSERT OR IGNORE INTO pictures(
             id, width, height, size, file_type, edit_time, download_time, restrict_type
         ) VALUES (
@@ -354,11 +636,18 @@ bool PicDatabase::insertPicture(const ParsedPicture& picInfo) const {
         Error() << "Failed to insert picture: " << sqlite3_errmsg(db);
         return false;
     }
-    // insert into picture_file_paths table
-    stmt = prepare(R"(
-            INSERT OR IGNORE INTO picture_file_paths(
+    if (sqlite3_changes(db) > 0) tagIndexStale = true;
+    // insert into picture_file_paths table, a modified file found by a rescan moves its path to the new content
+    stmt = prepareCached(StatementId::SelectPictureFilePathId, R"(
+            SELECT id FROM picture_file_paths WHERE file_path = ?
+        )");
+    sqlite3_bind_text(stmt.get(), 1, picInfo.filePath.generic_u8string().c_str(), -1, SQLITE_TRANSIENT);
+    uint64_t previousID = sqlite3_step(stmt.get()) == SQLITE_ROW ? int64_to_uint64(sqlite3_column_int64(stmt.get(), 0)) : 0;
+    stmt = prepareCached(StatementId::InsertPictureFilePath, R"(
+            INSERT INTO picture_file_paths(
                 id, file_path
             ) VALUES (?, ?)
+            ON CONFLICT(file_path) DO UPDATE SET id = excluded.id
         )");
     sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picInfo.id));
     sqlite3_bind_text(stmt.get(), 2, picInfo.filePath.generic_u8string().c_str(), -1, SQLITE_TRANSIENT);
@@ -366,9 +655,10 @@ bool PicDatabase::insertPicture(const ParsedPicture& picInfo) const {
         Error() << "Failed to insert picture_file_path: " << sqlite3_errmsg(db);
         return false;
     }
+    if (previousID != 0 && previousID != picInfo.id) deletePathlessPicture(previousID); // before its source blocks ours
     // insert into picture_source table
     if (picInfo.identifier.platform == PlatformType::Unknown) return true; // no source info to insert
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::InsertPictureSource, R"(
             INSERT OR IGNORE INTO picture_source(
                 id, platform, platform_id, image_index
             ) VALUES (
@@ -383,18 +673,57 @@ bool PicDatabase::insertPicture(const ParsedPicture& picInfo) const {
         Error() << "Failed to insert picture_source: " << sqlite3_errmsg(db);
         return false;
     }
+    if (sqlite3_changes(db) > 0) tagIndexStale = true;
 
     return true;
 }
+void PicDatabase::deletePathlessPicture(uint64_t picID) const {
+    // foreign keys are off during import, so the rows referencing the picture are deleted here instead of by cascade
+    CachedStatement stmt = prepareCached(StatementId::SelectPicturePathExists, R"(
+        SELECT 1 FROM picture_file_paths WHERE id = ? LIMIT 1
+    )");
+    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picID));
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) return; // another copy of the old content is still imported
+    stmt = prepareCached(StatementId::DeletePictureTags, R"(
+        DELETE FROM picture_tags WHERE id = ? RETURNING tag_id
+    )");
+    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picID));
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        tagCountDeltas[static_cast<uint32_t>(sqlite3_column_int(stmt.get(), 0))]--;
+    }
+    if (rc != SQLITE_DONE) {
+        Error() << "Failed to delete picture_tags of replaced picture: " << sqlite3_errmsg(db);
+        return;
+    }
+    stmt = prepareCached(StatementId::DeletePictureSource, R"(
+        DELETE FROM picture_source WHERE id = ?
+    )");
+    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picID));
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        Error() << "Failed to delete picture_source of replaced picture: " << sqlite3_errmsg(db);
+        return;
+    }
+    stmt = prepareCached(StatementId::DeletePicture, R"(
+        DELETE FROM pictures WHERE id = ?
+    )");
+    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picID));
+    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        Error() << "Failed to delete replaced picture: " << sqlite3_errmsg(db);
+        return;
+    }
+    tagIndexStale = true;
+    featureHashIndexStale = true;
+}
 bool PicDatabase::insertMetadata(const ParsedMetadata& metadataInfo) {
     if (metadataInfo.updateIfExists) {
         Warn() << "insertMetadata called with updateIfExists=true, redirecting to updateMetadata.";
         return updateMetadata(metadataInfo);
     }
     if (metadataInfo.id == 0) return false; // invalid metadata ID
-    SQLiteStatement stmt;
+    CachedStatement stmt;
     // insert into picture_metadata table
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::InsertMetadata, R"(
         INSERT OR IGNORE INTO picture_metadata(
             platform, platform_id, date, author_id, author_name, author_nick, 
             author_description, title, description, view_count, like_count, bookmark_count,
@@ -422,13 +751,14 @@ bool PicDatabase::insertMetadata(const ParsedMetadata& metadataInfo) {
         Error() << "Failed to insert picture_metadata: " << sqlite3_errmsg(db);
         return false;
     }
+    tagIndexStale = true;
     // insert into picture_metadata_tags table
     for (const auto& tag : metadataInfo.tags) {
         PlatformTagStr stringTag{metadataInfo.platformType, tag};
         if (!cache.platformTagExists(stringTag)) {
             // insert new platform tag
             uint32_t newId = cache.addPlatformTag(stringTag);
-            stmt = prepare(R"(
+            stmt = prepareCached(StatementId::InsertPlatformTag, R"(
                 INSERT OR IGNORE INTO platform_tags(tag_id, platform, tag) VALUES (?, ?, ?)
             )");
             sqlite3_bind_int(stmt.get(), 1, newId);
@@ -439,7 +769,7 @@ bool PicDatabase::insertMetadata(const ParsedMetadata& metadataInfo) {
                 return false;
             }
         }
-        stmt = prepare(R"(
+        stmt = prepareCached(StatementId::InsertMetadataTag, R"(
             INSERT OR IGNORE INTO picture_metadata_tags(
                 platform, platform_id, tag_id
             ) VALUES (?, ?, ?)
@@ -451,11 +781,12 @@ bool PicDatabase::insertMetadata(const ParsedMetadata& metadataInfo) {
             Error() << "Failed to insert picture_metadata_tag: " << sqlite3_errmsg(db);
             return false;
         }
+        if (sqlite3_changes(db) > 0) platformTagCountDeltas[cache.getPlatformTagId(stringTag)]++;
     }
     if (metadataInfo.tags.size() == metadataInfo.tagsTransl.size()) {
         for (size_t i = 0; i < metadataInfo.tags.size(); ++i) {
             PlatformTagStr stringTag{metadataInfo.platformType, metadataInfo.tags[i]};
-            stmt = prepare(R"(
+            stmt = prepareCached(StatementId::UpdatePlatformTagTranslation, R"(
                 UPDATE platform_tags SET translated_tag = ? WHERE tag_id = ?
             )");
             sqlite3_bind_text(stmt.get(), 1, metadataInfo.tagsTransl[i].c_str(), -1, SQLITE_TRANSIENT);
@@ -471,9 +802,9 @@ bool PicDatabase::insertMetadata(const ParsedMetadata& metadataInfo) {
 }
 bool PicDatabase::updateMetadata(const ParsedMetadata& metadataInfo) const {
     if (metadataInfo.id == 0) return false; // invalid metadata ID
-    SQLiteStatement stmt;
+    CachedStatement stmt;
     // update picture_metadata table
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::UpdateMetadata, R"(
         INSERT INTO picture_metadata(
             platform, platform_id, date, author_id, author_name, author_nick, 
             author_description, title, description, view_count, like_count, bookmark_count,
@@ -529,13 +860,14 @@ bool PicDatabase::updateMetadata(const ParsedMetadata& metadataInfo) const {
         Error() << "Failed to update picture_metadata: " << sqlite3_errmsg(db);
         return false;
     }
+    tagIndexStale = true;
     // update picture_metadata_tags table
     for (const auto& tag : metadataInfo.tags) {
         PlatformTagStr stringTag{metadataInfo.platformType, tag};
         if (!cache.platformTagExists(stringTag)) {
             // insert new platform tag
             uint32_t newId = cache.addPlatformTag(stringTag);
-            stmt = prepare(R"(
+            stmt = prepareCached(StatementId::InsertPlatformTag, R"(
                 INSERT OR IGNORE INTO platform_tags(tag_id, platform, tag) VALUES (?, ?, ?)
             )");
             sqlite3_bind_int(stmt.get(), 1, newId);
@@ -546,7 +878,7 @@ bool PicDatabase::updateMetadata(const ParsedMetadata& metadataInfo) const {
                 return false;
             }
         }
-        stmt = prepare(R"(
+        stmt = prepareCached(StatementId::InsertMetadataTag, R"(
             INSERT OR IGNORE INTO picture_metadata_tags(
                 platform, platform_id, tag_id
             ) VALUES (?, ?, ?)
@@ -558,11 +890,12 @@ bool PicDatabase::updateMetadata(const ParsedMetadata& metadataInfo) const {
             Error() << "Failed to insert picture_metadata_tag: " << sqlite3_errmsg(db);
             return false;
         }
+        if (sqlite3_changes(db) > 0) platformTagCountDeltas[cache.getPlatformTagId(stringTag)]++;
     }
     if (metadataInfo.tags.size() == metadataInfo.tagsTransl.size()) {
         for (size_t i = 0; i < metadataInfo.tags.size(); ++i) {
             PlatformTagStr stringTag{metadataInfo.platformType, metadataInfo.tags[i]};
-            stmt = prepare(R"(
+            stmt = prepareCached(StatementId::UpdatePlatformTagTranslation, R"(
                 UPDATE platform_tags SET translated_tag = ? WHERE tag_id = ?
             )");
             sqlite3_bind_text(stmt.get(), 1, metadataInfo.tagsTransl[i].c_str(), -1, SQLITE_TRANSIENT);
@@ -578,70 +911,147 @@ bool PicDatabase::updateMetadata(const ParsedMetadata& metadataInfo) const {
 
 // query functions
 
-PicInfo PicDatabase::getPicInfo(uint64_t id) const {
-    PicInfo info{};
+template <typename BindFunc, typename RowFunc>
+void PicDatabase::batchSelect(const std::string& sqlPrefix,
+                              const std::string& sqlSuffix,
+                              const std::string& keyPlaceholder,
+                              size_t keyCount,
+                              BindFunc bindKey,
+                              RowFunc onRow) const {
+    const int paramsPerKey = static_cast<int>(std::count(keyPlaceholder.begin(), keyPlaceholder.end(), '?'));
     SQLiteStatement stmt;
-
-    // query main picture info
-    stmt = prepare("SELECT width, height, size, file_type, edit_time, download_time, feature_hash, restrict_type, ai_type FROM "
-                   "pictures WHERE id = ?");
-    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(id));
-    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
-        info.id = id;
-        info.width = sqlite3_column_int(stmt.get(), 0);
-        info.height = sqlite3_column_int(stmt.get(), 1);
-        info.size = sqlite3_column_int(stmt.get(), 2);
-        info.fileType = static_cast<ImageFormat>(sqlite3_column_int(stmt.get(), 3));
-        info.editTime = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 4)));
-        info.downloadTime = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 5)));
-        const void* featureHashBlob = sqlite3_column_blob(stmt.get(), 6);
-        int featureHashSize = sqlite3_column_bytes(stmt.get(), 6);
-        if (featureHashBlob && featureHashSize == sizeof(info.featureHash)) {
-            std::memcpy(info.featureHash.data(), featureHashBlob, sizeof(info.featureHash));
+    size_t preparedChunkSize = 0;
+    for (size_t begin = 0; begin < keyCount; begin += BATCH_QUERY_SIZE) {
+        size_t chunkSize = std::min(BATCH_QUERY_SIZE, keyCount - begin);
+        if (chunkSize != preparedChunkSize) { // only the last chunk needs a different statement
+            std::string sql = sqlPrefix;
+            for (size_t i = 0; i < chunkSize; i++) {
+                if (i) sql += ", ";
+                sql += keyPlaceholder;
+            }
+            sql += sqlSuffix;
+            stmt = prepare(sql);
+            if (!stmt.get()) {
+                Error() << "Failed to prepare batch select statement:" << sqlite3_errmsg(db);
+                return;
+            }
+            preparedChunkSize = chunkSize;
         } else {
-            info.featureHash.fill(0);
+            sqlite3_reset(stmt.get());
         }
-        info.restrictType = static_cast<RestrictType>(sqlite3_column_int(stmt.get(), 7));
-        info.aiType = static_cast<AIType>(sqlite3_column_int(stmt.get(), 8));
-    } else {
-        return info; // id 不存在，返回空对象
+        for (size_t i = 0; i < chunkSize; i++) {
+            bindKey(stmt.get(), static_cast<int>(i) * paramsPerKey + 1, begin + i);
+        }
+        int rc;
+        while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+            onRow(stmt.get());
+        }
+        if (rc == SQLITE_INTERRUPT) return; // interrupted by another thread, the caller discards the partial result
     }
+}
+std::vector<PicInfo> PicDatabase::getPicInfos(const std::vector<uint64_t>& ids) const {
+    std::vector<PicInfo> infos(ids.size());
+    std::vector<uint64_t> uniqueIds;
+    std::unordered_map<uint64_t, size_t> positions; // id -> first position in ids
+    uniqueIds.reserve(ids.size());
+    positions.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (positions.emplace(ids[i], i).second) uniqueIds.push_back(ids[i]);
+    }
+    auto bindId = [&uniqueIds](sqlite3_stmt* stmt, int param, size_t keyIdx) {
+        sqlite3_bind_int64(stmt, param, uint64_to_int64(uniqueIds[keyIdx]));
+    };
+    std::vector<bool> found(ids.size(), false);
+    auto findInfo = [&](sqlite3_stmt* stmt) -> PicInfo* { // nullptr if the picture row does not exist
+        size_t pos = positions[int64_to_uint64(sqlite3_column_int64(stmt, 0))];
+        return found[pos] ? &infos[pos] : nullptr;
+    };
+
+    // query main picture info
+    batchSelect("SELECT id, width, height, size, file_type, edit_time, download_time, feature_hash, restrict_type, ai_type "
+                "FROM pictures WHERE id IN (",
+                ")",
+                "?",
+                uniqueIds.size(),
+                bindId,
+                [&](sqlite3_stmt* stmt) {
+                    uint64_t id = int64_to_uint64(sqlite3_column_int64(stmt, 0));
+                    size_t pos = positions[id];
+                    PicInfo& info = infos[pos];
+                    found[pos] = true;
+                    info.id = id;
+                    info.width = sqlite3_column_int(stmt, 1);
+                    info.height = sqlite3_column_int(stmt, 2);
+                    info.size = sqlite3_column_int(stmt, 3);
+                    info.fileType = static_cast<ImageFormat>(sqlite3_column_int(stmt, 4));
+                    info.editTime = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5)));
+                    info.downloadTime = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6)));
+                    const void* featureHashBlob = sqlite3_column_blob(stmt, 7);
+                    int featureHashSize = sqlite3_column_bytes(stmt, 7);
+                    if (featureHashBlob && featureHashSize == sizeof(info.featureHash)) {
+                        std::memcpy(info.featureHash.data(), featureHashBlob, sizeof(info.featureHash));
+                    } else {
+                        info.featureHash.fill(0);
+                    }
+                    info.restrictType = static_cast<RestrictType>(sqlite3_column_int(stmt, 8));
+                    info.aiType = static_cast<AIType>(sqlite3_column_int(stmt, 9));
+                });
 
     // query file paths
-    stmt = prepare("SELECT file_path FROM picture_file_paths WHERE id = ?");
-    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(id));
-    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
-        info.filePaths.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0)));
-    }
+    batchSelect("SELECT id, file_path FROM picture_file_paths WHERE id IN (",
+                ")",
+                "?",
+                uniqueIds.size(),
+                bindId,
+                [&](sqlite3_stmt* stmt) {
+                    if (PicInfo* info = findInfo(stmt)) {
+                        info->filePaths.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+                    }
+                });
 
     // query tags
-    stmt = prepare("SELECT tag_id, probability FROM picture_tags WHERE id = ?");
-    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(id));
-    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
-        PicTag picTag{};
-        picTag.tagId = sqlite3_column_int(stmt.get(), 0);
-        picTag.probability = static_cast<float>(sqlite3_column_double(stmt.get(), 1));
-        info.tags.push_back(picTag);
-    }
+    batchSelect("SELECT id, tag_id, probability FROM picture_tags WHERE id IN (",
+                ")",
+                "?",
+                uniqueIds.size(),
+                bindId,
+                [&](sqlite3_stmt* stmt) {
+                    if (PicInfo* info = findInfo(stmt)) {
+                        PicTag picTag{};
+                        picTag.tagId = sqlite3_column_int(stmt, 1);
+                        picTag.probability = static_cast<float>(sqlite3_column_double(stmt, 2));
+                        info->tags.push_back(picTag);
+                    }
+                });
 
     // query source identifiers
-    stmt = prepare("SELECT platform, platform_id, image_index FROM picture_source WHERE id = ?");
-    sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(id));
-    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
-        ImageSource identifier;
-        identifier.platform = static_cast<PlatformType>(sqlite3_column_int(stmt.get(), 0));
-        identifier.platformID = sqlite3_column_int64(stmt.get(), 1);
-        identifier.imageIndex = sqlite3_column_int(stmt.get(), 2);
-        info.sourceIdentifiers.push_back(identifier);
-    }
-
-    return info;
+    batchSelect("SELECT id, platform, platform_id, image_index FROM picture_source WHERE id IN (",
+                ")",
+                "?",
+                uniqueIds.size(),
+                bindId,
+                [&](sqlite3_stmt* stmt) {
+                    if (PicInfo* info = findInfo(stmt)) {
+                        ImageSource identifier;
+                        identifier.platform = static_cast<PlatformType>(sqlite3_column_int(stmt, 1));
+                        identifier.platformID = sqlite3_column_int64(stmt, 2);
+                        identifier.imageIndex = sqlite3_column_int(stmt, 3);
+                        info->sourceIdentifiers.push_back(identifier);
+                    }
+                });
+
+    // fill duplicated ids from their first occurrence
+    for (size_t i = 0; i < ids.size(); i++) {
+        size_t first = positions[ids[i]];
+        if (first != i) infos[i] = infos[first];
+    }
+    return infos;
 }
 std::vector<uint64_t> PicDatabase::getMetadataPicIds(const PlatformID& platformId) const {
     std::vector<uint64_t> picIds;
-    SQLiteStatement stmt;
+    CachedStatement stmt;
 
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::SelectMetadataPicIds, R"(
             SELECT ps.id
             FROM picture_source ps
             WHERE ps.platform = ? AND ps.platform_id = ?
@@ -657,64 +1067,81 @@ std::vector<uint64_t> PicDatabase::getMetadataPicIds(const PlatformID& platformI
     return picIds;
 }
 std::vector<PicInfo> PicDatabase::getMetadataPicInfos(const PlatformID& platformId) const {
-    std::vector<uint64_t> picIds = getMetadataPicIds(platformId);
-    std::vector<PicInfo> picInfos;
-
-    for (uint64_t picId : picIds) {
-        PicInfo picInfo = getPicInfo(picId);
-        picInfos.push_back(picInfo);
-    }
-
-    return picInfos;
+    return getPicInfos(getMetadataPicIds(platformId));
 }
-Metadata PicDatabase::getMetadata(PlatformType platform, int64_t platformID) const {
-    Metadata info{};
-    SQLiteStatement stmt;
+std::vector<Metadata> PicDatabase::getMetadatas(const std::vector<PlatformID>& platformIDs) const {
+    std::vector<Metadata> infos(platformIDs.size());
+    std::vector<PlatformID> uniqueIds;
+    std::unordered_map<PlatformID, size_t> positions; // platform id -> first position in platformIDs
+    uniqueIds.reserve(platformIDs.size());
+    positions.reserve(platformIDs.size());
+    for (size_t i = 0; i < platformIDs.size(); i++) {
+        if (positions.emplace(platformIDs[i], i).second) uniqueIds.push_back(platformIDs[i]);
+    }
+    auto bindId = [&uniqueIds](sqlite3_stmt* stmt, int param, size_t keyIdx) {
+        sqlite3_bind_int(stmt, param, static_cast<int>(uniqueIds[keyIdx].platform));
+        sqlite3_bind_int64(stmt, param + 1, uniqueIds[keyIdx].platformID);
+    };
+    auto rowPosition = [&positions](sqlite3_stmt* stmt) {
+        PlatformID platformID{};
+        platformID.platform = static_cast<PlatformType>(sqlite3_column_int(stmt, 0));
+        platformID.platformID = sqlite3_column_int64(stmt, 1);
+        return positions[platformID];
+    };
+    std::vector<bool> found(platformIDs.size(), false);
 
     // query main metadata
-    stmt = prepare(R"(
-        SELECT date, author_id, author_name, author_nick, author_description,
+    batchSelect(R"(
+        SELECT platform, platform_id, date, author_id, author_name, author_nick, author_description,
                title, description, view_count, like_count, bookmark_count,
                reply_count, forward_count, quote_count, restrict_type, ai_type
         FROM picture_metadata
-        WHERE platform = ? AND platform_id = ?
-        )");
-    sqlite3_bind_int(stmt.get(), 1, static_cast<int>(platform));
-    sqlite3_bind_int64(stmt.get(), 2, platformID);
-    if (sqlite3_step(stmt.get()) == SQLITE_ROW) {
-        info.platformType = platform;
-        info.id = platformID;
-        info.date = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
-        info.authorID = sqlite3_column_int64(stmt.get(), 1);
-        info.authorName = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 2));
-        info.authorNick = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 3));
-        info.authorDescription = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 4));
-        info.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 5));
-        info.description = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 6));
-        info.viewCount = sqlite3_column_int(stmt.get(), 7);
-        info.likeCount = sqlite3_column_int(stmt.get(), 8);
-        info.bookmarkCount = sqlite3_column_int(stmt.get(), 9);
-        info.replyCount = sqlite3_column_int(stmt.get(), 10);
-        info.forwardCount = sqlite3_column_int(stmt.get(), 11);
-        info.quoteCount = sqlite3_column_int(stmt.get(), 12);
-        info.restrictType = static_cast<RestrictType>(sqlite3_column_int(stmt.get(), 13));
-        info.aiType = static_cast<AIType>(sqlite3_column_int(stmt.get(), 14));
-    } else {
-        return info;
-    }
+        WHERE (platform, platform_id) IN (SELECT column1, column2 FROM (VALUES )",
+                "))",
+                "(?, ?)",
+                uniqueIds.size(),
+                bindId,
+                [&](sqlite3_stmt* stmt) {
+                    size_t pos = rowPosition(stmt);
+                    Metadata& info = infos[pos];
+                    found[pos] = true;
+                    info.platformType = platformIDs[pos].platform;
+                    info.id = platformIDs[pos].platformID;
+                    info.date = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+                    info.authorID = sqlite3_column_int64(stmt, 3);
+                    info.authorName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+                    info.authorNick = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 5));
+                    info.authorDescription = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 6));
+                    info.title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
+                    info.description = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 8));
+                    info.viewCount = sqlite3_column_int(stmt, 9);
+                    info.likeCount = sqlite3_column_int(stmt, 10);
+                    info.bookmarkCount = sqlite3_column_int(stmt, 11);
+                    info.replyCount = sqlite3_column_int(stmt, 12);
+                    info.forwardCount = sqlite3_column_int(stmt, 13);
+                    info.quoteCount = sqlite3_column_int(stmt, 14);
+                    info.restrictType = static_cast<RestrictType>(sqlite3_column_int(stmt, 15));
+                    info.aiType = static_cast<AIType>(sqlite3_column_int(stmt, 16));
+                });
 
     // query tags
-    stmt = prepare(R"(
-        SELECT tag_id FROM picture_metadata_tags WHERE platform = ? AND platform_id = ?
-        )");
-    sqlite3_bind_int(stmt.get(), 1, static_cast<int>(platform));
-    sqlite3_bind_int64(stmt.get(), 2, platformID);
-    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
-        auto tagId = static_cast<uint32_t>(sqlite3_column_int(stmt.get(), 0));
-        info.tagIds.push_back(tagId);
-    }
-
-    return info;
+    batchSelect("SELECT platform, platform_id, tag_id FROM picture_metadata_tags "
+                "WHERE (platform, platform_id) IN (SELECT column1, column2 FROM (VALUES ",
+                "))",
+                "(?, ?)",
+                uniqueIds.size(),
+                bindId,
+                [&](sqlite3_stmt* stmt) {
+                    size_t pos = rowPosition(stmt);
+                    if (found[pos]) infos[pos].tagIds.push_back(static_cast<uint32_t>(sqlite3_column_int(stmt, 2)));
+                });
+
+    // fill duplicated ids from their first occurrence
+    for (size_t i = 0; i < platformIDs.size(); i++) {
+        size_t first = positions[platformIDs[i]];
+        if (first != i) infos[i] = infos[first];
+    }
+    return infos;
 }
 
 // import functions
@@ -765,8 +1192,10 @@ void PicDatabase::importFilesFromDirectory(const std::filesystem::path& director
         auto batch_end = std::min(i + BATCH_SIZE, files.size());
         auto start_time = std::chrono::high_resolution_clock::now();
         for (size_t j = i; j < batch_end; j++) {
+            FileStat fileStat;
+            statFile(files[j], fileStat);
             processAndImportSingleFile(files[j], parserType);
-            addImportedFile(files[j]);
+            addImportedFile(files[j], fileStat);
             processed++;
         }
         if (!commitTransaction()) {
@@ -786,68 +1215,83 @@ void PicDatabase::importFilesFromDirectory(const std::filesystem::path& director
         //        << eta_seconds << "s";
     }
     syncMetadataAndPicTables();
-    updatePlatformTagCounts();
     enableForeignKeyRestriction();
     // Info() << "Import completed. Total files processed:" << processed;
 }
 void PicDatabase::syncMetadataAndPicTables(std::unordered_set<PlatformID> newMetadataIds) const { // post-import operations
-    SQLiteStatement stmt;
-    // sync restrict_type and ai_type in pictures table
+    // sync restrict_type, ai_type and edit_time in pictures table
     if (newMetadataIds.empty()) {
         newMetadataIds = this->newMetadataIds;
     }
+    if (newMetadataIds.empty()) {
+        enableForeignKeyRestriction();
+        return;
+    }
+
+    // stage the affected metadata ids, then update all their pictures with a single join
+    bool staged = execute(R"(
+        CREATE TEMP TABLE IF NOT EXISTS sync_metadata_ids (
+            platform INTEGER NOT NULL,
+            platform_id INTEGER NOT NULL,
+            PRIMARY KEY (platform, platform_id)
+        ) WITHOUT ROWID
+    )") && execute("DELETE FROM temp.sync_metadata_ids");
+    if (!staged) {
+        Warn() << "Failed to stage metadata ids for sync:" << sqlite3_errmsg(db);
+        enableForeignKeyRestriction();
+        return;
+    }
     for (const auto& metadataId : newMetadataIds) {
-        stmt = prepare(R"(
-            UPDATE pictures
-            SET restrict_type = CASE
-                WHEN restrict_type IS NULL OR restrict_type < (
-                    SELECT restrict_type FROM picture_metadata WHERE platform = ? AND platform_id = ?
-                )
-                THEN (SELECT restrict_type FROM picture_metadata WHERE platform = ? AND platform_id = ?)
-                ELSE restrict_type
-            END,
-            ai_type = CASE
-                WHEN ai_type IS NULL OR ai_type < (
-                    SELECT ai_type FROM picture_metadata WHERE platform = ? AND platform_id = ?
-                )
-                THEN (SELECT ai_type FROM picture_metadata WHERE platform = ? AND platform_id = ?)
-                ELSE ai_type
-            END,
-            edit_time = (SELECT date FROM picture_metadata WHERE platform = ? AND platform_id = ?)
-            WHERE id IN (
-                SELECT id FROM picture_source WHERE platform = ? AND platform_id = ?
-            )
+        CachedStatement stmt = prepareCached(StatementId::StageSyncMetadataId, R"(
+            INSERT OR IGNORE INTO temp.sync_metadata_ids(platform, platform_id) VALUES (?, ?)
         )");
         sqlite3_bind_int(stmt.get(), 1, static_cast<int>(metadataId.platform));
         sqlite3_bind_int64(stmt.get(), 2, metadataId.platformID);
-        sqlite3_bind_int(stmt.get(), 3, static_cast<int>(metadataId.platform));
-        sqlite3_bind_int64(stmt.get(), 4, metadataId.platformID);
-        sqlite3_bind_int(stmt.get(), 5, static_cast<int>(metadataId.platform));
-        sqlite3_bind_int64(stmt.get(), 6, metadataId.platformID);
-        sqlite3_bind_int(stmt.get(), 7, static_cast<int>(metadataId.platform));
-        sqlite3_bind_int64(stmt.get(), 8, metadataId.platformID);
-        sqlite3_bind_int(stmt.get(), 9, static_cast<int>(metadataId.platform));
-        sqlite3_bind_int64(stmt.get(), 10, metadataId.platformID);
-        sqlite3_bind_int(stmt.get(), 11, static_cast<int>(metadataId.platform));
-        sqlite3_bind_int64(stmt.get(), 12, metadataId.platformID);
         if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
-            Warn() << "Failed to sync restrict_type and ai_type for platform:" << static_cast<int>(metadataId.platform)
+            Warn() << "Failed to stage metadata id for platform:" << static_cast<int>(metadataId.platform)
                    << "platform_id:" << metadataId.platformID << "Error:" << sqlite3_errmsg(db);
         }
     }
+    // restrict_type and ai_type only grow, a picture with several new sources takes the highest of them
+    if (!execute(R"(
+        UPDATE pictures
+        SET restrict_type = CASE
+                WHEN pictures.restrict_type IS NULL OR pictures.restrict_type < src.restrict_type
+                THEN src.restrict_type
+                ELSE pictures.restrict_type
+            END,
+            ai_type = CASE
+                WHEN pictures.ai_type IS NULL OR pictures.ai_type < src.ai_type
+                THEN src.ai_type
+                ELSE pictures.ai_type
+            END,
+            edit_time = src.date
+        FROM (
+            SELECT ps.id AS id, MAX(pm.restrict_type) AS restrict_type, MAX(pm.ai_type) AS ai_type, MAX(pm.date) AS date
+            FROM temp.sync_metadata_ids s
+            JOIN picture_source ps ON ps.platform = s.platform AND ps.platform_id = s.platform_id
+            JOIN picture_metadata pm ON pm.platform = s.platform AND pm.platform_id = s.platform_id
+            GROUP BY ps.id
+        ) AS src
+        WHERE pictures.id = src.id
+    )")) {
+        Warn() << "Failed to sync restrict_type and ai_type:" << sqlite3_errmsg(db);
+    }
+    execute("DELETE FROM temp.sync_metadata_ids");
     enableForeignKeyRestriction();
 }
-void PicDatabase::addImportedFile(const std::filesystem::path& filePath) const {
-    if (isFileImported(filePath)) return;
+void PicDatabase::addImportedFile(const std::filesystem::path& filePath, const FileStat& fileStat) const {
+    FileStat importedStat;
+    if (findImportedFile(filePath, importedStat) && importedStat == fileStat) return;
 
-    cache.addImportedFile(filePath);
+    cache.addImportedFile(filePath, fileStat);
 
-    SQLiteStatement stmt;
+    CachedStatement stmt;
     std::string dir = filePath.parent_path().string();
     std::string filename = filePath.filename().string();
 
     // Step 1: Insert or ignore the directory
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::InsertImportedDirectory, R"(
         INSERT INTO imported_directories (dir_path)
         VALUES (?)
         ON CONFLICT(dir_path) DO NOTHING
@@ -861,7 +1305,7 @@ void PicDatabase::addImportedFile(const std::filesystem::path& filePath) const {
 
     // Step 2: Get the dir_id
     int64_t dirId = -1;
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::SelectImportedDirectoryId, R"(
         SELECT dir_id FROM imported_directories WHERE dir_path = ?
     )");
     sqlite3_bind_text(stmt.get(), 1, dir.c_str(), -1, SQLITE_TRANSIENT);
@@ -872,20 +1316,30 @@ void PicDatabase::addImportedFile(const std::filesystem::path& filePath) const {
         return;
     }
 
-    // Step 3: Insert the file
-    stmt = prepare(R"(
-        INSERT INTO imported_files (dir_id, filename)
-        VALUES (?, ?)
-        ON CONFLICT(dir_id, filename) DO NOTHING
+    // Step 3: Insert the file or update its stat
+    stmt = prepareCached(StatementId::InsertImportedFile, R"(
+        INSERT INTO imported_files (dir_id, filename, file_size, mtime, inode)
+        VALUES (?, ?, ?, ?, ?)
+        ON CONFLICT(dir_id, filename) DO UPDATE SET
+            file_size = excluded.file_size, mtime = excluded.mtime, inode = excluded.inode
     )");
     sqlite3_bind_int64(stmt.get(), 1, dirId);
     sqlite3_bind_text(stmt.get(), 2, filename.c_str(), -1, SQLITE_TRANSIENT);
+    if (fileStat.known()) {
+        sqlite3_bind_int64(stmt.get(), 3, fileStat.size);
+        sqlite3_bind_int64(stmt.get(), 4, fileStat.mtime);
+        sqlite3_bind_int64(stmt.get(), 5, uint64_to_int64(fileStat.inode));
+    } else {
+        sqlite3_bind_null(stmt.get(), 3);
+        sqlite3_bind_null(stmt.get(), 4);
+        sqlite3_bind_null(stmt.get(), 5);
+    }
     if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
         Error() << "Failed to insert imported file: " << sqlite3_errmsg(db);
     }
 }
-void PicDatabase::updatePlatformTagCounts() const {
-    SQLiteStatement stmt;
+void PicDatabase::rebuildPlatformTagCounts() const {
+    platformTagCountDeltas.clear(); // the recount already includes uncommitted rows
     if (!execute(R"(
         UPDATE platform_tags SET count = (
             SELECT COUNT(*) FROM picture_metadata_tags WHERE tag_id = platform_tags.tag_id
@@ -894,8 +1348,8 @@ void PicDatabase::updatePlatformTagCounts() const {
         Warn() << "Failed to count platform tags:" << sqlite3_errmsg(db);
     }
 }
-void PicDatabase::updateTagCounts() const {
-    SQLiteStatement stmt;
+void PicDatabase::rebuildTagCounts() const {
+    tagCountDeltas.clear(); // the recount already includes uncommitted rows
     if (!execute(R"(
         UPDATE tags SET count = (
             SELECT COUNT(*) FROM picture_tags WHERE tag_id = tags.tag_id
@@ -904,9 +1358,189 @@ void PicDatabase::updateTagCounts() const {
         Warn() << "Failed to count tags:" << sqlite3_errmsg(db);
     }
 }
+bool PicDatabase::applyTagCountDeltas() const {
+    return applyCountDeltas("tags", tagCountDeltas) && applyCountDeltas("platform_tags", platformTagCountDeltas);
+}
+bool PicDatabase::applyCountDeltas(const std::string& table, std::unordered_map<uint32_t, int64_t>& deltas) const {
+    std::vector<std::pair<uint32_t, int64_t>> changes;
+    for (const auto& [tagId, delta] : deltas) {
+        if (delta != 0) changes.emplace_back(tagId, delta);
+    }
+    deltas.clear();
+    for (size_t begin = 0; begin < changes.size(); begin += BATCH_QUERY_SIZE) {
+        size_t chunkSize = std::min(BATCH_QUERY_SIZE, changes.size() - begin);
+        std::string sql = "UPDATE " + table + " SET count = count + delta.column2 FROM (VALUES ";
+        for (size_t i = 0; i < chunkSize; i++) {
+            if (i) sql += ", ";
+            sql += "(?, ?)";
+        }
+        sql += ") AS delta WHERE " + table + ".tag_id = delta.column1";
+        SQLiteStatement stmt = prepare(sql);
+        if (!stmt.get()) return false;
+        for (size_t i = 0; i < chunkSize; i++) {
+            sqlite3_bind_int(stmt.get(), static_cast<int>(i) * 2 + 1, changes[begin + i].first);
+            sqlite3_bind_int64(stmt.get(), static_cast<int>(i) * 2 + 2, changes[begin + i].second);
+        }
+        if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+            Error() << "Failed to update" << table << "counts:" << sqlite3_errmsg(db);
+            return false;
+        }
+    }
+    return true;
+}
 
 // Search functions
 
+static RoaringBitmap bitmapSearch(const std::vector<RoaringBitmap>& bitmaps,
+                                  const std::unordered_set<uint32_t>& includedTagIds,
+                                  const std::unordered_set<uint32_t>& excludedTagIds) {
+    RoaringBitmap result;
+    if (includedTagIds.empty()) return result;
+
+    // start from the rarest tag to keep intermediate results small
+    std::vector<const RoaringBitmap*> included;
+    for (const auto& tagId : includedTagIds) {
+        if (tagId >= bitmaps.size()) return result; // unknown tag, nothing can match
+        included.push_back(&bitmaps[tagId]);
+    }
+    std::sort(included.begin(), included.end(), [](const RoaringBitmap* a, const RoaringBitmap* b) {
+        return a->cardinality() < b->cardinality();
+    });
+    result = *included.front();
+    for (size_t i = 1; i < included.size() && !result.empty(); i++) {
+        result &= *included[i];
+    }
+    for (const auto& tagId : excludedTagIds) {
+        if (result.empty()) break;
+        if (tagId < bitmaps.size()) result -= bitmaps[tagId];
+    }
+    return result;
+}
+RoaringBitmap TagIndex::search(const std::unordered_set<uint32_t>& includedTagIds,
+                               const std::unordered_set<uint32_t>& excludedTagIds) const {
+    return bitmapSearch(tagBitmaps, includedTagIds, excludedTagIds);
+}
+RoaringBitmap TagIndex::platformTagSearch(const std::unordered_set<uint32_t>& includedTagIds,
+                                          const std::unordered_set<uint32_t>& excludedTagIds) const {
+    return bitmapSearch(platformTagBitmaps, includedTagIds, excludedTagIds);
+}
+std::vector<uint32_t> TagIndex::toMetadataOrdinals(const std::vector<PlatformID>& platformIds) const {
+    std::vector<uint32_t> ordinals;
+    ordinals.reserve(platformIds.size());
+    for (const auto& platformID : platformIds) {
+        auto it = metadataOrdinals.find(platformID);
+        if (it != metadataOrdinals.end()) ordinals.push_back(it->second);
+    }
+    return ordinals;
+}
+RoaringBitmap TagIndex::metadataToPics(const RoaringBitmap& metadataOrdinals) const {
+    std::vector<uint32_t> picOrdinals;
+    metadataOrdinals.forEach([&](uint32_t ordinal) {
+        picOrdinals.insert(picOrdinals.end(),
+                           metadataPics.begin() + metadataPicOffsets[ordinal],
+                           metadataPics.begin() + metadataPicOffsets[ordinal + 1]);
+    });
+    return RoaringBitmap::fromValues(std::move(picOrdinals));
+}
+RoaringBitmap TagIndex::picsToMetadata(const RoaringBitmap& picOrdinals) const {
+    std::vector<uint32_t> metadataOrdinals;
+    picOrdinals.forEach([&](uint32_t ordinal) {
+        metadataOrdinals.insert(metadataOrdinals.end(),
+                                picMetadata.begin() + picMetadataOffsets[ordinal],
+                                picMetadata.begin() + picMetadataOffsets[ordinal + 1]);
+    });
+    return RoaringBitmap::fromValues(std::move(metadataOrdinals));
+}
+static std::vector<TagFacet> bitmapFacets(const std::vector<RoaringBitmap>& bitmaps,
+                                          const std::vector<uint32_t>& tagsByCardinality,
+                                          const RoaringBitmap& ordinals,
+                                          size_t limit,
+                                          uint64_t scaleNumerator,
+                                          uint64_t scaleDenominator) {
+    // min-heap of the best tags so far, a tag can not be counted more often than its global cardinality,
+    // so once the heap is full and its weakest count reaches the next tag's cardinality no later tag can enter
+    auto weaker = [](const TagFacet& a, const TagFacet& b) { return a.count > b.count; };
+    std::vector<TagFacet> facets;
+    for (uint32_t tagId : tagsByCardinality) {
+        uint64_t cardinality = bitmaps[tagId].cardinality();
+        if (limit != 0 && facets.size() == limit && facets.front().count >= cardinality) break;
+        uint64_t count = bitmaps[tagId].andCardinality(ordinals);
+        if (count == 0) continue;
+        count = std::min(cardinality, count * scaleNumerator / scaleDenominator);
+        if (limit != 0 && facets.size() == limit) {
+            if (count <= facets.front().count) continue;
+            std::pop_heap(facets.begin(), facets.end(), weaker);
+            facets.pop_back();
+        }
+        facets.push_back(TagFacet{tagId, static_cast<uint32_t>(count)});
+        std::push_heap(facets.begin(), facets.end(), weaker);
+    }
+    std::sort(facets.begin(), facets.end(), [](const TagFacet& a, const TagFacet& b) {
+        return a.count != b.count ? a.count > b.count : a.tagId < b.tagId;
+    });
+    return facets;
+}
+std::vector<TagFacet> TagIndex::tagFacets(const RoaringBitmap& picOrdinals, size_t limit, bool approximate) const {
+    // picture ordinals follow the hash based picture ids, so every few containers make an unbiased sample
+    uint64_t cardinality = picOrdinals.cardinality();
+    if (approximate && cardinality > FACET_SAMPLE_SIZE * 2) {
+        RoaringBitmap sample = picOrdinals.sample(static_cast<size_t>(cardinality / FACET_SAMPLE_SIZE));
+        uint64_t sampleCardinality = sample.cardinality();
+        if (sampleCardinality > 0) {
+            return bitmapFacets(tagBitmaps, tagsByCardinality, sample, limit, cardinality, sampleCardinality);
+        }
+    }
+    return bitmapFacets(tagBitmaps, tagsByCardinality, picOrdinals, limit, 1, 1);
+}
+std::vector<TagFacet> TagIndex::platformTagFacets(const RoaringBitmap& metadataOrdinals, size_t limit) const {
+    return bitmapFacets(platformTagBitmaps, platformTagsByCardinality, metadataOrdinals, limit, 1, 1);
+}
+std::vector<uint64_t> TagIndex::getMetadataPicIds(uint32_t metadataOrdinal) const {
+    std::vector<uint64_t> ids;
+    ids.reserve(metadataPicOffsets[metadataOrdinal + 1] - metadataPicOffsets[metadataOrdinal]);
+    for (uint32_t i = metadataPicOffsets[metadataOrdinal]; i < metadataPicOffsets[metadataOrdinal + 1]; i++) {
+        ids.push_back(picIds[metadataPics[i]]);
+    }
+    return ids;
+}
+std::shared_ptr<const TagIndex> PicDatabase::getTagIndex() const {
+    if (auto index = cache.getTagIndex()) return index;
+    uint64_t generation = cache.getGeneration(); // a commit during the build makes the index stale before it is cached
+    bool snapshot = sqlite3_get_autocommit(db) && execute("BEGIN;"); // read every table from the same snapshot
+    auto index = initTagIndex();
+    if (snapshot) execute("COMMIT;");
+    if (index && cache.getGeneration() == generation) cache.loadTagIndex(index);
+    return index;
+}
+std::shared_ptr<const FeatureHashIndex> PicDatabase::getFeatureHashIndex() const {
+    if (auto index = cache.getFeatureHashIndex()) return index;
+    uint64_t generation = cache.getGeneration();
+    auto index = initFeatureHashIndex();
+    if (index && cache.getGeneration() == generation) cache.loadFeatureHashIndex(index);
+    return index;
+}
+std::vector<SimilarPic> PicDatabase::findSimilarPics(uint64_t picId, size_t count) const {
+    auto index = getFeatureHashIndex();
+    if (!index) return {};
+    const uint64_t* queryHash = index->getHash(picId);
+    if (!queryHash) return {}; // picture is not tagged yet
+    return index->nearest(queryHash, count, picId);
+}
+std::vector<SimilarPic> PicDatabase::findNearDuplicates(uint64_t picId, uint32_t radius) const {
+    auto index = getFeatureHashIndex();
+    if (!index) return {};
+    const uint64_t* queryHash = index->getHash(picId);
+    if (!queryHash) return {};
+    return index->withinRadius(queryHash, radius, picId);
+}
+std::vector<std::vector<uint64_t>> PicDatabase::clusterNearDuplicates(uint32_t radius,
+                                                                      ProgressCallback progressCallback) const {
+    auto index = getFeatureHashIndex();
+    if (!index) return {};
+    auto clusters = index->clusterNearDuplicates(radius, progressCallback);
+    Info() << "Near-duplicate clustering finished. Radius:" << radius << "Clusters:" << clusters.size();
+    return clusters;
+}
 std::unordered_set<uint64_t> PicDatabase::tagSearch(const std::unordered_set<uint32_t>& includedTagIds,
                                                     const std::unordered_set<uint32_t>& excludedTagIds) const {
     std::unordered_set<uint64_t> results;
@@ -987,16 +1621,17 @@ std::unordered_set<PlatformID> PicDatabase::platformTagSearch(const std::unorder
     }
     return results;
 }
-std::unordered_set<PlatformID>
-PicDatabase::textSearch(const std::string& searchText, PlatformType platformType, SearchField searchField) const {
-    std::unordered_set<PlatformID> results;
+std::vector<PlatformID>
+PicDatabase::rankedTextSearch(const std::string& searchText, PlatformType platformType, SearchField searchField) const {
+    std::vector<PlatformID> results;
     if (searchText.empty() || searchField == SearchField::None) return results;
     SQLiteStatement stmt;
     bool isNumeric =
         !searchText.empty() && std::all_of(searchText.begin(), searchText.end(), [](char c) { return std::isdigit(c); });
+    size_t charCount = std::count_if(searchText.begin(), searchText.end(), [](char c) { return (c & 0xC0) != 0x80; });
 
     std::string searchFieldStr;
-    std::string likePattern;
+    std::string pattern;
     switch (searchField) {
     case SearchField::PlatformID:
         searchFieldStr = "platform_id";
@@ -1013,18 +1648,23 @@ PicDatabase::textSearch(const std::string& searchText, PlatformType platformType
     case SearchField::Title:
         searchFieldStr = "title";
         break;
+    case SearchField::Description:
+        searchFieldStr = "description";
+        break;
     default:
         return results;
     }
+    std::string platformFilter;
+    if (platformType != PlatformType::Unknown) {
+        platformFilter = " AND m.platform = " + std::to_string(static_cast<int>(platformType));
+    }
 
     switch (searchField) {
     case SearchField::PlatformID:
     case SearchField::AuthorID:
         if (isNumeric) {
-            if (platformType != PlatformType::Unknown) {
-                searchFieldStr = "platform = " + std::to_string(static_cast<int>(platformType)) + " AND " + searchFieldStr;
-            }
-            stmt = prepare("SELECT platform, platform_id FROM picture_metadata WHERE " + searchFieldStr + " = ?");
+            stmt = prepare("SELECT platform, platform_id FROM picture_metadata m WHERE " + searchFieldStr + " = ?" +
+                           platformFilter);
             sqlite3_bind_int64(stmt.get(), 1, std::stoll(searchText));
         } else {
             return results;
@@ -1033,12 +1673,28 @@ PicDatabase::textSearch(const std::string& searchText, PlatformType platformType
     case SearchField::AuthorName:
     case SearchField::AuthorNick:
     case SearchField::Title:
-        if (platformType != PlatformType::Unknown) {
-            searchFieldStr = "platform = " + std::to_string(static_cast<int>(platformType)) + " AND " + searchFieldStr;
+    case SearchField::Description:
+        if (fullTextIndexAvailable && charCount >= 3) { // trigrams need at least 3 characters
+            stmt = prepare("SELECT m.platform, m.platform_id FROM picture_metadata_fts f "
+                           "JOIN picture_metadata m ON m.rowid = f.rowid WHERE picture_metadata_fts MATCH ?" +
+                           platformFilter + " ORDER BY f.rank");
+            pattern = searchFieldStr + " : \"";
+            for (char c : searchText) { // quote as a phrase, phrase matching on trigrams is a substring match
+                if (c == '"') pattern += '"';
+                pattern += c;
+            }
+            pattern += "\"";
+        } else { // substring scan, unranked
+            stmt = prepare("SELECT platform, platform_id FROM picture_metadata m WHERE " + searchFieldStr +
+                           " LIKE ? ESCAPE '\\' COLLATE NOCASE" + platformFilter);
+            pattern = "%";
+            for (char c : searchText) { // wildcards in the search text match literally
+                if (c == '%' || c == '_' || c == '\\') pattern += '\\';
+                pattern += c;
+            }
+            pattern += "%";
         }
-        stmt = prepare(" SELECT platform, platform_id FROM picture_metadata WHERE " + searchFieldStr + " LIKE ? COLLATE NOCASE");
-        likePattern = searchText + "%";
-        sqlite3_bind_text(stmt.get(), 1, likePattern.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt.get(), 1, pattern.c_str(), -1, SQLITE_TRANSIENT);
         break;
     default:
         return results;
@@ -1052,7 +1708,7 @@ PicDatabase::textSearch(const std::string& searchText, PlatformType platformType
         PlatformID platformID{};
         platformID.platform = static_cast<PlatformType>(sqlite3_column_int(stmt.get(), 0));
         platformID.platformID = sqlite3_column_int64(stmt.get(), 1);
-        results.insert(platformID);
+        results.push_back(platformID);
     }
     return results;
 }
@@ -1121,16 +1777,19 @@ void PicDatabase::importTagSet(const std::string& modelName, const std::vector<s
         Error() << "Failed to clear existing picture_tags: " << sqlite3_errmsg(db);
     }
 
+    tagIndexStale = true;
+    tagCountDeltas.clear(); // all counts restart from zero with the new tag set
+
     // insert/update tags
     for (int tagId = 0; tagId < tags.size(); tagId++) {
-        stmt = prepare(R"(
+        CachedStatement insertStmt = prepareCached(StatementId::InsertTag, R"(
             INSERT OR REPLACE INTO tags(tag_id, tag, is_character) VALUES (?, ?, ?)
         )");
         const auto& [tag, isCharacter] = tags[tagId];
-        sqlite3_bind_int(stmt.get(), 1, tagId);
-        sqlite3_bind_text(stmt.get(), 2, tag.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_int(stmt.get(), 3, isCharacter ? 1 : 0);
-        if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+        sqlite3_bind_int(insertStmt.get(), 1, tagId);
+        sqlite3_bind_text(insertStmt.get(), 2, tag.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(insertStmt.get(), 3, isCharacter ? 1 : 0);
+        if (sqlite3_step(insertStmt.get()) != SQLITE_DONE) {
             Error() << "Failed to insert/update tag: " << sqlite3_errmsg(db);
         }
     }
@@ -1166,18 +1825,22 @@ void PicDatabase::updatePicTags(uint64_t picID,
                                 const std::vector<PicTag>& picTags,
                                 RestrictType restrictType,
                                 const std::vector<uint8_t>& featureHash) const {
-    SQLiteStatement stmt;
+    CachedStatement stmt;
     // delete existing tags
-    stmt = prepare(R"(
-        DELETE FROM picture_tags WHERE id = ?
+    stmt = prepareCached(StatementId::DeletePictureTags, R"(
+        DELETE FROM picture_tags WHERE id = ? RETURNING tag_id
     )");
     sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picID));
-    if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+        tagCountDeltas[static_cast<uint32_t>(sqlite3_column_int(stmt.get(), 0))]--;
+    }
+    if (rc != SQLITE_DONE) {
         Error() << "Failed to delete existing picture_tags: " << sqlite3_errmsg(db);
     }
     // insert new tags
     for (const auto& picTag : picTags) {
-        stmt = prepare(R"(
+        stmt = prepareCached(StatementId::InsertPictureTag, R"(
             INSERT INTO picture_tags(id, tag_id, probability) VALUES (?, ?, ?)
         )");
         sqlite3_bind_int64(stmt.get(), 1, uint64_to_int64(picID));
@@ -1185,10 +1848,12 @@ void PicDatabase::updatePicTags(uint64_t picID,
         sqlite3_bind_double(stmt.get(), 3, static_cast<double>(picTag.probability));
         if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
             Error() << "Failed to insert picture_tag: " << sqlite3_errmsg(db);
+        } else {
+            tagCountDeltas[picTag.tagId]++;
         }
     }
     // update restrict_type and feature_hash in pictures table
-    stmt = prepare(R"(
+    stmt = prepareCached(StatementId::UpdatePictureTagInfo, R"(
         UPDATE pictures SET restrict_type = ?, feature_hash = ? WHERE id = ?
     )");
     sqlite3_bind_int(stmt.get(), 1, static_cast<int>(restrictType));
@@ -1197,4 +1862,6 @@ void PicDatabase::updatePicTags(uint64_t picID,
     if (sqlite3_step(stmt.get()) != SQLITE_DONE) {
         Error() << "Failed to update pictures restrict_type and feature_hash: " << sqlite3_errmsg(db);
     }
+    tagIndexStale = true;
+    featureHashIndexStale = true;
 }
@@ -17,12 +17,17 @@
  */
 
 #pragma once
+#include "feature_hash_index.h"
 #include "model.h"
 #include "parser.h"
+#include "roaring_bitmap.h"
 #include "utils/logger.h"
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <sqlite3.h>
 #include <unordered_map>
@@ -31,12 +36,32 @@
 
 using ProgressCallback = std::function<void(size_t processed, size_t total)>;
 
-enum class SearchField { None, PlatformID, AuthorID, AuthorName, AuthorNick, Title };
+enum class SearchField { None, PlatformID, AuthorID, AuthorName, AuthorNick, Title, Description };
 
 const std::string DEFAULT_DATABASE_FILE = "database.db";
 
 enum class DbMode { None, Normal, Import, Query };
 
+constexpr uint64_t FACET_SAMPLE_SIZE = 1 << 18; // approximate tag counts of larger results are taken from a sample this big
+
+struct TagFacet { // tag of a search result and how many results have it
+    uint32_t tagId;
+    uint32_t count;
+};
+
+struct FileStat { // recorded for every imported file, a rescan skips files whose stat is unchanged
+    int64_t size = -1;  // -1 for files imported before stats were recorded
+    int64_t mtime = -1; // seconds since epoch
+    uint64_t inode = 0; // 0 where stat has no inode (windows)
+    bool known() const { return size >= 0; }
+    bool operator==(const FileStat& other) const {
+        return size == other.size && mtime == other.mtime && inode == other.inode;
+    }
+    bool operator!=(const FileStat& other) const { return !(*this == other); }
+};
+
+bool statFile(const std::filesystem::path& filePath, FileStat& fileStat); // a single stat call, false if it failed
+
 class SQLiteStatement { // RAII wrapper for sqlite3_stmt
 public:
     SQLiteStatement() : stmt_(nullptr) {}
@@ -71,6 +96,74 @@ private:
     sqlite3_stmt* stmt_;
 };
 
+class CachedStatement { // statement borrowed from PicDatabase's statement cache, reset and unbound when released
+public:
+    CachedStatement() : stmt_(nullptr) {}
+    explicit CachedStatement(sqlite3_stmt* stmt) : stmt_(stmt) {}
+    ~CachedStatement() { release(); }
+    sqlite3_stmt* get() const { return stmt_; }
+
+    CachedStatement(const CachedStatement&) = delete;
+    CachedStatement& operator=(const CachedStatement&) = delete;
+    CachedStatement(CachedStatement&& other) noexcept : stmt_(other.stmt_) { other.stmt_ = nullptr; }
+    CachedStatement& operator=(CachedStatement&& other) noexcept {
+        if (this != &other) {
+            release();
+            stmt_ = other.stmt_;
+            other.stmt_ = nullptr;
+        }
+        return *this;
+    }
+
+private:
+    sqlite3_stmt* stmt_;
+
+    void release() {
+        if (stmt_) {
+            sqlite3_reset(stmt_);
+            sqlite3_clear_bindings(stmt_);
+            stmt_ = nullptr;
+        }
+    }
+};
+
+class TagIndex { // in-memory inverted index for tag and platform tag search, built from picture_tags and picture_metadata_tags
+public:
+    uint64_t getPicId(uint32_t ordinal) const { return picIds[ordinal]; }
+    size_t picCount() const { return picIds.size(); }
+    PlatformID getMetadataId(uint32_t ordinal) const { return metadataIds[ordinal]; }
+    size_t metadataCount() const { return metadataIds.size(); }
+    std::vector<uint64_t> getMetadataPicIds(uint32_t metadataOrdinal) const; // ordered by image index
+
+    RoaringBitmap search(const std::unordered_set<uint32_t>& includedTagIds,
+                         const std::unordered_set<uint32_t>& excludedTagIds) const; // returns picture ordinals
+    RoaringBitmap platformTagSearch(const std::unordered_set<uint32_t>& includedTagIds,
+                                    const std::unordered_set<uint32_t>& excludedTagIds) const; // returns metadata ordinals
+    std::vector<uint32_t> toMetadataOrdinals(const std::vector<PlatformID>& platformIds) const; // keeps order, skips unknown
+    RoaringBitmap metadataToPics(const RoaringBitmap& metadataOrdinals) const; // picture ordinals of the given posts
+    RoaringBitmap picsToMetadata(const RoaringBitmap& picOrdinals) const;      // metadata ordinals of the given pictures
+
+    // tags of the given ordinals counted with bitmap intersections, most frequent first, at most limit tags unless 0
+    std::vector<TagFacet> tagFacets(const RoaringBitmap& picOrdinals, size_t limit, bool approximate) const;
+    std::vector<TagFacet> platformTagFacets(const RoaringBitmap& metadataOrdinals, size_t limit) const;
+
+private:
+    friend class PicDatabase;
+    std::vector<uint64_t> picIds;                       // ordinal -> picture id
+    std::unordered_map<uint64_t, uint32_t> picOrdinals; // picture id -> ordinal
+    std::vector<RoaringBitmap> tagBitmaps;              // index is tag ID, bitmap of picture ordinals
+    std::vector<uint32_t> tagsByCardinality;            // tag IDs used by any picture, most frequent first
+
+    std::vector<PlatformID> metadataIds;                       // ordinal -> (platform, platform_id)
+    std::unordered_map<PlatformID, uint32_t> metadataOrdinals; // (platform, platform_id) -> ordinal
+    std::vector<RoaringBitmap> platformTagBitmaps;             // index is platform tag ID, bitmap of metadata ordinals
+    std::vector<uint32_t> platformTagsByCardinality;           // platform tag IDs used by any metadata, most frequent first
+    std::vector<uint32_t> metadataPicOffsets; // pictures of metadata i are metadataPics[offsets[i], offsets[i + 1])
+    std::vector<uint32_t> metadataPics;       // picture ordinals grouped by metadata ordinal
+    std::vector<uint32_t> picMetadataOffsets; // metadata of picture i are picMetadata[offsets[i], offsets[i + 1])
+    std::vector<uint32_t> picMetadata;        // metadata ordinals grouped by picture ordinal
+};
+
 class DbCache { // singleton class for caching database mappings
 public:
     static DbCache& getInstance() {
@@ -80,7 +173,6 @@ public:
     bool tagMappingLoaded() const {
         return !tagToId.empty() && !platformTagToId.empty() && !tags.empty() && !platformTags.empty();
     }
-    bool featureHashCacheLoaded() const { return !picFeatureHashes.empty(); }
     bool importedFileLoaded() const { return !importedFiles.empty(); }
 
     void loadTagMapping(std::unordered_map<std::string, uint32_t>&& tagToIdMap,
@@ -93,14 +185,36 @@ public:
         tags = tagList;
         platformTags = platformTagList;
     }
-    void loadPicFeatureHashes(std::vector<std::pair<uint64_t, std::array<uint8_t, 64>>>&& featureHashes) {
-        std::lock_guard<std::mutex> lock(writeMutex);
-        picFeatureHashes = featureHashes;
-    }
-    void loadImportedFiles(std::unordered_map<std::string, std::unordered_set<std::string>>&& files) {
+    void loadImportedFiles(std::unordered_map<std::string, std::unordered_map<std::string, FileStat>>&& files) {
         std::lock_guard<std::mutex> lock(writeMutex);
         importedFiles = files;
     }
+    void loadTagIndex(std::shared_ptr<const TagIndex> index) {
+        std::lock_guard<std::mutex> lock(tagIndexMutex);
+        tagIndex = std::move(index);
+    }
+    std::shared_ptr<const TagIndex> getTagIndex() const { // the returned snapshot stays valid after invalidation
+        std::lock_guard<std::mutex> lock(tagIndexMutex);
+        return tagIndex;
+    }
+    void invalidateTagIndex() {
+        std::lock_guard<std::mutex> lock(tagIndexMutex);
+        tagIndex.reset();
+    }
+    void bumpGeneration() { generation.fetch_add(1); }
+    uint64_t getGeneration() const { return generation.load(); }
+    void loadFeatureHashIndex(std::shared_ptr<const FeatureHashIndex> index) {
+        std::lock_guard<std::mutex> lock(featureHashIndexMutex);
+        featureHashIndex = std::move(index);
+    }
+    std::shared_ptr<const FeatureHashIndex> getFeatureHashIndex() const {
+        std::lock_guard<std::mutex> lock(featureHashIndexMutex);
+        return featureHashIndex;
+    }
+    void invalidateFeatureHashIndex() {
+        std::lock_guard<std::mutex> lock(featureHashIndexMutex);
+        featureHashIndex.reset();
+    }
 
     TagStr getStringTag(uint32_t tagId) const {
         if (tagId < tags.size()) {
@@ -124,16 +238,35 @@ public:
         }
         return false;
     }
-    void addImportedFile(const std::filesystem::path& filePath) {
-        if (isFileImported(filePath)) return;
+    bool findImportedFile(const std::filesystem::path& filePath, FileStat& fileStat) const {
+        auto dirIt = importedFiles.find(filePath.parent_path().string());
+        if (dirIt == importedFiles.end()) return false;
+        auto fileIt = dirIt->second.find(filePath.filename().string());
+        if (fileIt == dirIt->second.end()) return false;
+        fileStat = fileIt->second;
+        return true;
+    }
+    void addImportedFile(const std::filesystem::path& filePath, const FileStat& fileStat) {
         std::lock_guard<std::mutex> lock(writeMutex);
-
-        std::string dir = filePath.parent_path().string();
-        std::string filename = filePath.filename().string();
-        if (importedFiles.find(dir) == importedFiles.end()) {
-            importedFiles[dir] = std::unordered_set<std::string>();
+        importedFiles[filePath.parent_path().string()][filePath.filename().string()] = fileStat;
+    }
+    std::vector<std::string> getImportedFileNames(const std::filesystem::path& directory) const {
+        std::vector<std::string> fileNames;
+        auto dirIt = importedFiles.find(directory.string());
+        if (dirIt == importedFiles.end()) return fileNames;
+        fileNames.reserve(dirIt->second.size());
+        for (const auto& [fileName, fileStat] : dirIt->second) {
+            fileNames.push_back(fileName);
+        }
+        return fileNames;
+    }
+    std::vector<std::string> getImportedDirectories() const {
+        std::vector<std::string> directories;
+        directories.reserve(importedFiles.size());
+        for (const auto& [directory, files] : importedFiles) {
+            directories.push_back(directory);
         }
-        importedFiles[dir].insert(filename);
+        return directories;
     }
 
     bool platformTagExists(const PlatformTagStr& tag) const { return platformTagToId.find(tag) != platformTagToId.end(); }
@@ -173,11 +306,19 @@ private:
     std::vector<TagStr> tags;                 // index is tag ID
     std::vector<PlatformTagStr> platformTags; // index is platform tag ID
 
-    // feature hash cache for similarity search
-    std::vector<std::pair<uint64_t, std::array<uint8_t, 64>>> picFeatureHashes; // (picID, featureHash)
-
     // imported files cache
-    std::unordered_map<std::string, std::unordered_set<std::string>> importedFiles; // directory -> set of imported file names
+    std::unordered_map<std::string, std::unordered_map<std::string, FileStat>> importedFiles; // directory -> file name -> stat
+
+    // tag inverted index, rebuilt lazily after picture tags change
+    std::shared_ptr<const TagIndex> tagIndex;
+    mutable std::mutex tagIndexMutex;
+
+    // bumped by every commit, lets readers tell whether results they computed earlier are still current
+    std::atomic<uint64_t> generation{0};
+
+    // feature hashes for similarity search, rebuilt lazily after tagging
+    std::shared_ptr<const FeatureHashIndex> featureHashIndex;
+    mutable std::mutex featureHashIndexMutex;
 };
 
 class PicDatabase { // sqlite database wrapper
@@ -197,9 +338,32 @@ public:
             Error() << "Failed to disable foreign key restriction:" << sqlite3_errmsg(db);
         }
     }
-    bool beginTransaction() const { return execute("BEGIN TRANSACTION;"); }
-    bool commitTransaction() const { return execute("COMMIT;"); }
-    bool rollbackTransaction() const { return execute("ROLLBACK;"); }
+    bool beginTransaction(bool immediate = false) const { // immediate takes the write lock up front
+        transactionStartChanges = sqlite3_total_changes(db);
+        return execute(immediate ? "BEGIN IMMEDIATE TRANSACTION;" : "BEGIN TRANSACTION;");
+    }
+    bool commitTransaction() const {
+        if (!applyTagCountDeltas()) return false;
+        bool wroteRows = sqlite3_total_changes(db) != transactionStartChanges; // opening a connection commits no rows
+        if (!execute("COMMIT;")) return false;
+        if (wroteRows) cache.bumpGeneration();
+        if (tagIndexStale) { // other connections only see the changes after commit
+            cache.invalidateTagIndex();
+            tagIndexStale = false;
+        }
+        if (featureHashIndexStale) {
+            cache.invalidateFeatureHashIndex();
+            featureHashIndexStale = false;
+        }
+        return true;
+    }
+    bool rollbackTransaction() const {
+        tagIndexStale = false;
+        featureHashIndexStale = false;
+        tagCountDeltas.clear();
+        platformTagCountDeltas.clear();
+        return execute("ROLLBACK;");
+    }
     void setMode(DbMode mode) {
         if (currentMode == mode) return;
         execute("PRAGMA journal_mode = WAL");
@@ -231,13 +395,17 @@ public:
     }
 
     // getters
-    PicInfo getPicInfo(uint64_t id) const;
+    PicInfo getPicInfo(uint64_t id) const { return getPicInfos({id}).front(); }
+    std::vector<PicInfo> getPicInfos(const std::vector<uint64_t>& ids) const; // same order as ids, empty PicInfo if not found
     std::vector<uint64_t> getMetadataPicIds(const PlatformID& platformID) const;
     std::vector<PicInfo> getMetadataPicInfos(const PlatformID& platformID) const;
 
-    Metadata getMetadata(PlatformType platform, int64_t PlatformID) const;
+    Metadata getMetadata(PlatformType platform, int64_t platformID) const {
+        return getMetadatas({PlatformID{platform, platformID}}).front();
+    }
     Metadata getMetadata(const ImageSource& identifier) const { return getMetadata(identifier.platform, identifier.platformID); }
     Metadata getMetadata(const PlatformID& platformID) const { return getMetadata(platformID.platform, platformID.platformID); }
+    std::vector<Metadata> getMetadatas(const std::vector<PlatformID>& platformIDs) const; // same order, empty if not found
 
     std::vector<TagCount> getTagCounts() const; // for gui tag selection panel display
     std::vector<PlatformTagCount> getPlatformTagCounts() const;
@@ -250,12 +418,25 @@ public:
     bool updateMetadata(const ParsedMetadata& metadataInfo) const;
 
     // search functions
+    std::shared_ptr<const TagIndex> getTagIndex() const;             // build the tag index on first use, nullptr if it failed
+    uint64_t getGeneration() const { return cache.getGeneration(); } // changes after every commit that wrote rows
     std::unordered_set<uint64_t> tagSearch(const std::unordered_set<uint32_t>& includedTagIds,
-                                           const std::unordered_set<uint32_t>& excludedTagIds) const;
+                                           const std::unordered_set<uint32_t>& excludedTagIds) const; // sql fallback
     std::unordered_set<PlatformID> platformTagSearch(const std::unordered_set<uint32_t>& includedTagIds,
-                                                     const std::unordered_set<uint32_t>& excludedTagIds) const;
+                                                     const std::unordered_set<uint32_t>& excludedTagIds) const; // sql fallback
     std::unordered_set<PlatformID>
-    textSearch(const std::string& searchText, PlatformType platformType, SearchField searchField) const;
+    textSearch(const std::string& searchText, PlatformType platformType, SearchField searchField) const {
+        std::vector<PlatformID> ranked = rankedTextSearch(searchText, platformType, searchField);
+        return std::unordered_set<PlatformID>(ranked.begin(), ranked.end());
+    }
+    std::vector<PlatformID> // substring search, best match first when the full-text index is used
+    rankedTextSearch(const std::string& searchText, PlatformType platformType, SearchField searchField) const;
+    std::shared_ptr<const FeatureHashIndex> getFeatureHashIndex() const; // load feature hashes on first use
+    std::vector<SimilarPic> findSimilarPics(uint64_t picId, size_t count) const; // nearest first, excludes picId itself
+    std::vector<SimilarPic> findNearDuplicates(uint64_t picId, uint32_t radius = NEAR_DUPLICATE_RADIUS) const;
+    std::vector<std::vector<uint64_t>> clusterNearDuplicates(uint32_t radius = NEAR_DUPLICATE_RADIUS,
+                                                             ProgressCallback progressCallback = nullptr) const;
+    void interrupt() const { sqlite3_interrupt(db); } // thread safe, stops the running statement of this connection
 
     // import functions
     void importFilesFromDirectory(
@@ -265,9 +446,16 @@ public:
     void processAndImportSingleFile(const std::filesystem::path& path, ParserType parserType = ParserType::None);
     void syncMetadataAndPicTables(std::unordered_set<PlatformID> newMetadataIds = {}) const; // post-import operations
     bool isFileImported(const std::filesystem::path& filePath) const { return cache.isFileImported(filePath); }
-    void addImportedFile(const std::filesystem::path& filePath) const;
-    void updatePlatformTagCounts() const; // update platform tag counts after bulk import
-    void updateTagCounts() const;         // update tag counts after bulk import
+    bool findImportedFile(const std::filesystem::path& filePath, FileStat& fileStat) const {
+        return cache.findImportedFile(filePath, fileStat);
+    }
+    void addImportedFile(const std::filesystem::path& filePath, const FileStat& fileStat) const; // inserts or updates the stat
+    std::vector<std::string> getImportedFileNames(const std::filesystem::path& directory) const { // files directly in it
+        return cache.getImportedFileNames(directory);
+    }
+    std::vector<std::string> getImportedDirectories() const { return cache.getImportedDirectories(); }
+    void rebuildPlatformTagCounts() const; // full recount, counts are otherwise maintained incrementally at commit
+    void rebuildTagCounts() const;         // full recount, counts are otherwise maintained incrementally at commit
 
     // tagger functions
     std::string getModelName() const;
@@ -278,17 +466,65 @@ public:
                        RestrictType restrictType,
                        const std::vector<uint8_t>& featureHash) const;
 
+    // statement cache statistics
+    struct StatementCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0; // statements compiled
+    };
+    StatementCacheStats getStatementCacheStats() const { return statementCacheStats; }
+
 private:
+    enum class StatementId { // statements executed per row, compiled once per connection
+        InsertPicture,
+        InsertPictureFilePath,
+        SelectPictureFilePathId,
+        SelectPicturePathExists,
+        DeletePictureSource,
+        DeletePicture,
+        InsertPictureSource,
+        InsertMetadata,
+        UpdateMetadata,
+        InsertPlatformTag,
+        InsertMetadataTag,
+        UpdatePlatformTagTranslation,
+        SelectMetadataPicIds,
+        StageSyncMetadataId,
+        InsertImportedDirectory,
+        SelectImportedDirectoryId,
+        InsertImportedFile,
+        InsertTag,
+        DeletePictureTags,
+        InsertPictureTag,
+        UpdatePictureTagInfo,
+        Count
+    };
+
     sqlite3* db = nullptr;
     DbMode currentMode = DbMode::None;
     DbCache& cache = DbCache::getInstance();
+    mutable std::array<SQLiteStatement, static_cast<size_t>(StatementId::Count)> statementCache;
+    mutable StatementCacheStats statementCacheStats;
+
+    static constexpr size_t BATCH_QUERY_SIZE = 500; // keys bound per statement in batch getters
 
     std::unordered_set<PlatformID> newMetadataIds; // for syncMetadataAndPicTables use
+    bool fullTextIndexAvailable = false;
+    mutable bool tagIndexStale = false;            // indexed tables changed in current transaction
+    mutable bool featureHashIndexStale = false;    // feature hashes changed in current transaction
+    mutable int transactionStartChanges = 0;       // sqlite3_total_changes when the current transaction began
+    mutable std::unordered_map<uint32_t, int64_t> tagCountDeltas;         // tag ID -> count change in current transaction
+    mutable std::unordered_map<uint32_t, int64_t> platformTagCountDeltas; // platform tag ID -> count change
 
     void initDatabase(const std::string& databaseFile);
     bool createTables() const;
+    bool initFullTextIndex() const; // returns false if fts5 is not available
     void initTagMapping() const;
     void initImportedFiles() const;
+    std::shared_ptr<const TagIndex> initTagIndex() const; // nullptr if reading the tables failed
+    std::shared_ptr<const FeatureHashIndex> initFeatureHashIndex() const;
+    bool applyTagCountDeltas() const; // write pending count changes, called before commit
+    void deletePathlessPicture(uint64_t picID) const; // the last path of a modified file moved to its new content
+    bool applyCountDeltas(const std::string& table, std::unordered_map<uint32_t, int64_t>& deltas) const;
 
     bool execute(const std::string& sql) const {
         char* errorMsg = nullptr;
@@ -301,4 +537,12 @@ private:
         return true;
     }
     SQLiteStatement prepare(const std::string& sql) const { return SQLiteStatement(db, sql); }
+    CachedStatement prepareCached(StatementId id, const char* sql) const; // compile on first use, then reuse
+    template <typename BindFunc, typename RowFunc> // runs sqlPrefix + "keyPlaceholder, ..." + sqlSuffix over keys in chunks
+    void batchSelect(const std::string& sqlPrefix,
+                     const std::string& sqlSuffix,
+                     const std::string& keyPlaceholder,
+                     size_t keyCount,
+                     BindFunc bindKey,
+                     RowFunc onRow) const;
 };
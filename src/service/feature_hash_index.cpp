@@ -0,0 +1,325 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "feature_hash_index.h"
+#include "roaring_bitmap.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <numeric>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define HAMMING_X86_KERNELS
+#include <immintrin.h>
+#ifdef _MSC_VER // msvc emits any intrinsic regardless of /arch, kernels are only called after the cpu check
+#define TARGET_AVX2
+#define TARGET_AVX512
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512vpopcntdq")))
+#endif
+#endif
+
+// distance kernels, hashes are 64-byte aligned and FEATURE_HASH_WORDS words each
+
+static void distancesScalar(const uint64_t* hashes, size_t count, const uint64_t* query, uint16_t* distances) {
+    for (size_t i = 0; i < count; i++) {
+        const uint64_t* hash = hashes + i * FEATURE_HASH_WORDS;
+        int distance = 0;
+        for (size_t word = 0; word < FEATURE_HASH_WORDS; word++) {
+            distance += popcount64(hash[word] ^ query[word]);
+        }
+        distances[i] = static_cast<uint16_t>(distance);
+    }
+}
+
+#ifdef HAMMING_X86_KERNELS
+TARGET_AVX2 static void distancesAVX2(const uint64_t* hashes, size_t count, const uint64_t* query, uint16_t* distances) {
+    // per-nibble popcount through a shuffle lookup table, then summed horizontally by sad against zero
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0F);
+    const __m256i query0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query));
+    const __m256i query1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query + 4));
+    for (size_t i = 0; i < count; i++) {
+        const auto* hash = reinterpret_cast<const __m256i*>(hashes + i * FEATURE_HASH_WORDS);
+        __m256i x0 = _mm256_xor_si256(_mm256_load_si256(hash), query0);
+        __m256i x1 = _mm256_xor_si256(_mm256_load_si256(hash + 1), query1);
+        __m256i count0 = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(x0, lowMask)),
+                                         _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x0, 4), lowMask)));
+        __m256i count1 = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, _mm256_and_si256(x1, lowMask)),
+                                         _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x1, 4), lowMask)));
+        // each byte holds at most 16 here, so adding before the sad cannot overflow
+        __m256i sums = _mm256_sad_epu8(_mm256_add_epi8(count0, count1), _mm256_setzero_si256());
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+        distances[i] = static_cast<uint16_t>(_mm_cvtsi128_si32(sum));
+    }
+}
+TARGET_AVX512 static void distancesAVX512(const uint64_t* hashes, size_t count, const uint64_t* query, uint16_t* distances) {
+    const __m512i query512 = _mm512_loadu_si512(query);
+    for (size_t i = 0; i < count; i++) { // one hash is exactly one zmm register
+        __m512i x = _mm512_xor_si512(_mm512_load_si512(hashes + i * FEATURE_HASH_WORDS), query512);
+        distances[i] = static_cast<uint16_t>(_mm512_reduce_add_epi64(_mm512_popcnt_epi64(x)));
+    }
+}
+#endif
+
+static uint32_t hashDistance(const uint64_t* a, const uint64_t* b) { // single pair, used to verify candidates
+    uint32_t distance = 0;
+    for (size_t word = 0; word < FEATURE_HASH_WORDS; word++) {
+        distance += popcount64(a[word] ^ b[word]);
+    }
+    return distance;
+}
+static uint32_t getChunk(const uint64_t* hash, size_t chunk) {
+    return static_cast<uint32_t>(hash[chunk / 2] >> ((chunk & 1) * 32));
+}
+
+static HammingKernel detectKernel() {
+#ifdef HAMMING_X86_KERNELS
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return HammingKernel::Scalar;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] >> 27) & 1;
+    bool avx = (info[2] >> 28) & 1;
+    if (!osxsave || !avx) return HammingKernel::Scalar;
+    uint64_t xcr0 = _xgetbv(0); // register state the os saves on context switch
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] >> 5) & 1;
+    bool avx512f = (info[1] >> 16) & 1;
+    bool avx512popcnt = (info[2] >> 14) & 1;
+    if (avx512f && avx512popcnt && (xcr0 & 0xE6) == 0xE6) return HammingKernel::AVX512;
+    if (avx2 && (xcr0 & 0x06) == 0x06) return HammingKernel::AVX2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) return HammingKernel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return HammingKernel::AVX2;
+#endif
+#endif
+    return HammingKernel::Scalar;
+}
+
+// FeatureHashIndex implementation
+
+HammingKernel FeatureHashIndex::activeKernel() {
+    static const HammingKernel kernel = detectKernel();
+    return kernel;
+}
+const char* FeatureHashIndex::kernelName(HammingKernel kernel) {
+    switch (kernel) {
+    case HammingKernel::AVX2:
+        return "AVX2";
+    case HammingKernel::AVX512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+void FeatureHashIndex::reserve(size_t count) {
+    hashWords.reserve(count * FEATURE_HASH_WORDS);
+    picIds.reserve(count);
+    picOrdinals.reserve(count);
+}
+void FeatureHashIndex::add(uint64_t picId, const uint8_t* hash) {
+    picOrdinals[picId] = static_cast<uint32_t>(picIds.size());
+    picIds.push_back(picId);
+    size_t offset = hashWords.size();
+    hashWords.resize(offset + FEATURE_HASH_WORDS);
+    std::memcpy(hashWords.data() + offset, hash, FEATURE_HASH_BYTES);
+}
+const uint64_t* FeatureHashIndex::getHash(uint64_t picId) const {
+    auto it = picOrdinals.find(picId);
+    if (it == picOrdinals.end()) return nullptr;
+    return hashWords.data() + static_cast<size_t>(it->second) * FEATURE_HASH_WORDS;
+}
+void FeatureHashIndex::computeDistances(const uint64_t* queryHash, uint16_t* distances) const {
+    switch (activeKernel()) {
+#ifdef HAMMING_X86_KERNELS
+    case HammingKernel::AVX512:
+        distancesAVX512(hashWords.data(), picIds.size(), queryHash, distances);
+        break;
+    case HammingKernel::AVX2:
+        distancesAVX2(hashWords.data(), picIds.size(), queryHash, distances);
+        break;
+#endif
+    default:
+        distancesScalar(hashWords.data(), picIds.size(), queryHash, distances);
+        break;
+    }
+}
+std::vector<SimilarPic> FeatureHashIndex::nearest(const uint64_t* queryHash, size_t count, uint64_t excludedPicId) const {
+    std::vector<SimilarPic> results;
+    if (count == 0 || picIds.empty()) return results;
+
+    constexpr uint16_t EXCLUDED_DISTANCE = MAX_HAMMING_DISTANCE + 1;
+    std::vector<uint16_t> distances(picIds.size());
+    computeDistances(queryHash, distances.data());
+    auto excludedIt = picOrdinals.find(excludedPicId);
+    if (excludedIt != picOrdinals.end()) distances[excludedIt->second] = EXCLUDED_DISTANCE;
+
+    // distances are bounded, so a histogram finds the cut-off distance without sorting all candidates
+    std::array<uint32_t, MAX_HAMMING_DISTANCE + 2> histogram{};
+    for (uint16_t distance : distances) {
+        histogram[distance]++;
+    }
+    uint32_t cutoff = 0;
+    size_t closer = 0; // candidates strictly closer than cutoff
+    for (; cutoff < MAX_HAMMING_DISTANCE; cutoff++) {
+        if (closer + histogram[cutoff] >= count) break;
+        closer += histogram[cutoff];
+    }
+    size_t tiesLeft = count - closer; // candidates taken at exactly the cut-off distance
+
+    results.reserve(std::min(count, picIds.size()));
+    for (uint32_t ordinal = 0; ordinal < distances.size(); ordinal++) {
+        uint16_t distance = distances[ordinal];
+        if (distance > cutoff) continue;
+        if (distance == cutoff) {
+            if (tiesLeft == 0) continue;
+            tiesLeft--;
+        }
+        results.push_back({picIds[ordinal], distance});
+    }
+    std::stable_sort(results.begin(), results.end(), [](const SimilarPic& a, const SimilarPic& b) {
+        return a.distance < b.distance;
+    });
+    return results;
+}
+
+// multi-index hashing
+
+void FeatureHashIndex::buildChunkTables() const {
+    std::vector<std::pair<uint32_t, uint32_t>> entries(picIds.size()); // (chunk value, ordinal)
+    for (size_t chunk = 0; chunk < HASH_CHUNKS; chunk++) {
+        for (uint32_t ordinal = 0; ordinal < picIds.size(); ordinal++) {
+            entries[ordinal] = {getChunk(hashWords.data() + ordinal * FEATURE_HASH_WORDS, chunk), ordinal};
+        }
+        std::sort(entries.begin(), entries.end());
+        chunkKeys[chunk].resize(entries.size());
+        chunkOrdinals[chunk].resize(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            chunkKeys[chunk][i] = entries[i].first;
+            chunkOrdinals[chunk][i] = entries[i].second;
+        }
+    }
+}
+template <typename Func>
+void FeatureHashIndex::forEachWithinRadius(
+    const uint64_t* queryHash, uint32_t radius, std::vector<uint32_t>& visitStamps, uint32_t stamp, Func&& func) const {
+    uint32_t chunkRadius = radius / HASH_CHUNKS;
+    if (chunkRadius > MAX_CHUNK_RADIUS) {
+        for (uint32_t ordinal = 0; ordinal < picIds.size(); ordinal++) {
+            uint32_t distance = hashDistance(hashWords.data() + ordinal * FEATURE_HASH_WORDS, queryHash);
+            if (distance <= radius) func(ordinal, distance);
+        }
+        return;
+    }
+    std::call_once(chunkTablesBuilt, [this] { buildChunkTables(); });
+    auto probe = [&](size_t chunk, uint32_t key) {
+        const std::vector<uint32_t>& keys = chunkKeys[chunk];
+        auto range = std::equal_range(keys.begin(), keys.end(), key);
+        for (auto it = range.first; it != range.second; ++it) {
+            uint32_t ordinal = chunkOrdinals[chunk][it - keys.begin()];
+            if (visitStamps[ordinal] == stamp) continue; // already verified through another chunk
+            visitStamps[ordinal] = stamp;
+            uint32_t distance = hashDistance(hashWords.data() + ordinal * FEATURE_HASH_WORDS, queryHash);
+            if (distance <= radius) func(ordinal, distance);
+        }
+    };
+    for (size_t chunk = 0; chunk < HASH_CHUNKS; chunk++) { // probe every key within chunkRadius of the query chunk
+        uint32_t key = getChunk(queryHash, chunk);
+        probe(chunk, key);
+        if (chunkRadius < 1) continue;
+        for (uint32_t first = 0; first < 32; first++) {
+            uint32_t flipped = key ^ (uint32_t(1) << first);
+            probe(chunk, flipped);
+            if (chunkRadius < 2) continue;
+            for (uint32_t second = first + 1; second < 32; second++) {
+                probe(chunk, flipped ^ (uint32_t(1) << second));
+            }
+        }
+    }
+}
+std::vector<SimilarPic> FeatureHashIndex::withinRadius(const uint64_t* queryHash, uint32_t radius, uint64_t excludedPicId) const {
+    std::vector<std::pair<uint32_t, uint32_t>> matches; // (distance, ordinal)
+    std::vector<uint32_t> visitStamps(picIds.size(), 0);
+    forEachWithinRadius(queryHash, radius, visitStamps, 1, [&](uint32_t ordinal, uint32_t distance) {
+        if (picIds[ordinal] != excludedPicId) matches.emplace_back(distance, ordinal);
+    });
+    std::sort(matches.begin(), matches.end());
+
+    std::vector<SimilarPic> results;
+    results.reserve(matches.size());
+    for (const auto& [distance, ordinal] : matches) {
+        results.push_back({picIds[ordinal], distance});
+    }
+    return results;
+}
+std::vector<std::vector<uint64_t>>
+FeatureHashIndex::clusterNearDuplicates(uint32_t radius,
+                                        const std::function<void(size_t processed, size_t total)>& progressCallback) const {
+    constexpr size_t PROGRESS_INTERVAL = 1024; // pictures queried between progress reports
+    const size_t total = picIds.size();
+
+    std::vector<uint32_t> parent(total); // union-find over ordinals, the root is the smallest ordinal of a group
+    std::iota(parent.begin(), parent.end(), 0);
+    auto findRoot = [&parent](uint32_t ordinal) {
+        while (parent[ordinal] != ordinal) {
+            parent[ordinal] = parent[parent[ordinal]]; // path halving
+            ordinal = parent[ordinal];
+        }
+        return ordinal;
+    };
+
+    std::vector<uint32_t> visitStamps(total, 0);
+    for (uint32_t ordinal = 0; ordinal < total; ordinal++) {
+        const uint64_t* hash = hashWords.data() + static_cast<size_t>(ordinal) * FEATURE_HASH_WORDS;
+        forEachWithinRadius(hash, radius, visitStamps, ordinal + 1, [&](uint32_t other, uint32_t) {
+            if (other <= ordinal) return; // each pair is linked once, from its smaller ordinal
+            uint32_t rootA = findRoot(ordinal);
+            uint32_t rootB = findRoot(other);
+            if (rootA != rootB) parent[std::max(rootA, rootB)] = std::min(rootA, rootB);
+        });
+        if (progressCallback && (ordinal + 1) % PROGRESS_INTERVAL == 0) progressCallback(ordinal + 1, total);
+    }
+
+    std::vector<uint32_t> groupSizes(total, 0);
+    for (uint32_t ordinal = 0; ordinal < total; ordinal++) {
+        groupSizes[findRoot(ordinal)]++;
+    }
+    std::vector<std::vector<uint64_t>> clusters;
+    std::vector<uint32_t> clusterIndices(total); // root -> index in clusters, roots are met before their members
+    for (uint32_t ordinal = 0; ordinal < total; ordinal++) {
+        uint32_t root = findRoot(ordinal);
+        if (groupSizes[root] < 2) continue;
+        if (root == ordinal) {
+            clusterIndices[root] = static_cast<uint32_t>(clusters.size());
+            clusters.emplace_back();
+            clusters.back().reserve(groupSizes[root]);
+        }
+        clusters[clusterIndices[root]].push_back(picIds[ordinal]);
+    }
+    std::sort(clusters.begin(), clusters.end(), [](const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+        return a.size() != b.size() ? a.size() > b.size() : a.front() < b.front();
+    });
+    if (progressCallback) progressCallback(total, total);
+    return clusters;
+}
@@ -0,0 +1,99 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t FEATURE_HASH_BYTES = 64;                                    // 512-bit feature hash from the tagger
+constexpr size_t FEATURE_HASH_WORDS = FEATURE_HASH_BYTES / sizeof(uint64_t); // 8 words per hash
+constexpr uint32_t MAX_HAMMING_DISTANCE = FEATURE_HASH_BYTES * 8;
+constexpr size_t HASH_CHUNKS = 16;             // multi-index hashing splits a hash into 16 32-bit chunks
+constexpr uint32_t MAX_CHUNK_RADIUS = 2;       // probes per chunk grow as C(32, radius), larger radii scan linearly
+constexpr uint32_t NEAR_DUPLICATE_RADIUS = 31; // largest radius answered with single-bit chunk probes
+
+enum class HammingKernel { Scalar, AVX2, AVX512 };
+
+template <typename T, size_t Alignment> struct AlignedAllocator { // keeps every hash on its own cache line
+    using value_type = T;
+    template <typename U> struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+struct SimilarPic {
+    uint64_t picId;
+    uint32_t distance; // hamming distance between feature hashes, 0 to MAX_HAMMING_DISTANCE
+};
+
+class FeatureHashIndex { // contiguous feature hashes of tagged pictures, scanned by hamming distance for similarity search
+public:
+    void reserve(size_t count);
+    void add(uint64_t picId, const uint8_t* hash); // hash is FEATURE_HASH_BYTES long
+    size_t size() const { return picIds.size(); }
+    size_t sizeInBytes() const { return (hashWords.size() + picIds.size()) * sizeof(uint64_t); } // without chunk tables
+    const uint64_t* getHash(uint64_t picId) const; // nullptr if the picture has no feature hash
+
+    std::vector<SimilarPic> nearest(const uint64_t* queryHash, // nearest first, ties in ordinal order
+                                    size_t count,
+                                    uint64_t excludedPicId = 0) const;
+
+    // multi-index hashing, a hash within radius r shares at least one chunk within r / HASH_CHUNKS with the query
+    // the chunk tables are built by the first radius query that can use them, add every hash before that
+    std::vector<SimilarPic> withinRadius(const uint64_t* queryHash, // nearest first
+                                         uint32_t radius,
+                                         uint64_t excludedPicId = 0) const;
+    std::vector<std::vector<uint64_t>> // groups of two or more pictures linked by distance <= radius, largest first
+    clusterNearDuplicates(uint32_t radius, const std::function<void(size_t processed, size_t total)>& progressCallback) const;
+
+    static HammingKernel activeKernel(); // best kernel supported by the running cpu
+    static const char* kernelName(HammingKernel kernel);
+
+private:
+    std::vector<uint64_t, AlignedAllocator<uint64_t, 64>> hashWords; // ordinal i occupies words [i * 8, i * 8 + 8)
+    std::vector<uint64_t> picIds;                                    // ordinal -> picture id
+    std::unordered_map<uint64_t, uint32_t> picOrdinals;              // picture id -> ordinal
+
+    mutable std::array<std::vector<uint32_t>, HASH_CHUNKS> chunkKeys;     // chunk value of every ordinal, sorted
+    mutable std::array<std::vector<uint32_t>, HASH_CHUNKS> chunkOrdinals; // ordinals in the same order as chunkKeys
+    mutable std::once_flag chunkTablesBuilt;                              // the index is shared read-only between threads
+
+    void buildChunkTables() const;
+
+    void computeDistances(const uint64_t* queryHash, uint16_t* distances) const;
+    template <typename Func> // calls func(ordinal, distance) for every ordinal within radius, each at most once
+    void forEachWithinRadius(const uint64_t* queryHash,
+                             uint32_t radius,
+                             std::vector<uint32_t>& visitStamps,
+                             uint32_t stamp,
+                             Func&& func) const;
+};
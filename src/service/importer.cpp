@@ -18,7 +18,19 @@
 
 #include "importer.h"
 
-void Importer::startImportFromDirectory(const std::filesystem::path& directory, ParserType parserType) {
+void Importer::startImportFromDirectory(const std::filesystem::path& directory, ParserType parserType, bool rescan) {
+    // the walk starts from the import directory, without a trailing separator it matches the parent path of its files
+    startWalk({directory.has_filename() ? directory : directory.parent_path()}, directory, parserType, rescan, true);
+}
+void Importer::startImportFromDirectories(const std::vector<std::filesystem::path>& directories, ParserType parserType) {
+    if (directories.empty()) return;
+    startWalk(directories, directories.front(), parserType, true, false);
+}
+void Importer::startWalk(const std::vector<std::filesystem::path>& directories,
+                         const std::filesystem::path& directory,
+                         ParserType parserType,
+                         bool rescan,
+                         bool walkSubdirectories) {
     if (!finished && !finish()) {
         Warn() << "Importer is running.";
         return;
@@ -26,23 +38,36 @@ void Importer::startImportFromDirectory(const std::filesystem::path& directory,
     finished = false;
     importDirectory = directory;
     this->parserType = parserType;
+    this->rescan = rescan;
+    this->walkSubdirectories = walkSubdirectories;
+    parsedBatches = std::make_unique<BoundedMpscQueue<ParsedBatch>>(IMPORT_QUEUE_BATCHES);
+    runningWorkers.store(threadCount);
+    taskDeques.clear();
+    for (size_t i = 0; i < threadCount; ++i) {
+        taskDeques.push_back(std::make_unique<TaskDeque>());
+    }
+    for (size_t i = 0; i < directories.size(); ++i) {
+        pushTask(i % threadCount, ImportTask{directories[i], {}});
+    }
 
     // start insert thread
     insertThread = std::thread(&Importer::insertThreadFunc, this);
 
     // start worker threads
     for (size_t i = 0; i < threadCount; ++i) {
-        workers.emplace_back(&Importer::workerThreadFunc, this);
+        workers.emplace_back(&Importer::workerThreadFunc, this, i);
     }
 }
 void Importer::forceStop() {
     if (finished) return;
     stopFlag.store(true);
+    parsedBatches->close(); // wakes workers waiting for space and the insert thread waiting for batches
+    wakeWorkers(true);      // and the idle ones
     finish();
 }
 bool Importer::finish() {
     if (finished) return true; // already finished
-    if (importedCount < supportedFileCount.load() && !stopFlag.load()) {
+    if (!insertFinished.load() && !stopFlag.load()) {
         return false; // not finished yet
     }
 
@@ -53,49 +78,60 @@ bool Importer::finish() {
         }
     }
     workers.clear();
-    files.clear();
-    nextFileIndex.store(0);
-
-    cv.notify_all();
     if (insertThread.joinable()) {
         insertThread.join();
     }
+    taskDeques.clear();
+    pendingTasks.store(0);
+    queuedTasks.store(0);
     readyFlag.store(false);
+    insertDb = nullptr;
     importedCount = 0;
     supportedFileCount.store(0);
-
-    parsedPicQueueMutex.lock();
-    while (!parsedPictureQueue.empty()) {
-        parsedPictureQueue.pop();
-    }
-    parsedPicQueueMutex.unlock();
-    parsedMetadataQueueMutex.lock();
-    while (!metadataVecQueue.empty()) {
-        metadataVecQueue.pop();
-    }
-    parsedMetadataQueueMutex.unlock();
+    insertFinished.store(false);
+    rescan = false;
+    walkSubdirectories = true;
+    listedDirectories.clear();
+    vanishedFiles.clear();
+    importedPictures.clear();
+    parsedBatches.reset(); // drops batches left by a forced stop
 
     stopFlag.store(false);
 
     finished = true;
     return true;
 }
-bool processSingleFile(const std::filesystem::path& filePath,
-                       ParserType parserType,
-                       std::vector<ParsedPicture>& parsedPictures,
-                       std::vector<std::vector<ParsedMetadata>>& parsedMetadataVecs) {
+static std::string lowerExtension(const std::filesystem::path& filePath) {
     std::string ext = filePath.extension().string();
     std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+static bool isPictureExtension(const std::string& ext) {
+    return ext == ".jpg" || ext == ".png" || ext == ".jpeg" || ext == ".gif" || ext == ".webp";
+}
+static bool isImportCandidate(const std::filesystem::path& filePath, ParserType parserType) { // checked during the walk
+    std::string ext = lowerExtension(filePath);
+    if (isPictureExtension(ext)) return true;
+    switch (parserType) {
+    case ParserType::PowerfulPixivDownloader:
+        return ext == ".json" || ext == ".csv" || ext == ".txt";
+    case ParserType::GallerydlTwitter:
+        return ext == ".json";
+    default:
+        return false;
+    }
+}
+bool processSingleFile(const std::filesystem::path& filePath, ParserType parserType, ParsedBatch& batch) {
     try {
-        if (ext == ".jpg" || ext == ".png" || ext == ".jpeg" || ext == ".gif" || ext == ".webp") {
-            parsedPictures.emplace_back(parsePicture(filePath, parserType));
+        if (isPictureExtension(lowerExtension(filePath))) {
+            batch.pictures.emplace_back(parsePicture(filePath, parserType));
             return true;
         } else {
             switch (parserType) {
             case ParserType::PowerfulPixivDownloader: {
                 std::vector<ParsedMetadata> parsedMetadata = powerfulPixivDownloaderMetadataParser(filePath);
                 if (!parsedMetadata.empty()) {
-                    parsedMetadataVecs.push_back(std::move(parsedMetadata));
+                    batch.metadataVecs.push_back(std::move(parsedMetadata));
                     return true;
                 }
                 break;
@@ -103,7 +139,7 @@ bool processSingleFile(const std::filesystem::path& filePath,
             case ParserType::GallerydlTwitter: {
                 ParsedMetadata parsedMetadata = gallerydlTwitterMetadataParser(filePath);
                 if (parsedMetadata.platformType != PlatformType::Unknown) {
-                    parsedMetadataVecs.push_back({std::move(parsedMetadata)});
+                    batch.metadataVecs.push_back({std::move(parsedMetadata)});
                     return true;
                 }
                 break;
@@ -118,141 +154,203 @@ bool processSingleFile(const std::filesystem::path& filePath,
     }
     return false;
 }
-void Importer::workerThreadFunc() {
-    std::vector<ParsedPicture> parsedPictures;
-    parsedPictures.reserve(500);
-    std::vector<std::vector<ParsedMetadata>> ParsedMetadataVecs;
-    ParsedMetadataVecs.reserve(500);
-    size_t index = 0;
-
-    // Wait until files are collected
-    while (!readyFlag.load() && !stopFlag.load()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+void Importer::workerThreadFunc(size_t workerIndex) {
+    { // Wait until the insert thread opened its connection, it is used for the imported file checks
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idleCondition.wait(lock, [this]() { return readyFlag.load() || stopFlag.load(); });
     }
-    if (stopFlag.load()) return;
 
-    while ((index = nextFileIndex.fetch_add(1)) < files.size()) {
-        if (parsedPictures.size() >= 100) {
-            if (parsedPicQueueMutex.try_lock()) {
-                while (!parsedPictures.empty()) {
-                    parsedPictureQueue.push(std::move(parsedPictures.back()));
-                    parsedPictures.pop_back();
-                }
-                parsedPicQueueMutex.unlock();
-                parsedPictures.clear();
-                cv.notify_one();
-            }
+    ParsedBatch batch;
+    ImportTask task;
+    while (!stopFlag.load()) {
+        if (!popTask(workerIndex, task)) {
+            if (pendingTasks.load() == 0) break; // nothing queued and nobody listing a directory, the walk is done
+            std::unique_lock<std::mutex> lock(idleMutex); // until another worker pushes a task or the walk ends
+            idleCondition.wait(lock, [this]() { return queuedTasks.load() > 0 || pendingTasks.load() == 0 || stopFlag.load(); });
+            continue;
         }
-        if (ParsedMetadataVecs.size() >= 100) {
-            if (parsedMetadataQueueMutex.try_lock()) {
-                while (!ParsedMetadataVecs.empty()) {
-                    metadataVecQueue.push(std::move(ParsedMetadataVecs.back()));
-                    ParsedMetadataVecs.pop_back();
-                }
-                parsedMetadataQueueMutex.unlock();
-                ParsedMetadataVecs.clear();
-                cv.notify_one();
+        if (task.files.empty()) {
+            listDirectory(workerIndex, task.directory);
+        }
+        for (auto& file : task.files) {
+            if (stopFlag.load()) break;
+            if (!task.recordOnly && !processSingleFile(file.path, parserType, batch)) supportedFileCount.fetch_sub(1);
+            batch.files.push_back(std::move(file));
+            if (batch.files.size() >= IMPORT_BATCH_FILES) {
+                if (!parsedBatches->push(std::move(batch))) break; // closed by forceStop
+                batch = ParsedBatch();
             }
         }
-        if (stopFlag.load()) return;
-        const auto& filePath = files[index];
-        if (!processSingleFile(filePath, parserType, parsedPictures, ParsedMetadataVecs)) supportedFileCount.fetch_sub(1);
+        if (pendingTasks.fetch_sub(1) == 1) wakeWorkers(true); // after the tasks found in it were pushed
     }
-    if (!parsedPictures.empty()) {
-        std::lock_guard<std::mutex> lock(parsedPicQueueMutex);
-        while (!parsedPictures.empty()) {
-            parsedPictureQueue.push(std::move(parsedPictures.back()));
-            parsedPictures.pop_back();
+    if (!batch.files.empty() && !stopFlag.load()) parsedBatches->push(std::move(batch));
+    if (runningWorkers.fetch_sub(1) == 1) parsedBatches->close(); // last worker, the insert thread drains and finishes
+}
+void Importer::pushTask(size_t workerIndex, ImportTask&& task) {
+    pendingTasks.fetch_add(1);
+    {
+        TaskDeque& own = *taskDeques[workerIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.tasks.push_back(std::move(task));
+        queuedTasks.fetch_add(1);
+    }
+    wakeWorkers(false);
+}
+bool Importer::popTask(size_t workerIndex, ImportTask& task) {
+    { // newest task of our own first, it is the deepest directory and keeps the walk depth first
+        TaskDeque& own = *taskDeques[workerIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queuedTasks.fetch_sub(1);
+            return true;
         }
-        parsedPictures.clear();
-        cv.notify_one();
     }
-    if (!ParsedMetadataVecs.empty()) {
-        std::lock_guard<std::mutex> lock(parsedMetadataQueueMutex);
-        while (!ParsedMetadataVecs.empty()) {
-            metadataVecQueue.push(std::move(ParsedMetadataVecs.back()));
-            ParsedMetadataVecs.pop_back();
+    for (size_t i = 1; i < taskDeques.size(); i++) { // then steal the oldest task of another worker, usually a large subtree
+        TaskDeque& victim = *taskDeques[(workerIndex + i) % taskDeques.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queuedTasks.fetch_sub(1);
+            return true;
         }
-        ParsedMetadataVecs.clear();
-        cv.notify_one();
+    }
+    return false;
+}
+void Importer::wakeWorkers(bool all) {
+    { // a worker checks its wait condition under the lock, so it either sees the change or is already waiting
+        std::lock_guard<std::mutex> lock(idleMutex);
+    }
+    if (all) {
+        idleCondition.notify_all();
+    } else {
+        idleCondition.notify_one();
     }
 }
-void Importer::insertThreadFunc() {
-    PicDatabase threadDb(dbFile, DbMode::Import);
-    std::mutex conditionMutex;
-    std::vector<ParsedPicture> picsToInsert;
-    picsToInsert.reserve(1000);
-    std::vector<std::vector<ParsedMetadata>> metadataVecsToInsert;
-    metadataVecsToInsert.reserve(1000);
+void Importer::listDirectory(size_t workerIndex, const std::filesystem::path& directory) {
+    // subdirectories and groups of new candidate files become tasks, so a huge directory is parsed by every worker
+    std::vector<ImportedFile> files;
+    std::vector<ImportedFile> unknownStatFiles;  // rescan only, imported before stats were recorded
+    std::unordered_set<std::string> listedNames; // rescan only
+    std::error_code ec;
+    std::filesystem::directory_iterator it(directory, ec);
+    for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        if (stopFlag.load()) return;
+        const auto& entry = *it;
+        std::error_code entryEc;
+        if (entry.is_directory(entryEc) && !entry.is_symlink(entryEc)) {
+            if (walkSubdirectories) pushTask(workerIndex, ImportTask{entry.path(), {}});
+            continue;
+        }
+        if (!entry.is_regular_file(entryEc)) continue;
+        if (rescan) listedNames.insert(entry.path().filename().string());
+        if (!isImportCandidate(entry.path(), parserType)) continue;
 
-    // Collect files to import
-    for (const auto& entry : std::filesystem::recursive_directory_iterator(importDirectory)) {
-        if (!entry.is_regular_file() || threadDb.isFileImported(entry.path())) {
+        FileStat importedStat;
+        bool imported = insertDb->findImportedFile(entry.path(), importedStat);
+        if (imported && !rescan) continue; // a plain import skips imported files by name
+        ImportedFile file{entry.path(), {}};
+        if (!statFile(file.path, file.stat)) {
+            Warn() << "Failed to stat file:" << file.path;
+            continue;
+        }
+        if (imported && importedStat == file.stat) continue; // unchanged, not read again
+        if (imported && !importedStat.known()) {             // trusted as unchanged, its stat is recorded
+            unknownStatFiles.push_back(std::move(file));
+            if (unknownStatFiles.size() >= IMPORT_BATCH_FILES) {
+                pushTask(workerIndex, ImportTask{{}, std::move(unknownStatFiles), true});
+                unknownStatFiles.clear();
+            }
             continue;
         }
-        files.push_back(entry.path());
+        files.push_back(std::move(file)); // new, or modified since it was imported
+        supportedFileCount.fetch_add(1);
+        if (files.size() >= IMPORT_BATCH_FILES) {
+            pushTask(workerIndex, ImportTask{{}, std::move(files)});
+            files.clear();
+        }
     }
-    supportedFileCount = files.size();
-    Info() << "Total files to import: " << supportedFileCount.load();
-    readyFlag.store(true);
+    if (ec) Warn() << "Failed to list directory:" << directory << "Error:" << ec.message();
+    if (!files.empty()) pushTask(workerIndex, ImportTask{{}, std::move(files)});
+    if (!unknownStatFiles.empty()) pushTask(workerIndex, ImportTask{{}, std::move(unknownStatFiles), true});
+    if (!rescan || !walkSubdirectories || ec) return; // failed listings and watch batches report no vanished files
+
+    std::lock_guard<std::mutex> lock(vanishedFilesMutex);
+    listedDirectories.insert(directory.string());
+    for (const auto& fileName : insertDb->getImportedFileNames(directory)) {
+        if (listedNames.find(fileName) == listedNames.end()) vanishedFiles.push_back(directory / fileName);
+    }
+}
+void Importer::collectVanishedDirectories(const PicDatabase& db) {
+    std::lock_guard<std::mutex> lock(vanishedFilesMutex);
+    const std::filesystem::path root = importDirectory.has_filename() ? importDirectory : importDirectory.parent_path();
+    for (const auto& directory : db.getImportedDirectories()) {
+        if (listedDirectories.find(directory) != listedDirectories.end()) continue;
+        std::filesystem::path relative = std::filesystem::path(directory).lexically_relative(root);
+        if (relative.empty() || *relative.begin() == "..") continue; // outside the rescanned directory
+        for (const auto& fileName : db.getImportedFileNames(directory)) {
+            vanishedFiles.push_back(std::filesystem::path(directory) / fileName);
+        }
+    }
+}
+void Importer::insertThreadFunc() {
+    PicDatabase threadDb(dbFile, DbMode::Import);
+    insertDb = &threadDb;
+    readyFlag.store(true); // workers start walking the import directory
+    wakeWorkers(true);
 
     threadDb.beginTransaction();
-    while (!stopFlag.load() && importedCount < supportedFileCount.load()) {
-        if (progressCallback) progressCallback(importedCount, supportedFileCount.load());
-        std::unique_lock<std::mutex> lock(conditionMutex);
-        cv.wait(lock, [this]() { return !parsedPictureQueue.empty() || !metadataVecQueue.empty() || stopFlag.load(); });
+    std::vector<ImportedFile> processedFiles;
+    std::vector<std::pair<uint64_t, std::vector<std::filesystem::path>>> insertedPictures;
+    ParsedBatch batch;
+    while (parsedBatches->pop(batch)) { // blocks until a worker hands over a batch, false once all workers are done
         if (stopFlag.load()) break;
-        if (!parsedPictureQueue.empty()) {
-            if (parsedPicQueueMutex.try_lock()) {
-                while (!parsedPictureQueue.empty()) {
-                    picsToInsert.push_back(std::move(parsedPictureQueue.front()));
-                    parsedPictureQueue.pop();
-                }
-                parsedPicQueueMutex.unlock();
-                for (const auto& picInfo : picsToInsert) {
-                    threadDb.insertPicture(picInfo);
-                    importedCount++;
-                }
-                picsToInsert.clear();
-            }
+        processedFiles.insert(processedFiles.end(), batch.files.begin(), batch.files.end());
+        for (const auto& picInfo : batch.pictures) {
+            if (threadDb.insertPicture(picInfo)) insertedPictures.push_back({picInfo.id, {picInfo.filePath}});
+            importedCount++;
         }
-        if (!metadataVecQueue.empty()) {
-            if (parsedMetadataQueueMutex.try_lock()) {
-                while (!metadataVecQueue.empty()) {
-                    metadataVecsToInsert.push_back(std::move(metadataVecQueue.front()));
-                    metadataVecQueue.pop();
-                }
-                parsedMetadataQueueMutex.unlock();
-                for (const auto& metadataVec : metadataVecsToInsert) {
-                    for (const auto& metadataInfo : metadataVec) {
-                        if (metadataInfo.updateIfExists) {
-                            threadDb.updateMetadata(metadataInfo);
-                        } else {
-                            threadDb.insertMetadata(metadataInfo);
-                        }
-                    }
-                    importedCount++;
+        for (const auto& metadataVec : batch.metadataVecs) {
+            for (const auto& metadataInfo : metadataVec) {
+                if (metadataInfo.updateIfExists) {
+                    threadDb.updateMetadata(metadataInfo);
+                } else {
+                    threadDb.insertMetadata(metadataInfo);
                 }
-                metadataVecsToInsert.clear();
             }
+            importedCount++;
+        }
+        if (progressCallback) { // the walk may still find more files, total stays ahead until the end
+            progressCallback(importedCount, std::max(supportedFileCount.load(), importedCount + 1));
         }
     }
-    Info() << "Finalizing import";
+    Info() << "Finalizing import. Files: " << processedFiles.size();
     if (stopFlag.load()) {
         Info() << "Import stopped by user, rolling back. " << "Directory: " << importDirectory;
         threadDb.rollbackTransaction();
         return;
     }
+    if (rescan) {
+        if (walkSubdirectories) collectVanishedDirectories(threadDb);
+        if (!vanishedFiles.empty()) {
+            Warn() << "Imported files no longer found:" << vanishedFiles.size() << "Directory:" << importDirectory;
+        }
+    }
     threadDb.syncMetadataAndPicTables();
-    threadDb.updatePlatformTagCounts();
-    for (const auto& filePath : files) {
-        threadDb.addImportedFile(filePath);
+    for (const auto& file : processedFiles) {
+        threadDb.addImportedFile(file.path, file.stat);
     }
     if (!threadDb.commitTransaction()) {
         Error() << "Import commit failed, rolling back. " << "Directory: " << importDirectory;
         threadDb.rollbackTransaction();
+    } else {
+        std::lock_guard<std::mutex> lock(importedPicturesMutex);
+        importedPictures = std::move(insertedPictures);
     }
     Info() << "Import completed. Directory: " << importDirectory;
+    insertFinished.store(true);
     // progress equals to total is the signal of completion
     if (progressCallback) progressCallback(importedCount, supportedFileCount.load());
 }
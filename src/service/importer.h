@@ -17,13 +17,36 @@
  */
 
 #pragma once
+#include "bounded_mpsc_queue.h"
 #include "database.h"
 #include "parser.h"
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <unordered_set>
+
+constexpr size_t IMPORT_BATCH_FILES = 64;   // files a worker parses before handing them to the insert thread
+constexpr size_t IMPORT_QUEUE_BATCHES = 64; // parsed batches waiting for insertion, workers wait when it is full
+
+struct ImportedFile {
+    std::filesystem::path path;
+    FileStat stat; // taken when the file was found
+};
+
+struct ParsedBatch {
+    std::vector<ParsedPicture> pictures;                   // one ParsedPicture represents one image file
+    std::vector<std::vector<ParsedMetadata>> metadataVecs; // one vector represents one metadata file
+    std::vector<ImportedFile> files;                       // every processed file, recorded as imported on commit
+};
+
+struct ImportTask {
+    std::filesystem::path directory; // directory to list
+    std::vector<ImportedFile> files; // or files to parse when not empty
+    bool recordOnly = false;         // unchanged files imported before stats were recorded, only their stats are written
+};
 
 class Importer {
 public:
@@ -36,10 +59,25 @@ public:
         finish();
     };
 
-    void startImportFromDirectory(const std::filesystem::path& directory, ParserType parserType = ParserType::None);
+    // a rescan also checks imported files, unchanged ones are skipped by their stat, modified ones are parsed again
+    void startImportFromDirectory(const std::filesystem::path& directory,
+                                  ParserType parserType = ParserType::None,
+                                  bool rescan = false);
+    // watch mode, only the files directly in the given directories are checked, new subdirectories are listed separately,
+    // files are compared by stat like a rescan, so one that was still being written is read again once it changes
+    void startImportFromDirectories(const std::vector<std::filesystem::path>& directories,
+                                    ParserType parserType = ParserType::None);
     bool finish(); // return true means ready to start a new import task
     void forceStop();
     std::pair<std::filesystem::path, ParserType> getImportingDir() const { return {importDirectory, parserType}; }
+    std::vector<std::filesystem::path> getVanishedFiles() const { // imported files a completed rescan did not find
+        std::lock_guard<std::mutex> lock(vanishedFilesMutex);
+        return vanishedFiles;
+    }
+    std::vector<std::pair<uint64_t, std::vector<std::filesystem::path>>> getImportedPictures() const { // committed by the import
+        std::lock_guard<std::mutex> lock(importedPicturesMutex);
+        return importedPictures;
+    }
 
 private:
     bool finished = true;
@@ -50,27 +88,53 @@ private:
 
     ParserType parserType = ParserType::None;
     std::filesystem::path importDirectory = "";
+    bool rescan = false;
+    bool walkSubdirectories = true;
 
-    // worker threads
+    // worker threads, they list directories and parse the files found, so parsing starts with the first directory
+    // every worker owns a task deque, it pops its newest task and steals the oldest one of another worker when idle
+    struct TaskDeque {
+        std::mutex mutex;
+        std::deque<ImportTask> tasks;
+    };
     std::vector<std::thread> workers;
-    std::vector<std::filesystem::path> files;
-    std::atomic<size_t> nextFileIndex = 0;
+    std::vector<std::unique_ptr<TaskDeque>> taskDeques; // index is worker index
+    std::atomic<size_t> pendingTasks = 0;               // queued or running tasks, the walk is done when it reaches 0
+    std::atomic<size_t> queuedTasks = 0;                // tasks in the deques, changed under the deque's mutex
+    std::mutex idleMutex;
+    std::condition_variable idleCondition; // idle workers wait for a task, the end of the walk, a stop or the insert thread
 
     // single insert thread
     std::thread insertThread;
-    std::condition_variable cvReady;
     std::atomic<bool> readyFlag = false;
+    const PicDatabase* insertDb = nullptr; // connection of the insert thread, outlives the workers
     size_t importedCount = 0;
-    std::atomic<size_t> supportedFileCount = 0;
+    std::atomic<size_t> supportedFileCount = 0; // files found so far minus the ones that failed to parse
+    std::atomic<bool> insertFinished = false;
 
-    std::queue<ParsedPicture> parsedPictureQueue; // one ParsedPicture represents one image file
-    std::mutex parsedPicQueueMutex;
-    std::queue<std::vector<ParsedMetadata>> metadataVecQueue; // one vector represents one metadata file
-    std::mutex parsedMetadataQueueMutex;
+    std::unique_ptr<BoundedMpscQueue<ParsedBatch>> parsedBatches; // closed by the last worker or by forceStop
+    std::atomic<size_t> runningWorkers = 0;
 
     std::atomic<bool> stopFlag = false;
-    std::condition_variable cv;
 
-    void workerThreadFunc();
+    // rescan only, directories listed by the walk and imported files missing from them
+    mutable std::mutex vanishedFilesMutex;
+    std::unordered_set<std::string> listedDirectories;
+    std::vector<std::filesystem::path> vanishedFiles;
+
+    mutable std::mutex importedPicturesMutex; // pictures the import committed, their thumbnails are generated next
+    std::vector<std::pair<uint64_t, std::vector<std::filesystem::path>>> importedPictures;
+
+    void startWalk(const std::vector<std::filesystem::path>& directories,
+                   const std::filesystem::path& directory,
+                   ParserType parserType,
+                   bool rescan,
+                   bool walkSubdirectories);
+    void workerThreadFunc(size_t workerIndex);
     void insertThreadFunc();
+    void pushTask(size_t workerIndex, ImportTask&& task);
+    bool popTask(size_t workerIndex, ImportTask& task);
+    void wakeWorkers(bool all);
+    void listDirectory(size_t workerIndex, const std::filesystem::path& directory);
+    void collectVanishedDirectories(const PicDatabase& db); // imported directories the walk did not reach
 };
@@ -23,6 +23,7 @@
 #include <nlohmann/json.hpp>
 #include <rapidcsv.h>
 #include <regex>
+#include <stdexcept>
 #define STB_IMAGE_IMPLEMENTATION
 #include <chrono>
 #include <stb_image.h>
@@ -42,11 +43,40 @@ static const std::unordered_map<std::string, ImageFormat> fileTypeMap = {
     {"WEBP", ImageFormat::WebP},
 };
 
+struct ByteView { // bytes of a mapped file or a buffer, what the header parsers read from
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+    ByteView(const uint8_t* bytes, size_t length) : bytes(bytes), length(length) {}
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    uint8_t operator[](size_t i) const { return bytes[i]; }
+};
+
+class MappedFile { // read-only map of a whole file, pages come straight from the page cache without a copy
+public:
+    explicit MappedFile(const std::filesystem::path& filePath);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ByteView bytes() const { return ByteView(view, fileSize); }
+
+private:
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    const uint8_t* view = nullptr;
+    size_t fileSize = 0;
+};
+
+// a mapped page that can not be read (file truncated by another process, network drive gone) raises
+// EXCEPTION_IN_PAGE_ERROR instead of failing a read call, it is turned into the runtime_error a failed open throws
+template <typename Read> void readMappedFile(const std::filesystem::path& filePath, Read read);
+constexpr size_t HEADER_CHUNK_SIZE = 64 * 1024; // image dimensions are near the start of the file
+
 // Utility functions
 std::vector<uint8_t> readFileToBuffer(const std::filesystem::path& imagePath);
-uint64_t calcFileHash(const std::vector<uint8_t>& buffer);
+uint64_t calcFileHash(ByteView bytes);
 std::vector<std::string> splitAndTrim(const std::string& str);
-std::tuple<int, int, ImageFormat> getImageResolutionOptimized(const std::vector<uint8_t>& buffer, ImageFormat fileType);
+std::tuple<int, int, ImageFormat> getImageResolutionOptimized(ByteView buffer, ImageFormat fileType);
 RestrictType toXRestrictTypeEnum(const std::string& xRestrictStr);
 AIType toAITypeEnum(const std::string& aiTypeStr);
 std::pair<std::string, std::string> getFileTimestamps(const std::filesystem::path& filePath);
@@ -62,7 +92,8 @@ static std::string replacePlusZeroWithZ(const std::string& s) {
 }
 
 ParsedPicture parsePicture(const std::filesystem::path& pictureFilePath, ParserType parserType) {
-    std::vector<uint8_t> buffer = readFileToBuffer(pictureFilePath);
+    MappedFile mappedFile(pictureFilePath); // throws if the file can not be read, the importer skips it
+    ByteView buffer = mappedFile.bytes();
 
     std::string fileName = pictureFilePath.filename().string();
     std::string fileTypeStr = pictureFilePath.extension().string().substr(1);
@@ -70,13 +101,17 @@ ParsedPicture parsePicture(const std::filesystem::path& pictureFilePath, ParserT
     ImageFormat fileType = fileTypeMap.at(fileTypeStr);
 
     int width, height;
-    std::tie(width, height, fileType) = getImageResolutionOptimized(buffer, fileType);
+    uint64_t fileHash;
+    readMappedFile(pictureFilePath, [&]() {
+        std::tie(width, height, fileType) = getImageResolutionOptimized(buffer, fileType);
+        fileHash = calcFileHash(buffer);
+    });
 
     std::string creationTime, lastModifiedTime;
     std::tie(creationTime, lastModifiedTime) = getFileTimestamps(pictureFilePath);
 
     ParsedPicture parsedPic;
-    parsedPic.id = calcFileHash(buffer);
+    parsedPic.id = fileHash;
     parsedPic.filePath = pictureFilePath;
     parsedPic.width = width;
     parsedPic.height = height;
@@ -371,10 +406,56 @@ std::vector<uint8_t> readFileToBuffer(const std::filesystem::path& imagePath) {
     }
     return buffer;
 }
-uint64_t calcFileHash(const std::vector<uint8_t>& buffer) {
-    return XXH64(buffer.data(), static_cast<size_t>(buffer.size()), 0);
+MappedFile::MappedFile(const std::filesystem::path& filePath) {
+    // the same sharing as an ifstream, downloaders may still hold the file open
+    file = CreateFileW(filePath.wstring().c_str(),
+                       GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       nullptr,
+                       OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN,
+                       nullptr);
+    if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("Failed to open file: " + filePath.string());
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) { // an empty file can not be mapped
+        CloseHandle(file);
+        throw std::runtime_error("File is empty or unreadable: " + filePath.string());
+    }
+    fileSize = static_cast<size_t>(size.QuadPart);
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map file: " + filePath.string());
+    }
+}
+MappedFile::~MappedFile() {
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+    CloseHandle(file);
+}
+static bool tryMappedRead(void (*read)(void*), void* context) { // no objects to unwind here, __try requires it
+#ifdef _MSC_VER
+    __try {
+        read(context);
+    } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+        return false;
+    }
+#else
+    read(context);
+#endif
+    return true;
+}
+template <typename Read> void readMappedFile(const std::filesystem::path& filePath, Read read) {
+    if (!tryMappedRead([](void* context) { (*static_cast<Read*>(context))(); }, &read)) {
+        throw std::runtime_error("Failed to read mapped file: " + filePath.string());
+    }
+}
+uint64_t calcFileHash(ByteView bytes) { // picture ids are xxh64 digests, a different hash would change every stored id
+    return XXH64(bytes.data(), bytes.size(), 0);
 }
-std::tuple<int, int, ImageFormat> getImageResolution(const std::vector<uint8_t>& buffer, ImageFormat fileType) {
+std::tuple<int, int, ImageFormat> getImageResolution(ByteView buffer, ImageFormat fileType) {
     int width = 0, height = 0, channels = 0;
     if (fileType == ImageFormat::WebP) {
         if (WebPGetInfo(buffer.data(), buffer.size(), &width, &height)) {
@@ -400,7 +481,7 @@ struct ImageHeaderInfo {
 };
 
 // 检查签名的辅助函数
-inline bool checkSignature(const std::vector<uint8_t>& buffer, const char* signature, size_t len) {
+inline bool checkSignature(ByteView buffer, const char* signature, size_t len) {
     return buffer.size() >= len && memcmp(buffer.data(), signature, len) == 0;
 }
 inline bool checkSignature(const uint8_t* data, const char* signature, size_t len) {
@@ -408,7 +489,7 @@ inline bool checkSignature(const uint8_t* data, const char* signature, size_t le
 }
 
 // 各种格式的解析函数
-void parseJPEGResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& info) {
+void parseJPEGResolution(ByteView buffer, ImageHeaderInfo& info) {
     static constexpr char JPEG_SIGNATURE[] = "\xFF\xD8\xFF";
 
     if (!checkSignature(buffer, JPEG_SIGNATURE, 3)) return;
@@ -437,7 +518,7 @@ void parseJPEGResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& in
     }
 }
 
-void parsePNGResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& info) {
+void parsePNGResolution(ByteView buffer, ImageHeaderInfo& info) {
     static constexpr char PNG_SIGNATURE[] = "\x89PNG\r\n\x1A\n";
     static constexpr char IHDR_CHUNK[] = "IHDR";
 
@@ -446,7 +527,7 @@ void parsePNGResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& inf
     // IHDR块在文件头后8字节开始
     if (buffer.size() >= 24) {
         // 检查IHDR块标识
-        if (memcmp(&buffer[12], IHDR_CHUNK, 4) == 0) {
+        if (memcmp(buffer.data() + 12, IHDR_CHUNK, 4) == 0) {
             info.width = (buffer[16] << 24) | (buffer[17] << 16) | (buffer[18] << 8) | buffer[19];
             info.height = (buffer[20] << 24) | (buffer[21] << 16) | (buffer[22] << 8) | buffer[23];
             info.isValid = (info.width > 0 && info.height > 0);
@@ -454,7 +535,7 @@ void parsePNGResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& inf
     }
 }
 
-void parseGIFResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& info) {
+void parseGIFResolution(ByteView buffer, ImageHeaderInfo& info) {
     static constexpr char GIF87A_SIGNATURE[] = "GIF87a";
     static constexpr char GIF89A_SIGNATURE[] = "GIF89a";
 
@@ -469,7 +550,7 @@ void parseGIFResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& inf
     }
 }
 
-void parseWebPResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& info) {
+void parseWebPResolution(ByteView buffer, ImageHeaderInfo& info) {
     static constexpr char WEBP_RIFF_SIGNATURE[] = "RIFF";
     static constexpr char WEBP_WEBP_SIGNATURE[] = "WEBP";
 
@@ -507,7 +588,7 @@ void parseWebPResolution(const std::vector<uint8_t>& buffer, ImageHeaderInfo& in
 }
 
 // 统一的解析函数
-ImageHeaderInfo parseImageHeader(const std::vector<uint8_t>& buffer) {
+ImageHeaderInfo parseImageHeader(ByteView buffer) {
     ImageHeaderInfo info;
 
     if (buffer.size() < 12) {
@@ -520,7 +601,7 @@ ImageHeaderInfo parseImageHeader(const std::vector<uint8_t>& buffer) {
         size_t length;
         ImageFormat format;
         const char* name;
-        void (*parser)(const std::vector<uint8_t>&, ImageHeaderInfo&);
+        void (*parser)(ByteView, ImageHeaderInfo&);
     };
 
     static constexpr FormatSignature SIGNATURES[] = {
@@ -546,8 +627,10 @@ ImageHeaderInfo parseImageHeader(const std::vector<uint8_t>& buffer) {
     return info;
 }
 
-std::tuple<int, int, ImageFormat> getImageResolutionOptimized(const std::vector<uint8_t>& buffer, ImageFormat fileType) {
-    ImageHeaderInfo headerInfo = parseImageHeader(buffer);
+std::tuple<int, int, ImageFormat> getImageResolutionOptimized(ByteView buffer, ImageFormat fileType) {
+    // the first chunk is enough for almost every file, a jpeg with a large exif or icc segment is parsed again whole
+    ImageHeaderInfo headerInfo = parseImageHeader(ByteView(buffer.data(), std::min(buffer.size(), HEADER_CHUNK_SIZE)));
+    if (!headerInfo.isValid && buffer.size() > HEADER_CHUNK_SIZE) headerInfo = parseImageHeader(buffer);
     if (headerInfo.isValid) {
         fileType = headerInfo.format;
         return {headerInfo.width, headerInfo.height, fileType};
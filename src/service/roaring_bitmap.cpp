@@ -0,0 +1,328 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "roaring_bitmap.h"
+#include <algorithm>
+#include <iterator>
+
+// Container implementation
+
+bool RoaringBitmap::Container::contains(uint16_t low) const {
+    if (isBitset()) return (bits[low >> 6] >> (low & 63)) & 1;
+    return std::binary_search(array.begin(), array.end(), low);
+}
+void RoaringBitmap::Container::add(uint16_t low) {
+    if (isBitset()) {
+        uint64_t mask = uint64_t(1) << (low & 63);
+        if (!(bits[low >> 6] & mask)) {
+            bits[low >> 6] |= mask;
+            cardinality++;
+        }
+        return;
+    }
+    if (array.empty() || array.back() < low) { // fast path for ascending insertion
+        array.push_back(low);
+    } else {
+        auto it = std::lower_bound(array.begin(), array.end(), low);
+        if (it != array.end() && *it == low) return;
+        array.insert(it, low);
+    }
+    cardinality++;
+    if (array.size() > ARRAY_MAX_SIZE) toBitset();
+}
+void RoaringBitmap::Container::toBitset() {
+    if (isBitset()) return;
+    bits.assign(BITSET_WORDS, 0);
+    for (uint16_t low : array) {
+        bits[low >> 6] |= uint64_t(1) << (low & 63);
+    }
+    array.clear();
+    array.shrink_to_fit();
+}
+void RoaringBitmap::Container::normalize() {
+    if (!isBitset() || cardinality > ARRAY_MAX_SIZE) return;
+    array.clear();
+    array.reserve(cardinality);
+    for (size_t word = 0; word < BITSET_WORDS; word++) {
+        uint64_t w = bits[word];
+        while (w) {
+            array.push_back(static_cast<uint16_t>(word * 64 + countTrailingZeros64(w)));
+            w &= w - 1;
+        }
+    }
+    bits.clear();
+    bits.shrink_to_fit();
+}
+
+// container set operations
+
+RoaringBitmap::Container RoaringBitmap::intersect(const Container& a, const Container& b) {
+    Container result;
+    if (a.isBitset() && b.isBitset()) {
+        result.bits.resize(BITSET_WORDS);
+        for (size_t i = 0; i < BITSET_WORDS; i++) {
+            result.bits[i] = a.bits[i] & b.bits[i];
+            result.cardinality += popcount64(result.bits[i]);
+        }
+        result.normalize();
+    } else if (a.isBitset() || b.isBitset()) {
+        const Container& arrayContainer = a.isBitset() ? b : a;
+        const Container& bitsetContainer = a.isBitset() ? a : b;
+        for (uint16_t low : arrayContainer.array) {
+            if (bitsetContainer.contains(low)) result.array.push_back(low);
+        }
+        result.cardinality = static_cast<uint32_t>(result.array.size());
+    } else {
+        std::set_intersection(
+            a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+        result.cardinality = static_cast<uint32_t>(result.array.size());
+    }
+    return result;
+}
+RoaringBitmap::Container RoaringBitmap::unite(const Container& a, const Container& b) {
+    Container result;
+    if (a.isBitset() || b.isBitset()) {
+        result = a.isBitset() ? a : b;
+        const Container& other = a.isBitset() ? b : a;
+        if (other.isBitset()) {
+            result.cardinality = 0;
+            for (size_t i = 0; i < BITSET_WORDS; i++) {
+                result.bits[i] |= other.bits[i];
+                result.cardinality += popcount64(result.bits[i]);
+            }
+        } else {
+            for (uint16_t low : other.array) {
+                result.add(low);
+            }
+        }
+    } else {
+        std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+        result.cardinality = static_cast<uint32_t>(result.array.size());
+        if (result.array.size() > ARRAY_MAX_SIZE) result.toBitset();
+    }
+    return result;
+}
+RoaringBitmap::Container RoaringBitmap::subtract(const Container& a, const Container& b) {
+    Container result;
+    if (a.isBitset()) {
+        result = a;
+        if (b.isBitset()) {
+            result.cardinality = 0;
+            for (size_t i = 0; i < BITSET_WORDS; i++) {
+                result.bits[i] &= ~b.bits[i];
+                result.cardinality += popcount64(result.bits[i]);
+            }
+        } else {
+            for (uint16_t low : b.array) {
+                uint64_t mask = uint64_t(1) << (low & 63);
+                if (result.bits[low >> 6] & mask) {
+                    result.bits[low >> 6] &= ~mask;
+                    result.cardinality--;
+                }
+            }
+        }
+        result.normalize();
+    } else if (b.isBitset()) {
+        for (uint16_t low : a.array) {
+            if (!b.contains(low)) result.array.push_back(low);
+        }
+        result.cardinality = static_cast<uint32_t>(result.array.size());
+    } else {
+        std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(result.array));
+        result.cardinality = static_cast<uint32_t>(result.array.size());
+    }
+    return result;
+}
+uint32_t RoaringBitmap::intersectCardinality(const Container& a, const Container& b) {
+    uint32_t count = 0;
+    if (a.isBitset() && b.isBitset()) {
+        for (size_t i = 0; i < BITSET_WORDS; i++) {
+            count += popcount64(a.bits[i] & b.bits[i]);
+        }
+    } else if (a.isBitset() || b.isBitset()) {
+        const Container& arrayContainer = a.isBitset() ? b : a;
+        const Container& bitsetContainer = a.isBitset() ? a : b;
+        for (uint16_t low : arrayContainer.array) {
+            count += bitsetContainer.contains(low) ? 1 : 0;
+        }
+    } else {
+        auto itA = a.array.begin();
+        auto itB = b.array.begin();
+        while (itA != a.array.end() && itB != b.array.end()) {
+            if (*itA < *itB) {
+                ++itA;
+            } else if (*itB < *itA) {
+                ++itB;
+            } else {
+                count++;
+                ++itA;
+                ++itB;
+            }
+        }
+    }
+    return count;
+}
+
+// RoaringBitmap implementation
+
+RoaringBitmap RoaringBitmap::fromValues(std::vector<uint32_t> values) {
+    std::sort(values.begin(), values.end()); // ascending insertion is the fast path
+    RoaringBitmap result;
+    for (uint32_t value : values) {
+        result.add(value);
+    }
+    return result;
+}
+void RoaringBitmap::add(uint32_t value) {
+    auto high = static_cast<uint16_t>(value >> 16);
+    auto low = static_cast<uint16_t>(value & 0xFFFF);
+    if (keys.empty() || keys.back() < high) { // fast path for ascending insertion
+        keys.push_back(high);
+        containers.emplace_back();
+        containers.back().add(low);
+        return;
+    }
+    auto it = std::lower_bound(keys.begin(), keys.end(), high);
+    size_t index = it - keys.begin();
+    if (it == keys.end() || *it != high) {
+        keys.insert(it, high);
+        containers.insert(containers.begin() + index, Container{});
+    }
+    containers[index].add(low);
+}
+bool RoaringBitmap::contains(uint32_t value) const {
+    auto high = static_cast<uint16_t>(value >> 16);
+    auto it = std::lower_bound(keys.begin(), keys.end(), high);
+    if (it == keys.end() || *it != high) return false;
+    return containers[it - keys.begin()].contains(static_cast<uint16_t>(value & 0xFFFF));
+}
+uint64_t RoaringBitmap::cardinality() const {
+    uint64_t count = 0;
+    for (const auto& container : containers) {
+        count += container.cardinality;
+    }
+    return count;
+}
+size_t RoaringBitmap::sizeInBytes() const {
+    size_t bytes = keys.size() * sizeof(uint16_t);
+    for (const auto& container : containers) {
+        bytes += sizeof(Container) + container.array.size() * sizeof(uint16_t) + container.bits.size() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+RoaringBitmap& RoaringBitmap::operator&=(const RoaringBitmap& other) {
+    std::vector<uint16_t> newKeys;
+    std::vector<Container> newContainers;
+    size_t i = 0, j = 0;
+    while (i < keys.size() && j < other.keys.size()) {
+        if (keys[i] < other.keys[j]) {
+            i++;
+        } else if (other.keys[j] < keys[i]) {
+            j++;
+        } else {
+            Container container = intersect(containers[i], other.containers[j]);
+            if (container.cardinality > 0) {
+                newKeys.push_back(keys[i]);
+                newContainers.push_back(std::move(container));
+            }
+            i++;
+            j++;
+        }
+    }
+    keys = std::move(newKeys);
+    containers = std::move(newContainers);
+    return *this;
+}
+RoaringBitmap& RoaringBitmap::operator|=(const RoaringBitmap& other) {
+    std::vector<uint16_t> newKeys;
+    std::vector<Container> newContainers;
+    newKeys.reserve(keys.size() + other.keys.size());
+    newContainers.reserve(keys.size() + other.keys.size());
+    size_t i = 0, j = 0;
+    while (i < keys.size() || j < other.keys.size()) {
+        if (j >= other.keys.size() || (i < keys.size() && keys[i] < other.keys[j])) {
+            newKeys.push_back(keys[i]);
+            newContainers.push_back(std::move(containers[i]));
+            i++;
+        } else if (i >= keys.size() || other.keys[j] < keys[i]) {
+            newKeys.push_back(other.keys[j]);
+            newContainers.push_back(other.containers[j]);
+            j++;
+        } else {
+            newKeys.push_back(keys[i]);
+            newContainers.push_back(unite(containers[i], other.containers[j]));
+            i++;
+            j++;
+        }
+    }
+    keys = std::move(newKeys);
+    containers = std::move(newContainers);
+    return *this;
+}
+RoaringBitmap& RoaringBitmap::operator-=(const RoaringBitmap& other) {
+    std::vector<uint16_t> newKeys;
+    std::vector<Container> newContainers;
+    size_t j = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        while (j < other.keys.size() && other.keys[j] < keys[i]) {
+            j++;
+        }
+        if (j < other.keys.size() && other.keys[j] == keys[i]) {
+            Container container = subtract(containers[i], other.containers[j]);
+            if (container.cardinality == 0) continue;
+            newKeys.push_back(keys[i]);
+            newContainers.push_back(std::move(container));
+        } else {
+            newKeys.push_back(keys[i]);
+            newContainers.push_back(std::move(containers[i]));
+        }
+    }
+    keys = std::move(newKeys);
+    containers = std::move(newContainers);
+    return *this;
+}
+uint64_t RoaringBitmap::andCardinality(const RoaringBitmap& other) const {
+    uint64_t count = 0;
+    size_t i = 0, j = 0;
+    while (i < keys.size() && j < other.keys.size()) {
+        if (keys[i] < other.keys[j]) {
+            i++;
+        } else if (other.keys[j] < keys[i]) {
+            j++;
+        } else {
+            count += intersectCardinality(containers[i], other.containers[j]);
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+RoaringBitmap RoaringBitmap::sample(size_t step) const {
+    RoaringBitmap result;
+    for (size_t i = 0; i < keys.size(); i += step) {
+        result.keys.push_back(keys[i]);
+        result.containers.push_back(containers[i]);
+    }
+    return result;
+}
+std::vector<uint32_t> RoaringBitmap::toVector() const {
+    std::vector<uint32_t> values;
+    values.reserve(cardinality());
+    forEach([&values](uint32_t value) { values.push_back(value); });
+    return values;
+}
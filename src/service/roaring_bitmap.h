@@ -0,0 +1,111 @@
+/*
+ * Waifu Gallery - A anime illustration gallery application.
+ * Copyright (C) 2025 R4nd5tr <r4nd5tr@outlook.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline int popcount64(uint64_t x) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(x));
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+inline int countTrailingZeros64(uint64_t x) { // x must not be 0
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// compressed bitmap of 32-bit values, values are split by their high 16 bits into containers,
+// sparse containers store sorted low 16 bits, dense containers store a 65536-bit bitset
+class RoaringBitmap {
+public:
+    RoaringBitmap() = default;
+    static RoaringBitmap fromValues(std::vector<uint32_t> values); // values may be unsorted
+
+    void add(uint32_t value);
+    bool contains(uint32_t value) const;
+    uint64_t cardinality() const;
+    bool empty() const { return keys.empty(); }
+    void clear() {
+        keys.clear();
+        containers.clear();
+    }
+    size_t sizeInBytes() const;
+
+    RoaringBitmap& operator&=(const RoaringBitmap& other);
+    RoaringBitmap& operator|=(const RoaringBitmap& other);
+    RoaringBitmap& operator-=(const RoaringBitmap& other); // and-not
+    uint64_t andCardinality(const RoaringBitmap& other) const;
+    RoaringBitmap sample(size_t step) const; // every step-th container, a uniform sample if values are in random order
+
+    std::vector<uint32_t> toVector() const;
+    template <typename Func> void forEach(Func&& func) const { // values are visited in ascending order
+        for (size_t i = 0; i < keys.size(); i++) {
+            uint32_t high = static_cast<uint32_t>(keys[i]) << 16;
+            const Container& container = containers[i];
+            if (container.isBitset()) {
+                for (size_t word = 0; word < BITSET_WORDS; word++) {
+                    uint64_t bits = container.bits[word];
+                    while (bits) {
+                        func(high | static_cast<uint32_t>(word * 64 + countTrailingZeros64(bits)));
+                        bits &= bits - 1;
+                    }
+                }
+            } else {
+                for (uint16_t low : container.array) {
+                    func(high | low);
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t ARRAY_MAX_SIZE = 4096; // above this a bitset is smaller than an array
+    static constexpr size_t BITSET_WORDS = 1024;   // 65536 bits
+
+    struct Container {
+        std::vector<uint16_t> array; // sorted low 16 bits, used while sparse
+        std::vector<uint64_t> bits;  // BITSET_WORDS words, used when dense
+        uint32_t cardinality = 0;
+
+        bool isBitset() const { return !bits.empty(); }
+        bool contains(uint16_t low) const;
+        void add(uint16_t low);
+        void toBitset();
+        void normalize(); // convert back to array if sparse enough
+    };
+
+    std::vector<uint16_t> keys;        // sorted high 16 bits
+    std::vector<Container> containers; // corresponds to keys
+
+    static Container intersect(const Container& a, const Container& b);
+    static Container unite(const Container& a, const Container& b);
+    static Container subtract(const Container& a, const Container& b);
+    static uint32_t intersectCardinality(const Container& a, const Container& b);
+};
@@ -216,9 +216,7 @@ void Tagger::analyzeThreadFunc() {
         return;
     }
 
-    threadDb.updateTagCounts();
-
-    if (!threadDb.commitTransaction()) {
+    if (!threadDb.commitTransaction()) { // tag counts are updated with the commit
         Error() << "Failed to commit tagging transaction, rolling back.";
         threadDb.rollbackTransaction();
     }
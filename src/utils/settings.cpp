@@ -28,8 +28,11 @@ uint32_t Settings::windowWidth = 1200;
 uint32_t Settings::windowHeight = 800;
 std::vector<std::pair<std::filesystem::path, ParserType>> Settings::picDirectories;
 bool Settings::autoImportOnStartup = false;
+bool Settings::watchPicDirectories = false;
 bool Settings::autoTagAfterImport = false;
 std::filesystem::path Settings::autoTaggerDLLPath = "";
+uint32_t Settings::imageCacheSizeMB = 512;
+bool Settings::approximateTagCounts = false;
 std::filesystem::path Settings::settingsFilePath = DEFALT_SETTINGS_FILE_PATH;
 
 void Settings::loadSettings(const std::filesystem::path& path) {
@@ -56,8 +59,11 @@ void Settings::loadSettings(const std::filesystem::path& path) {
                 }
             }
             autoImportOnStartup = j.value("autoImportOnStartup", false);
+            watchPicDirectories = j.value("watchPicDirectories", false);
             autoTagAfterImport = j.value("autoTagAfterImport", false);
             autoTaggerDLLPath = j.value("autoTaggerDLLPath", "");
+            imageCacheSizeMB = j.value("imageCacheSizeMB", 512);
+            approximateTagCounts = j.value("approximateTagCounts", false);
         } else {
             Info() << "Settings file not found. Using default settings.";
         }
@@ -82,8 +88,11 @@ void Settings::saveSettings() {
             j["picDirectories"].push_back({pair.first.string(), static_cast<int>(pair.second)});
         }
         j["autoImportOnStartup"] = autoImportOnStartup;
+        j["watchPicDirectories"] = watchPicDirectories;
         j["autoTagAfterImport"] = autoTagAfterImport;
         j["autoTaggerDLLPath"] = autoTaggerDLLPath.string();
+        j["imageCacheSizeMB"] = imageCacheSizeMB;
+        j["approximateTagCounts"] = approximateTagCounts;
 
         std::ofstream outFile(settingsFilePath);
         outFile << j.dump(4);
@@ -40,8 +40,11 @@ public:
     static uint32_t windowHeight;
     static std::vector<std::pair<std::filesystem::path, ParserType>> picDirectories;
     static bool autoImportOnStartup;
+    static bool watchPicDirectories; // import new files of picDirectories as they arrive
     static bool autoTagAfterImport;
     static std::filesystem::path autoTaggerDLLPath;
+    static uint32_t imageCacheSizeMB;  // decoded thumbnails and previews kept in memory, read at startup
+    static bool approximateTagCounts; // count available tags of huge search results from a sample
 
 private:
     static std::filesystem::path settingsFilePath;